@@ -0,0 +1,137 @@
+#ifndef MEMORY_ARENA_H
+#define MEMORY_ARENA_H
+
+#include <cstddef>
+#include <juce_core/juce_core.h>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+/**
+ * @brief One block of memory that holds the simulation and filter state of
+ * an instance, handed out in cache-line aligned pieces.
+ *
+ * The block is mapped when the instance is prepared, backed by 2 MB pages
+ * where the system provides them and the block is large enough to fill
+ * one, locked against paging and touched page by page, so the audio thread
+ * neither takes a TLB miss per 4 kB of a large grid nor a page fault on the
+ * first strike after the host has been idle. Locking is best effort: it is
+ * skipped quietly when the system limit on locked memory is reached.
+ */
+class MemoryArena final {
+public:
+    /** Alignment of every piece, one cache line */
+    static constexpr size_t alignment = 64;
+
+    /**
+     * @brief Constructs an empty MemoryArena.
+     */
+    MemoryArena() = default;
+
+    /**
+     * @brief Destructor for MemoryArena. Unmaps the block.
+     */
+    ~MemoryArena();
+
+    /**
+     * @brief Gets the room a piece of an array takes in the arena.
+     * @tparam T The type of the elements.
+     * @param count The number of elements.
+     * @return The size of the piece in bytes, a multiple of the alignment.
+     */
+    template<typename T>
+    static constexpr size_t sizeFor(const size_t count) {
+        return (count * sizeof(T) + alignment - 1) / alignment * alignment;
+    }
+
+    /**
+     * @brief Makes room for a number of bytes and takes back every piece.
+     * Keeps the block if it is large enough, otherwise maps a new one. The
+     * previous block stays mapped until the next new block, because other
+     * threads such as the editor may still read it. Not real-time safe.
+     * @param numBytes The total size of the pieces to allocate.
+     */
+    void reserve(size_t numBytes);
+
+    /**
+     * @brief Hands out a value-initialized, cache-line aligned array.
+     * Not real-time safe, it writes every byte of the piece.
+     * @tparam T The type of the elements, trivially destructible.
+     * @param count The number of elements.
+     * @return The array, or nullptr if the reserved room is used up.
+     */
+    template<typename T>
+    T *allocate(const size_t count) {
+        static_assert(std::is_trivially_destructible_v<T> &&
+                              alignof(T) <= alignment,
+                      "pieces are never destroyed and are cache-line aligned");
+        const size_t size = sizeFor<T>(count);
+        if (block == nullptr || used + size > capacity) {
+            jassertfalse;
+            return nullptr;
+        }
+        auto *piece = reinterpret_cast<T *>(block + used);
+        used += size;
+        std::uninitialized_value_construct_n(piece, count);
+        return std::launder(piece);
+    }
+
+    /**
+     * @brief Unmaps every block. Not real-time safe.
+     */
+    void release();
+
+    /**
+     * @brief Checks whether the block is backed by 2 MB pages.
+     * @return True if the system granted huge pages.
+     */
+    [[nodiscard]] bool usesHugePages() const { return hugePages; }
+
+    /**
+     * @brief Checks whether the block is locked against paging.
+     * @return True if the block is locked.
+     */
+    [[nodiscard]] bool isLocked() const { return locked; }
+
+    /**
+     * @brief Gets the size of the block.
+     * @return The size in bytes.
+     */
+    [[nodiscard]] size_t getCapacity() const { return capacity; }
+
+private:
+    /**
+     * @brief Maps, locks and touches a new block.
+     * @param numBytes The smallest size of the block.
+     */
+    void map(size_t numBytes);
+
+    /**
+     * @brief Unlocks and unmaps a block.
+     * @param address The start of the block.
+     * @param size The size of the block.
+     * @param wasHuge Whether the block is backed by huge pages.
+     * @param wasLocked Whether the block is locked.
+     */
+    static void unmap(std::byte *address, size_t size, bool wasHuge,
+                      bool wasLocked);
+
+    /** The current block and its size */
+    std::byte *block = nullptr;
+    size_t capacity = 0;
+
+    /** Bytes handed out from the current block */
+    size_t used = 0;
+
+    /** Whether the current block uses huge pages and is locked */
+    bool hugePages = false, locked = false;
+
+    /** The block replaced last, kept for readers on other threads */
+    std::byte *retiredBlock = nullptr;
+    size_t retiredCapacity = 0;
+    bool retiredHugePages = false, retiredLocked = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MemoryArena)
+};
+
+#endif // MEMORY_ARENA_H
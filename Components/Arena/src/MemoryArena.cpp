@@ -0,0 +1,172 @@
+#include "MemoryArena.h"
+#include <cstdint>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <mach/vm_statistics.h>
+#endif
+#define PDRUM_HAS_MMAP 1
+#endif
+
+/** Size of a huge page */
+static constexpr size_t hugePageSize = size_t{2} << 20;
+
+/**
+ * @brief Rounds a size up to a multiple of a granularity.
+ * @param size The size.
+ * @param granularity The granularity, a power of two.
+ * @return The rounded size.
+ */
+static size_t roundUp(const size_t size, const size_t granularity) {
+    return (size + granularity - 1) & ~(granularity - 1);
+}
+
+/**
+ * @brief Destructor for MemoryArena. Unmaps the block.
+ */
+MemoryArena::~MemoryArena() { release(); }
+
+/**
+ * @brief Makes room for a number of bytes and takes back every piece.
+ * Keeps the block if it is large enough, otherwise maps a new one. The
+ * previous block stays mapped until the next new block, because other
+ * threads such as the editor may still read it. Not real-time safe.
+ * @param numBytes The total size of the pieces to allocate.
+ */
+void MemoryArena::reserve(const size_t numBytes) {
+    used = 0;
+    if (block != nullptr && numBytes <= capacity)
+        return;
+    if (retiredBlock != nullptr)
+        unmap(retiredBlock, retiredCapacity, retiredHugePages, retiredLocked);
+    retiredBlock = block;
+    retiredCapacity = capacity;
+    retiredHugePages = hugePages;
+    retiredLocked = locked;
+    block = nullptr;
+    capacity = 0;
+    hugePages = locked = false;
+    if (numBytes > 0)
+        map(numBytes);
+}
+
+/**
+ * @brief Unmaps every block. Not real-time safe.
+ */
+void MemoryArena::release() {
+    if (retiredBlock != nullptr)
+        unmap(retiredBlock, retiredCapacity, retiredHugePages, retiredLocked);
+    if (block != nullptr)
+        unmap(block, capacity, hugePages, locked);
+    retiredBlock = block = nullptr;
+    retiredCapacity = capacity = used = 0;
+    retiredHugePages = retiredLocked = hugePages = locked = false;
+}
+
+/**
+ * @brief Maps, locks and touches a new block.
+ * @param numBytes The smallest size of the block.
+ */
+void MemoryArena::map(const size_t numBytes) {
+    /// A block smaller than a huge page would only waste the rest of it
+    const bool wantHugePages = numBytes >= hugePageSize;
+#if defined(_WIN32)
+    /// Large pages need the lock pages privilege, most users lack it
+    if (const size_t largePage = GetLargePageMinimum();
+        wantHugePages && largePage > 0) {
+        const size_t size = roundUp(numBytes, largePage);
+        if (void *address = VirtualAlloc(
+                    nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                    PAGE_READWRITE)) {
+            /// Large pages are always resident
+            block = static_cast<std::byte *>(address);
+            capacity = size;
+            hugePages = locked = true;
+            return;
+        }
+    }
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    const size_t size = roundUp(numBytes, info.dwPageSize);
+    block = static_cast<std::byte *>(VirtualAlloc(
+            nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+    if (block == nullptr)
+        throw std::bad_alloc();
+    capacity = size;
+    locked = VirtualLock(block, size) != 0;
+    const size_t pageSize = info.dwPageSize;
+#elif PDRUM_HAS_MMAP
+    const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t size =
+            roundUp(numBytes, wantHugePages ? hugePageSize : pageSize);
+    void *address = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+    /// Explicit huge pages come from a pool the administrator sets up
+    if (wantHugePages)
+        address = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    hugePages = address != MAP_FAILED;
+#elif defined(VM_FLAGS_SUPERPAGE_SIZE_2MB)
+    if (wantHugePages)
+        address = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANON, VM_FLAGS_SUPERPAGE_SIZE_2MB, 0);
+    hugePages = address != MAP_FAILED;
+#endif
+    if (address == MAP_FAILED) {
+        address = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (address == MAP_FAILED)
+            throw std::bad_alloc();
+#if defined(MADV_HUGEPAGE)
+        /// Otherwise ask for transparent huge pages, which need no setup
+        if (wantHugePages)
+            hugePages = madvise(address, size, MADV_HUGEPAGE) == 0;
+#endif
+    }
+    block = static_cast<std::byte *>(address);
+    capacity = size;
+    locked = mlock(block, size) == 0;
+#else
+    const size_t pageSize = 4096;
+    const size_t size = roundUp(numBytes, pageSize);
+    block = static_cast<std::byte *>(
+            ::operator new(size, std::align_val_t{alignment}));
+    capacity = size;
+#endif
+    /// Fault every page in now rather than on the audio thread
+    for (size_t offset = 0; offset < capacity; offset += pageSize)
+        block[offset] = std::byte{0};
+}
+
+/**
+ * @brief Unlocks and unmaps a block.
+ * @param address The start of the block.
+ * @param size The size of the block.
+ * @param wasHuge Whether the block is backed by huge pages.
+ * @param wasLocked Whether the block is locked.
+ */
+void MemoryArena::unmap(std::byte *address, const size_t size,
+                        const bool wasHuge, const bool wasLocked) {
+#if defined(_WIN32)
+    if (wasLocked && !wasHuge)
+        VirtualUnlock(address, size);
+    VirtualFree(address, 0, MEM_RELEASE);
+#elif PDRUM_HAS_MMAP
+    juce::ignoreUnused(wasHuge);
+    if (wasLocked)
+        munlock(address, size);
+    munmap(address, size);
+#else
+    juce::ignoreUnused(size, wasHuge, wasLocked);
+    ::operator delete(address, std::align_val_t{alignment});
+#endif
+}
@@ -0,0 +1,131 @@
+#ifndef UI_EVENT_QUEUE_H
+#define UI_EVENT_QUEUE_H
+
+#include <algorithm>
+#include <array>
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <juce_core/juce_core.h>
+
+/**
+ * @brief Hands strikes and notes from the editor to the audio thread.
+ *
+ * A fixed-capacity single-producer single-consumer queue: the message
+ * thread posts, the audio thread drains once per block. Both sides are
+ * wait-free, so the editor never touches the simulation state and the
+ * audio thread never takes a lock. Events are stamped with the time they
+ * were posted and land in the block at the same distance from its end,
+ * so their spacing is kept at the cost of at most one block of delay.
+ */
+class UiEventQueue final : public juce::MidiKeyboardState::Listener {
+public:
+    /**
+     * @brief A strike or note posted by the editor.
+     */
+    struct Event {
+        /**
+         * @brief Kinds of events.
+         */
+        enum class Type {
+            /** Strike at a grid cell */
+            strike,
+            /** Key pressed on the on-screen keyboard */
+            noteOn,
+            /** Key released on the on-screen keyboard */
+            noteOff
+        };
+
+        /** Kind of the event */
+        Type type = Type::strike;
+        /** Grid column of a strike */
+        int x = 0;
+        /** Grid row of a strike */
+        int y = 0;
+        /** Amplitude of a strike or velocity of a note */
+        float amplitude = 0.0f;
+        /** Note number of a note */
+        int noteNumber = 0;
+        /** Time the event was posted, in milliseconds */
+        double time = 0.0;
+    };
+
+    /**
+     * @brief Constructs an empty UiEventQueue.
+     */
+    UiEventQueue() = default;
+
+    /**
+     * @brief Post a strike at a grid cell. Call from the message thread.
+     * @param amplitude The amplitude of the strike.
+     * @param x The grid column.
+     * @param y The grid row.
+     * @return False if the queue is full and the strike was dropped.
+     */
+    bool postStrike(float amplitude, int x, int y);
+
+    /**
+     * @brief Posts a note-on of the on-screen keyboard.
+     * @param noteNumber The note number.
+     * @param velocity The velocity of the note.
+     */
+    void handleNoteOn(juce::MidiKeyboardState *, int, int noteNumber,
+                      float velocity) override;
+
+    /**
+     * @brief Posts a note-off of the on-screen keyboard.
+     * @param noteNumber The note number.
+     * @param velocity The release velocity of the note.
+     */
+    void handleNoteOff(juce::MidiKeyboardState *, int, int noteNumber,
+                       float velocity) override;
+
+    /**
+     * @brief Hand every posted event to a handler with its position in the
+     * current block. Call from the audio thread, once per block.
+     * @tparam Handler A callable taking the event and its sample offset.
+     * @param numSamples The number of samples of the block.
+     * @param sampleRate The sample rate of the audio stream.
+     * @param handle Called for each event in the order it was posted.
+     */
+    template<typename Handler>
+    void drain(const int numSamples, const double sampleRate,
+               Handler &&handle) {
+        const double now = juce::Time::getMillisecondCounterHiRes();
+        const auto offsetOf = [&](const Event &event) {
+            const int age = juce::roundToInt((now - event.time) * 0.001 *
+                                             sampleRate);
+            return std::clamp(numSamples - age, 0, numSamples - 1);
+        };
+        const auto scope = fifo.read(fifo.getNumReady());
+        for (int i = 0; i < scope.blockSize1; ++i) {
+            const auto &event =
+                    events[static_cast<size_t>(scope.startIndex1 + i)];
+            handle(event, offsetOf(event));
+        }
+        for (int i = 0; i < scope.blockSize2; ++i) {
+            const auto &event =
+                    events[static_cast<size_t>(scope.startIndex2 + i)];
+            handle(event, offsetOf(event));
+        }
+    }
+
+private:
+    /**
+     * @brief Stamp an event and append it to the queue.
+     * @param event The event to post.
+     * @return False if the queue is full and the event was dropped.
+     */
+    bool post(Event event);
+
+    /** Number of events the queue holds */
+    static constexpr int capacity = 256;
+
+    /** Posted events */
+    std::array<Event, capacity> events;
+
+    /** Read and write positions of the queue */
+    juce::AbstractFifo fifo{capacity};
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(UiEventQueue)
+};
+
+#endif // UI_EVENT_QUEUE_H
@@ -0,0 +1,47 @@
+#include "UiEventQueue.h"
+
+/**
+ * @brief Post a strike at a grid cell. Call from the message thread.
+ * @param amplitude The amplitude of the strike.
+ * @param x The grid column.
+ * @param y The grid row.
+ * @return False if the queue is full and the strike was dropped.
+ */
+bool UiEventQueue::postStrike(const float amplitude, const int x,
+                              const int y) {
+    return post({Event::Type::strike, x, y, amplitude});
+}
+
+/**
+ * @brief Posts a note-on of the on-screen keyboard.
+ * @param noteNumber The note number.
+ * @param velocity The velocity of the note.
+ */
+void UiEventQueue::handleNoteOn(juce::MidiKeyboardState *, int,
+                                const int noteNumber, const float velocity) {
+    post({Event::Type::noteOn, 0, 0, velocity, noteNumber});
+}
+
+/**
+ * @brief Posts a note-off of the on-screen keyboard.
+ * @param noteNumber The note number.
+ * @param velocity The release velocity of the note.
+ */
+void UiEventQueue::handleNoteOff(juce::MidiKeyboardState *, int,
+                                 const int noteNumber, const float velocity) {
+    post({Event::Type::noteOff, 0, 0, velocity, noteNumber});
+}
+
+/**
+ * @brief Stamp an event and append it to the queue.
+ * @param event The event to post.
+ * @return False if the queue is full and the event was dropped.
+ */
+bool UiEventQueue::post(Event event) {
+    event.time = juce::Time::getMillisecondCounterHiRes();
+    const auto scope = fifo.write(1);
+    if (scope.blockSize1 == 0)
+        return false;
+    events[static_cast<size_t>(scope.startIndex1)] = event;
+    return true;
+}
@@ -0,0 +1,120 @@
+#ifndef QUALITY_GOVERNOR_H
+#define QUALITY_GOVERNOR_H
+
+#include <atomic>
+#include <juce_core/juce_core.h>
+
+/**
+ * @brief Steps the quality of the synthesis down a ladder of levels while
+ * rendering takes too much of the time a block lasts, and back up once the
+ * headroom has returned.
+ *
+ * The thread that renders reports how long each block took. The share of
+ * the block duration it took is smoothed over about a tenth of a second,
+ * so a single late block caused by the host or the system moves nothing.
+ * A load above stepDownLoad held for pressureSeconds lowers the level by
+ * one; a load below stepUpLoad held for headroomSeconds raises it by one.
+ * The wide gap between the two thresholds and the long wait before a step
+ * up keep the level from flapping between two rungs, and no step is taken
+ * within settleSeconds of the last, so the load of the new level is
+ * measured before the next decision. What each level means is up to the
+ * owner.
+ */
+class QualityGovernor final {
+public:
+    /**
+     * @brief Constructs a QualityGovernor at full quality.
+     */
+    QualityGovernor() = default;
+
+    /**
+     * @brief Returns to full quality and forgets the measured load.
+     * @param levels The number of levels, full quality included.
+     */
+    void reset(int levels);
+
+    /**
+     * @brief Accounts for a rendered block and steps the level when the
+     * load calls for it. Called by the thread that renders; wait-free.
+     * @param seconds The time taken to render the block.
+     * @param numSamples The number of samples of the block.
+     * @param sampleRate The sample rate of the audio stream.
+     * @return True if the level changed.
+     */
+    bool addBlock(double seconds, int numSamples, double sampleRate);
+
+    /**
+     * @brief Gets the current level.
+     * @return The level, 0 for full quality.
+     */
+    [[nodiscard]] int getLevel() const { return level.load(); }
+
+    /**
+     * @brief Gets the smoothed share of the block duration rendering takes.
+     * @return The load, 1 when rendering takes as long as playing.
+     */
+    [[nodiscard]] float getLoad() const { return load.load(); }
+
+    /**
+     * @brief Gets the number of level changes since the last reset, so a
+     * reader can tell when a new one happened.
+     * @return The number of level changes.
+     */
+    [[nodiscard]] int getNumTransitions() const {
+        return numTransitions.load();
+    }
+
+    /**
+     * @brief Gets the load that caused the latest level change.
+     * @return The load at the latest level change.
+     */
+    [[nodiscard]] float getTransitionLoad() const {
+        return transitionLoad.load();
+    }
+
+    /** Load held for pressureSeconds that lowers the level */
+    static constexpr float stepDownLoad = 0.8f;
+
+    /** Load held for headroomSeconds that raises the level */
+    static constexpr float stepUpLoad = 0.45f;
+
+    /** Seconds of pressure before the level is lowered */
+    static constexpr double pressureSeconds = 0.25;
+
+    /** Seconds of headroom before the level is raised */
+    static constexpr double headroomSeconds = 3.0;
+
+    /** Seconds after a level change before the next one */
+    static constexpr double settleSeconds = 1.0;
+
+    /** Time constant of the load smoothing, in seconds */
+    static constexpr double smoothingSeconds = 0.1;
+
+private:
+    /**
+     * @brief Moves to another level and starts measuring it afresh.
+     * @param newLevel The level to move to.
+     */
+    void changeLevel(int newLevel);
+
+    /** Number of levels, full quality included */
+    int numLevels = 1;
+
+    /** Current level, 0 for full quality */
+    std::atomic<int> level{0};
+
+    /** Smoothed load */
+    std::atomic<float> load{0.0f};
+
+    /** Number of level changes and the load that caused the latest */
+    std::atomic<int> numTransitions{0};
+    std::atomic<float> transitionLoad{0.0f};
+
+    /** Seconds of audio the load has been above stepDownLoad, below
+     * stepUpLoad, and since the last level change; renderer only */
+    double pressureTime = 0.0, headroomTime = 0.0, settleTime = 0.0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(QualityGovernor)
+};
+
+#endif // QUALITY_GOVERNOR_H
@@ -0,0 +1,66 @@
+#include "QualityGovernor.h"
+#include <algorithm>
+#include <cmath>
+
+/**
+ * @brief Returns to full quality and forgets the measured load.
+ * @param levels The number of levels, full quality included.
+ */
+void QualityGovernor::reset(const int levels) {
+    numLevels = std::max(1, levels);
+    level.store(0);
+    load.store(0.0f);
+    numTransitions.store(0);
+    transitionLoad.store(0.0f);
+    pressureTime = headroomTime = 0.0;
+    settleTime = settleSeconds;
+}
+
+/**
+ * @brief Accounts for a rendered block and steps the level when the
+ * load calls for it. Called by the thread that renders; wait-free.
+ * @param seconds The time taken to render the block.
+ * @param numSamples The number of samples of the block.
+ * @param sampleRate The sample rate of the audio stream.
+ * @return True if the level changed.
+ */
+bool QualityGovernor::addBlock(const double seconds, const int numSamples,
+                               const double sampleRate) {
+    if (numSamples <= 0 || sampleRate <= 0.0)
+        return false;
+    const double duration = numSamples / sampleRate;
+    /// Weigh each block by its duration, so the smoothing does not depend
+    /// on the block size
+    const auto weight = static_cast<float>(
+            1.0 - std::exp(-duration / smoothingSeconds));
+    float smoothed = load.load(std::memory_order_relaxed);
+    smoothed += weight * (static_cast<float>(seconds / duration) - smoothed);
+    load.store(smoothed, std::memory_order_relaxed);
+
+    pressureTime = smoothed > stepDownLoad ? pressureTime + duration : 0.0;
+    headroomTime = smoothed < stepUpLoad ? headroomTime + duration : 0.0;
+    settleTime += duration;
+    if (settleTime < settleSeconds)
+        return false;
+    const int current = level.load(std::memory_order_relaxed);
+    if (pressureTime >= pressureSeconds && current + 1 < numLevels) {
+        changeLevel(current + 1);
+        return true;
+    }
+    if (headroomTime >= headroomSeconds && current > 0) {
+        changeLevel(current - 1);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Moves to another level and starts measuring it afresh.
+ * @param newLevel The level to move to.
+ */
+void QualityGovernor::changeLevel(const int newLevel) {
+    transitionLoad.store(load.load(std::memory_order_relaxed));
+    level.store(newLevel);
+    numTransitions.fetch_add(1);
+    pressureTime = headroomTime = settleTime = 0.0;
+}
@@ -0,0 +1,267 @@
+#ifndef HIT_CACHE_ENGINE_H
+#define HIT_CACHE_ENGINE_H
+
+#include <array>
+#include <atomic>
+#include <juce_audio_utils/juce_audio_utils.h>
+#include <juce_core/juce_core.h>
+#include <random>
+#include <utility>
+#include <vector>
+#include "MembraneBatch.h"
+#include "ModalResonatorModel.h"
+
+/**
+ * @brief Plays strikes from a cache of rendered drum hits.
+ *
+ * A background thread renders the response of the membrane and the modal
+ * body to a single strike from silence, for a lattice of strike positions
+ * covering the randomness range, and renders them again whenever a
+ * parameter of the sound changes. The membranes of eight positions are
+ * simulated together in a MembraneBatch. The audio thread only mixes scaled
+ * copies of these responses, so a strike costs a few multiply-adds per
+ * sample however fine the membrane grid is.
+ *
+ * Every hit rings on its own: a new strike does not move the pickup of
+ * the hits still ringing, as it does on the simulated membrane. Explicit
+ * strike positions outside the lattice are not covered and are left to
+ * the simulation.
+ */
+class HitCacheEngine final : juce::AudioProcessorValueTreeState::Listener,
+                             juce::Thread {
+public:
+    /**
+     * @brief Constructs a HitCacheEngine.
+     * @param state The AudioProcessorValueTreeState with the parameters of
+     * the sound.
+     * @param gridResolution Resolution of the membrane grid to render with.
+     */
+    HitCacheEngine(juce::AudioProcessorValueTreeState &state,
+                   int gridResolution);
+
+    /**
+     * @brief Destructor for HitCacheEngine. Stops the render thread.
+     */
+    ~HitCacheEngine() override;
+
+    /**
+     * @brief Allocate the responses, silence every hit and start rendering
+     * the cache. Not real-time safe.
+     * @param newSampleRate The sample rate of the audio stream.
+     */
+    void prepare(double newSampleRate);
+
+    /**
+     * @brief Stop the render thread.
+     */
+    void release();
+
+    /**
+     * @brief Set the size of the mode set of the drum body. Takes effect on
+     * the next call to prepare.
+     * @param numRadialModes The number of Bessel zeros to use.
+     * @param numAxialModes The number of axial orders per Bessel zero.
+     */
+    void setModeCount(int numRadialModes, int numAxialModes);
+
+    /**
+     * @brief Seeds the random number generator for the strike positions.
+     * @param seed The seed for the random number generator.
+     */
+    void setRandomSeed(uint32_t seed) { rng.seed(seed); }
+
+    /**
+     * @brief Checks whether a strike position is close enough to the
+     * lattice to be played from the cache. Strikes near the centre always
+     * are; explicit positions further out, such as editor strikes near the
+     * rim, should be simulated instead.
+     * @param x The grid column, or -1 to strike near the centre.
+     * @param y The grid row, or -1 to strike near the centre.
+     * @return True if the cache has a response for the position.
+     */
+    [[nodiscard]] bool covers(int x, int y) const;
+
+    /**
+     * @brief Start a hit from the cached response nearest to the strike
+     * position. Steals the oldest hit if the voice limit is reached.
+     * @param amplitude The amplitude of the strike.
+     * @param x The grid column, or -1 to strike near the centre.
+     * @param y The grid row, or -1 to strike near the centre.
+     * @param waitForRender Wait for a response that is not rendered yet
+     * instead of dropping the strike, for offline rendering.
+     */
+    void strike(float amplitude, int x, int y, bool waitForRender);
+
+    /**
+     * @brief Sets the number of hits that ring at once. Hits above a lowered
+     * limit ring out, later strikes steal the oldest instead. Call from the
+     * audio thread.
+     * @param limit The number of hits, at most maxVoices.
+     */
+    void setVoiceLimit(const int limit) {
+        voiceLimit = juce::jlimit(1, maxVoices, limit);
+    }
+
+    /**
+     * @brief Mix the ringing hits into the output.
+     * @param output Adds the samples to this.
+     * @param numSamples The number of samples to render.
+     */
+    void render(float *output, int numSamples);
+
+    /** Largest number of hits ringing at once */
+    static constexpr int maxVoices = 32;
+
+private:
+    /**
+     * @brief The response to one strike position. Holds two buffers, so a
+     * new response is rendered while hits still play the old one.
+     */
+    struct Slot {
+        /** Rendered responses */
+        std::array<std::vector<float>, 2> responses;
+        /** Length of each response */
+        std::array<int, 2> lengths{};
+        /** Index of the response new hits play, -1 before the first */
+        std::atomic<int> published{-1};
+        /** Number of hits playing each response */
+        std::array<std::atomic<int>, 2> listeners{};
+    };
+
+    /**
+     * @brief A ringing hit.
+     */
+    struct Voice {
+        /** Slot of the response, null if the voice is free */
+        Slot *slot = nullptr;
+        /** Index of the response in the slot */
+        int response = 0;
+        /** Position of the next sample in the response */
+        int position = 0;
+        /** Amplitude of the strike */
+        float gain = 0.0f;
+    };
+
+    /**
+     * @brief Handles parameter changes from the AudioProcessorValueTreeState.
+     * @param parameterID The ID of the parameter that changed.
+     * @param newValue The new value of the parameter.
+     */
+    void parameterChanged(const juce::String &parameterID,
+                          float newValue) override;
+
+    /**
+     * @brief Render every response of the lattice, centre first, and start
+     * over whenever a parameter changes.
+     */
+    void run() override;
+
+    /**
+     * @brief Render the responses of up to one slot per membrane lane into
+     * the buffers no hit is playing and publish them.
+     * @param indices The indices of the slots.
+     * @param numSlots The number of slots, at most MembraneBatch::numLanes.
+     * @param size The number of lattice positions along each axis.
+     * @param spacing The distance between two lattice positions.
+     * @return False if the render was abandoned for newer parameters.
+     */
+    bool renderSlots(const int *indices, int numSlots, int size,
+                     float spacing);
+
+    /**
+     * @brief Gets the strike offset of a lattice position.
+     * @param position The index of the position along one axis.
+     * @param size The number of lattice positions along each axis.
+     * @param spacing The distance between two lattice positions.
+     * @return The offset from the center, in cells.
+     */
+    static int latticeOffset(int position, int size, float spacing);
+
+    /**
+     * @brief Maps a strike offset onto the nearest lattice position.
+     * @param offset The offset of the strike from the center, in cells.
+     * @return The index of the lattice position along one axis.
+     */
+    [[nodiscard]] int latticeIndex(float offset) const;
+
+    /**
+     * @brief Stop a voice and let the render thread reuse its response.
+     * @param voice The voice to stop.
+     */
+    static void stopVoice(Voice &voice);
+
+    /**
+     * @brief Gets the offset of an explicit strike position from the
+     * center, as exciteOffset counts it.
+     * @param x The grid column.
+     * @param y The grid row.
+     * @return The column and row offset.
+     */
+    [[nodiscard]] std::pair<int, int> offsetOf(int x, int y) const;
+
+    /** Lattice positions along each axis */
+    static constexpr int positionsPerAxis = 5;
+
+
+    /** Longest response, in seconds */
+    static constexpr double maxResponseSeconds = 2.0;
+
+    /** Level below which a response counts as silent */
+    static constexpr float silenceThreshold = 1.0e-6f;
+
+    /** Silent samples that end a response */
+    static constexpr int silenceLength = 2048;
+
+    /** Responses by lattice position, row by row */
+    std::array<Slot, positionsPerAxis * positionsPerAxis> slots;
+
+    /** Hits ringing, audio thread only */
+    std::array<Voice, maxVoices> voices;
+
+    /** Number of hits allowed to ring at once, audio thread only */
+    int voiceLimit = maxVoices;
+
+    /** Lattice positions in use along each axis, at most positionsPerAxis */
+    std::atomic<int> latticeSize{1};
+
+    /** Distance between two lattice positions, in cells */
+    std::atomic<float> latticeSpacing{0.0f};
+
+    /** Set when the responses no longer match the parameters */
+    std::atomic<bool> responsesStale{true};
+
+    /** Signalled whenever a response is published */
+    juce::WaitableEvent responseRendered;
+
+    /** Membranes the responses are rendered with, render thread only */
+    MembraneBatch membranes;
+
+    /** Locked memory holding the mode states of the drum body */
+    MemoryArena arena;
+
+    /** Drum body the responses are rendered with, render thread only */
+    ModalResonatorModel resonator;
+
+    /** Mode count of the drum body, 0 for the default */
+    int radialModes = 0, axialModes = 0;
+
+    /** Sample rate of the responses */
+    double sampleRate = 44100.0;
+
+    /** Random number generator for the strike position offsets */
+    std::mt19937 rng{std::random_device{}()};
+
+    /** Reference to the AudioProcessorValueTreeState object */
+    juce::AudioProcessorValueTreeState &state;
+
+    /** Values of the parameters of the sound, looked up once and read by
+     * every strike and render */
+    std::atomic<float> *randomnessParameter = nullptr;
+    std::atomic<float> *sizeParameter = nullptr;
+    std::atomic<float> *depthParameter = nullptr;
+    std::atomic<float> *tensionParameter = nullptr;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(HitCacheEngine)
+};
+
+#endif // HIT_CACHE_ENGINE_H
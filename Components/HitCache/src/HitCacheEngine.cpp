@@ -0,0 +1,396 @@
+#include "HitCacheEngine.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <tuple>
+#include "TraceRecorder.h"
+
+/**
+ * @brief Constructs a HitCacheEngine.
+ * @param state The AudioProcessorValueTreeState with the parameters of
+ * the sound.
+ * @param gridResolution Resolution of the membrane grid to render with.
+ */
+HitCacheEngine::HitCacheEngine(juce::AudioProcessorValueTreeState &state,
+                               const int gridResolution) :
+    Thread("PDrum Hit Cache"), membranes(gridResolution), resonator(state),
+    state(state),
+    randomnessParameter(state.getRawParameterValue("randomness")),
+    sizeParameter(state.getRawParameterValue("membraneSize")),
+    depthParameter(state.getRawParameterValue("depth")),
+    tensionParameter(state.getRawParameterValue("membraneTension")) {
+    /// Leave the shared workers to every membrane that plays in real time
+    membranes.setBlockDeadline(std::numeric_limits<double>::max());
+    state.addParameterListener("membraneSize", this);
+    state.addParameterListener("membraneTension", this);
+    state.addParameterListener("depth", this);
+    state.addParameterListener("randomness", this);
+}
+
+/**
+ * @brief Destructor for HitCacheEngine. Stops the render thread.
+ */
+HitCacheEngine::~HitCacheEngine() {
+    state.removeParameterListener("membraneSize", this);
+    state.removeParameterListener("membraneTension", this);
+    state.removeParameterListener("depth", this);
+    state.removeParameterListener("randomness", this);
+    release();
+}
+
+/**
+ * @brief Allocate the responses, silence every hit and start rendering
+ * the cache. Not real-time safe.
+ * @param newSampleRate The sample rate of the audio stream.
+ */
+void HitCacheEngine::prepare(const double newSampleRate) {
+    release();
+    sampleRate = newSampleRate;
+    if (radialModes > 0 && axialModes > 0)
+        resonator.setModeCount(radialModes, axialModes);
+    arena.reserve(resonator.getStateSize());
+    resonator.placeState(arena);
+    const auto maxLength =
+            static_cast<size_t>(std::ceil(maxResponseSeconds * sampleRate));
+    for (auto &slot: slots) {
+        for (auto &response: slot.responses)
+            response.assign(maxLength, 0.0f);
+        slot.lengths.fill(0);
+        slot.published.store(-1);
+        for (auto &listeners: slot.listeners)
+            listeners.store(0);
+    }
+    voices.fill({});
+    responsesStale.store(true);
+    startThread(Priority::low);
+}
+
+/**
+ * @brief Stop the render thread.
+ */
+void HitCacheEngine::release() { stopThread(2000); }
+
+/**
+ * @brief Set the size of the mode set of the drum body. Takes effect on
+ * the next call to prepare.
+ * @param numRadialModes The number of Bessel zeros to use.
+ * @param numAxialModes The number of axial orders per Bessel zero.
+ */
+void HitCacheEngine::setModeCount(const int numRadialModes,
+                                  const int numAxialModes) {
+    radialModes = numRadialModes;
+    axialModes = numAxialModes;
+}
+
+/**
+ * @brief Checks whether a strike position is close enough to the
+ * lattice to be played from the cache. Strikes near the centre always
+ * are; explicit positions further out, such as editor strikes near the
+ * rim, should be simulated instead.
+ * @param x The grid column, or -1 to strike near the centre.
+ * @param y The grid row, or -1 to strike near the centre.
+ * @return True if the cache has a response for the position.
+ */
+bool HitCacheEngine::covers(const int x, const int y) const {
+    if (x < 0 || y < 0)
+        return true;
+    const auto [offsetX, offsetY] = offsetOf(x, y);
+    /// Half a spacing past the outermost position, and at least the
+    /// struck cell's neighbours when the lattice is a single point
+    const int size = latticeSize.load(std::memory_order_relaxed);
+    const float spacing = latticeSpacing.load(std::memory_order_relaxed);
+    const float reach = std::max(
+            1.0f, 0.5f * static_cast<float>(size) * std::max(spacing, 0.0f));
+    return std::abs(static_cast<float>(offsetX)) <= reach &&
+           std::abs(static_cast<float>(offsetY)) <= reach;
+}
+
+/**
+ * @brief Start a hit from the cached response nearest to the strike
+ * position. Steals the oldest hit if every voice is busy.
+ * @param amplitude The amplitude of the strike.
+ * @param x The grid column, or -1 to strike near the centre.
+ * @param y The grid row, or -1 to strike near the centre.
+ * @param waitForRender Wait for a response that is not rendered yet
+ * instead of dropping the strike, for offline rendering.
+ */
+void HitCacheEngine::strike(const float amplitude, const int x, const int y,
+                            const bool waitForRender) {
+    int offsetX, offsetY;
+    if (x < 0 || y < 0) {
+        /// Draw the offset as the membrane does
+        const float randomness =
+                randomnessParameter->load(std::memory_order_relaxed);
+        std::uniform_real_distribution<> dist(-randomness, randomness);
+        offsetX = static_cast<int>(dist(rng));
+        offsetY = static_cast<int>(dist(rng));
+    } else {
+        std::tie(offsetX, offsetY) = offsetOf(x, y);
+    }
+    auto &slot = slots[static_cast<size_t>(
+            latticeIndex(static_cast<float>(offsetY)) * positionsPerAxis +
+            latticeIndex(static_cast<float>(offsetX)))];
+    int response = slot.published.load();
+    if (waitForRender) {
+        while (response < 0 && isThreadRunning()) {
+            responseRendered.wait(10);
+            response = slot.published.load();
+        }
+    }
+    if (response < 0)
+        return;
+    /// Claim the response, then make sure it was not replaced meanwhile:
+    /// the render thread only overwrites a response nobody claimed
+    while (true) {
+        slot.listeners[static_cast<size_t>(response)].fetch_add(1);
+        const int latest = slot.published.load();
+        if (latest == response)
+            break;
+        slot.listeners[static_cast<size_t>(response)].fetch_sub(1);
+        response = latest;
+    }
+    const auto busy = std::count_if(
+            voices.begin(), voices.end(),
+            [](const Voice &v) { return v.slot != nullptr; });
+    auto voice = busy < voiceLimit
+                         ? std::find_if(voices.begin(), voices.end(),
+                                        [](const Voice &v) {
+                                            return v.slot == nullptr;
+                                        })
+                         : voices.end();
+    if (voice == voices.end()) {
+        voice = std::max_element(voices.begin(), voices.end(),
+                                 [](const Voice &a, const Voice &b) {
+                                     return a.position < b.position;
+                                 });
+        stopVoice(*voice);
+    }
+    *voice = {&slot, response, 0, amplitude};
+}
+
+/**
+ * @brief Mix the ringing hits into the output.
+ * @param output Adds the samples to this.
+ * @param numSamples The number of samples to render.
+ */
+void HitCacheEngine::render(float *output, const int numSamples) {
+    PDRUM_TRACE_ZONE("hitCacheMix");
+    for (auto &voice: voices) {
+        if (voice.slot == nullptr)
+            continue;
+        const auto response = static_cast<size_t>(voice.response);
+        const int length = voice.slot->lengths[response];
+        const float *samples =
+                voice.slot->responses[response].data() + voice.position;
+        const int count = std::min(numSamples, length - voice.position);
+        for (int i = 0; i < count; ++i)
+            output[i] += voice.gain * samples[i];
+        voice.position += count;
+        if (voice.position >= length)
+            stopVoice(voice);
+    }
+}
+
+/**
+ * @brief Gets the offset of an explicit strike position from the
+ * center, as exciteOffset counts it.
+ * @param x The grid column.
+ * @param y The grid row.
+ * @return The column and row offset.
+ */
+std::pair<int, int> HitCacheEngine::offsetOf(const int x, const int y) const {
+    const int center = membranes.getGridResolution() / 2;
+    return {x - center - 1, y - center};
+}
+
+/**
+ * @brief Maps a strike offset onto the nearest lattice position.
+ * @param offset The offset of the strike from the center, in cells.
+ * @return The index of the lattice position along one axis.
+ */
+int HitCacheEngine::latticeIndex(const float offset) const {
+    const int size = latticeSize.load(std::memory_order_relaxed);
+    const float spacing = latticeSpacing.load(std::memory_order_relaxed);
+    if (size <= 1 || spacing <= 0.0f)
+        return 0;
+    return juce::jlimit(
+            0, size - 1,
+            juce::roundToInt(offset / spacing +
+                             0.5f * static_cast<float>(size - 1)));
+}
+
+/**
+ * @brief Stop a voice and let the render thread reuse its response.
+ * @param voice The voice to stop.
+ */
+void HitCacheEngine::stopVoice(Voice &voice) {
+    voice.slot->listeners[static_cast<size_t>(voice.response)].fetch_sub(1);
+    voice.slot = nullptr;
+}
+
+/**
+ * @brief Render every response of the lattice, centre first, and start
+ * over whenever a parameter changes.
+ */
+void HitCacheEngine::run() {
+    while (!threadShouldExit()) {
+        if (!responsesStale.exchange(false)) {
+            wait(-1);
+            continue;
+        }
+        /// Strikes land on whole cells, so a small range needs fewer
+        /// positions
+        const float randomness =
+                randomnessParameter->load(std::memory_order_relaxed);
+        const int size = std::clamp(2 * static_cast<int>(randomness) + 1, 1,
+                                    positionsPerAxis);
+        const float spacing =
+                size > 1 ? 2.0f * randomness / static_cast<float>(size - 1)
+                         : 0.0f;
+        latticeSpacing.store(spacing);
+        latticeSize.store(size);
+        /// Ring by ring from the centre, so the positions shared with a
+        /// smaller lattice are ready first
+        std::array<int, positionsPerAxis * positionsPerAxis> order{};
+        int numPositions = 0;
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x)
+                order[static_cast<size_t>(numPositions++)] =
+                        y * positionsPerAxis + x;
+        }
+        const auto ring = [size](const int index) {
+            const int half = (size - 1) / 2;
+            return std::max(std::abs(index % positionsPerAxis - half),
+                            std::abs(index / positionsPerAxis - half));
+        };
+        std::stable_sort(order.begin(), order.begin() + numPositions,
+                         [&](const int a, const int b) {
+                             return ring(a) < ring(b);
+                         });
+        for (int i = 0; i < numPositions; i += MembraneBatch::numLanes) {
+            if (!renderSlots(order.data() + i,
+                             std::min(MembraneBatch::numLanes,
+                                      numPositions - i),
+                             size, spacing))
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Gets the strike offset of a lattice position.
+ * @param position The index of the position along one axis.
+ * @param size The number of lattice positions along each axis.
+ * @param spacing The distance between two lattice positions.
+ * @return The offset from the center, in cells.
+ */
+int HitCacheEngine::latticeOffset(const int position, const int size,
+                                  const float spacing) {
+    const float centre = 0.5f * static_cast<float>(size - 1);
+    return juce::roundToInt((static_cast<float>(position) - centre) * spacing);
+}
+
+/**
+ * @brief Render the responses of up to one slot per membrane lane into
+ * the buffers no hit is playing and publish them.
+ * @param indices The indices of the slots.
+ * @param numSlots The number of slots, at most MembraneBatch::numLanes.
+ * @param size The number of lattice positions along each axis.
+ * @param spacing The distance between two lattice positions.
+ * @return False if the render was abandoned for newer parameters.
+ */
+bool HitCacheEngine::renderSlots(const int *indices, const int numSlots,
+                                 const int size, const float spacing) {
+    PDRUM_TRACE_ZONE("hitCacheRenderSlots");
+    std::array<Slot *, MembraneBatch::numLanes> group{};
+    std::array<int, MembraneBatch::numLanes> targets{};
+    for (int lane = 0; lane < numSlots; ++lane) {
+        const auto l = static_cast<size_t>(lane);
+        group[l] = &slots[static_cast<size_t>(indices[lane])];
+        targets[l] = group[l]->published.load() == 0 ? 1 : 0;
+        const auto &listeners =
+                group[l]->listeners[static_cast<size_t>(targets[l])];
+        /// Wait for the hits still playing the older response to ring out
+        while (listeners.load() > 0) {
+            if (threadShouldExit() || responsesStale.load())
+                return false;
+            wait(5);
+        }
+    }
+    const float membraneSize =
+            sizeParameter->load(std::memory_order_relaxed);
+    const float depth = depthParameter->load(std::memory_order_relaxed);
+    const float tension = tensionParameter->load(std::memory_order_relaxed);
+    for (int lane = 0; lane < numSlots; ++lane)
+        membranes.setParameters(lane, membraneSize, tension);
+    membranes.reset();
+    for (int lane = 0; lane < numSlots; ++lane) {
+        const int index = indices[lane];
+        const int offsetX =
+                latticeOffset(index % positionsPerAxis, size, spacing);
+        const int offsetY =
+                latticeOffset(index / positionsPerAxis, size, spacing);
+        membranes.strike(lane, 1.0f, offsetX, offsetY);
+    }
+    /// Run the membranes together until every lane is silent
+    const auto maxLength = static_cast<int>(slots[0].responses[0].size());
+    const float inverseSampleRate = 1.0f / static_cast<float>(sampleRate);
+    std::array<float, MembraneBatch::numLanes> output{};
+    std::array<int, MembraneBatch::numLanes> silentSamples{};
+    int membraneLength = maxLength;
+    for (int i = 0; i < maxLength; ++i) {
+        membranes.processSample(inverseSampleRate, output.data());
+        bool allSilent = true;
+        for (int lane = 0; lane < numSlots; ++lane) {
+            const auto l = static_cast<size_t>(lane);
+            group[l]->responses[static_cast<size_t>(targets[l])]
+                               [static_cast<size_t>(i)] = output[l];
+            if (std::abs(output[l]) < silenceThreshold)
+                ++silentSamples[l];
+            else
+                silentSamples[l] = 0;
+            allSilent = allSilent && silentSamples[l] >= silenceLength;
+        }
+        if (allSilent) {
+            membraneLength = i + 1;
+            break;
+        }
+        if (i % 4096 == 0 && (threadShouldExit() || responsesStale.load()))
+            return false;
+    }
+    /// Pass every membrane response through the body, in place
+    for (int lane = 0; lane < numSlots; ++lane) {
+        const auto l = static_cast<size_t>(lane);
+        auto &response = group[l]->responses[static_cast<size_t>(targets[l])];
+        resonator.setParameters(membraneSize, depth,
+                                static_cast<float>(sampleRate));
+        int length = maxLength, silent = 0;
+        for (int i = 0; i < maxLength; ++i) {
+            auto &sample = response[static_cast<size_t>(i)];
+            sample = resonator.process(i < membraneLength ? sample : 0.0f);
+            if (std::abs(sample) < silenceThreshold) {
+                if (++silent >= silenceLength) {
+                    length = i + 1;
+                    break;
+                }
+            } else {
+                silent = 0;
+            }
+        }
+        group[l]->lengths[static_cast<size_t>(targets[l])] = length;
+        group[l]->published.store(targets[l]);
+        responseRendered.signal();
+    }
+    return true;
+}
+
+/**
+ * @brief Handles parameter changes from the AudioProcessorValueTreeState.
+ * @param parameterID The ID of the parameter that changed.
+ * @param newValue The new value of the parameter.
+ */
+void HitCacheEngine::parameterChanged(const juce::String &, float) {
+    PDRUM_TRACE_ZONE("HitCacheEngine::parameterChanged");
+    responsesStale.store(true);
+    notify();
+}
@@ -0,0 +1,181 @@
+#ifndef LOOKAHEAD_RENDERER_H
+#define LOOKAHEAD_RENDERER_H
+
+#include <array>
+#include <atomic>
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <juce_core/juce_core.h>
+#include <vector>
+
+/**
+ * @brief Runs the synthesis on a dedicated thread ahead of the host.
+ *
+ * The audio callback only forwards its strikes, tagged with their stream
+ * position, and copies finished samples out of a single-producer
+ * single-consumer ring. The render thread renders up to the end of the
+ * last host block, so every strike lands on the same sample as in a
+ * synchronous render, and the output is delayed by a fixed latency that
+ * the plugin reports to the host.
+ */
+class LookaheadRenderer final : juce::Thread {
+public:
+    /**
+     * @brief The synthesis driven by the render thread.
+     */
+    class Source {
+    public:
+        /**
+         * @brief Destructor for Source.
+         */
+        virtual ~Source() = default;
+
+        /**
+         * @brief Strike the drum before the next rendered sample.
+         * @param amplitude The amplitude of the strike.
+         * @param x The grid column, or -1 to strike near the centre.
+         * @param y The grid row, or -1 to strike near the centre.
+         */
+        virtual void strike(float amplitude, int x, int y) = 0;
+
+        /**
+         * @brief Render the next samples.
+         * @param output Receives the samples.
+         * @param numSamples The number of samples to render.
+         */
+        virtual void render(float *output, int numSamples) = 0;
+    };
+
+    /**
+     * @brief Constructs a LookaheadRenderer.
+     * @param source The synthesis to run on the render thread.
+     */
+    explicit LookaheadRenderer(Source &source);
+
+    /**
+     * @brief Destructor for LookaheadRenderer. Stops the render thread.
+     */
+    ~LookaheadRenderer() override;
+
+    /**
+     * @brief Allocate the ring, fill it with the latency in silence and
+     * start the render thread. Not real-time safe.
+     * @param latencySamples The delay between a strike and its sound.
+     * @param maximumBlockSize The largest block passed to process.
+     */
+    void prepare(int latencySamples, int maximumBlockSize);
+
+    /**
+     * @brief Stop the render thread.
+     */
+    void release();
+
+    /**
+     * @brief Queue a strike of the current host block. Strikes that do not
+     * fit in the queue are dropped.
+     * @param sampleOffset The position of the strike in the block.
+     * @param amplitude The amplitude of the strike.
+     * @param x The grid column, or -1 to strike near the centre.
+     * @param y The grid row, or -1 to strike near the centre.
+     */
+    void queueStrike(int sampleOffset, float amplitude, int x = -1,
+                     int y = -1);
+
+    /**
+     * @brief Let the render thread render the current host block and copy
+     * out the samples due for it. Samples the render thread has not
+     * finished in time are replaced by silence.
+     * @param output Receives the samples.
+     * @param numSamples The number of samples of the block.
+     * @param waitForRender Wait for late samples instead of dropping them,
+     * for offline rendering.
+     */
+    void process(float *output, int numSamples, bool waitForRender);
+
+    /**
+     * @brief Gets the latency of the renderer.
+     * @return The latency in samples.
+     */
+    [[nodiscard]] int getLatency() const { return latency; }
+
+    /**
+     * @brief Gets the number of samples replaced by silence so far.
+     * @return The number of dropped samples.
+     */
+    [[nodiscard]] juce::int64 getNumDroppedSamples() const {
+        return droppedSamples.load();
+    }
+
+private:
+    /**
+     * @brief A strike at a position of the sample stream.
+     */
+    struct Strike {
+        /** Stream position of the strike */
+        juce::int64 position = 0;
+        /** Amplitude of the strike */
+        float amplitude = 0.0f;
+        /** Grid column of the strike, -1 near the centre */
+        int x = -1;
+        /** Grid row of the strike, -1 near the centre */
+        int y = -1;
+    };
+
+    /**
+     * @brief Render until the end of the last host block or until the ring
+     * is full, then poll for the next block.
+     */
+    void run() override;
+
+    /**
+     * @brief Render samples and hand them to the ring.
+     * @param numSamples The number of samples to render.
+     */
+    void renderChunk(int numSamples);
+
+    /** Longest wait for the next host block, short against the latency */
+    static constexpr int pollIntervalMs = 1;
+
+    /** Largest number of samples rendered between two checks for strikes */
+    static constexpr int maxChunkSize = 256;
+
+    /** Synthesis run on the render thread */
+    Source &source;
+
+    /** Delay between a strike and its sound */
+    int latency = 0;
+
+    /** Queued strikes */
+    std::array<Strike, 256> strikes;
+
+    /** Read and write positions of the strike queue */
+    juce::AbstractFifo strikeFifo{256};
+
+    /** Rendered samples waiting for the host */
+    std::vector<float> ring;
+
+    /** Read and write positions of the ring */
+    juce::AbstractFifo ringFifo{1};
+
+    /** Scratch buffer for one chunk */
+    std::vector<float> chunk;
+
+    /** Stream position at the end of the last host block */
+    std::atomic<juce::int64> hostPosition{0};
+
+    /** Stream position of the next sample to render, render thread only */
+    juce::int64 renderPosition = 0;
+
+    /** Samples played as silence that are still to be skipped in the ring,
+     * audio thread only */
+    int samplesOwed = 0;
+
+    /** Total number of samples the host played as silence */
+    std::atomic<juce::int64> droppedSamples{0};
+
+    /** Signalled whenever the render thread hands samples to the ring */
+    juce::WaitableEvent samplesRendered;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(LookaheadRenderer)
+};
+
+#endif // LOOKAHEAD_RENDERER_H
@@ -0,0 +1,152 @@
+#include "LookaheadRenderer.h"
+#include <algorithm>
+
+/**
+ * @brief Constructs a LookaheadRenderer.
+ * @param source The synthesis to run on the render thread.
+ */
+LookaheadRenderer::LookaheadRenderer(Source &source) :
+    Thread("PDrum Lookahead Renderer"), source(source) {}
+
+/**
+ * @brief Destructor for LookaheadRenderer. Stops the render thread.
+ */
+LookaheadRenderer::~LookaheadRenderer() { release(); }
+
+/**
+ * @brief Allocate the ring, fill it with the latency in silence and
+ * start the render thread. Not real-time safe.
+ * @param latencySamples The delay between a strike and its sound.
+ * @param maximumBlockSize The largest block passed to process.
+ */
+void LookaheadRenderer::prepare(const int latencySamples,
+                                const int maximumBlockSize) {
+    release();
+    latency = latencySamples;
+    /// The ring holds at most the latency plus the block being published
+    const int capacity = latencySamples + 2 * maximumBlockSize + 1;
+    ring.assign(static_cast<size_t>(capacity), 0.0f);
+    ringFifo.setTotalSize(capacity);
+    ringFifo.reset();
+    ringFifo.finishedWrite(latencySamples);
+    strikeFifo.reset();
+    chunk.assign(maxChunkSize, 0.0f);
+    hostPosition.store(0);
+    renderPosition = 0;
+    samplesOwed = 0;
+    droppedSamples.store(0);
+    startThread(Priority::highest);
+}
+
+/**
+ * @brief Stop the render thread.
+ */
+void LookaheadRenderer::release() { stopThread(2000); }
+
+/**
+ * @brief Queue a strike of the current host block. Strikes that do not
+ * fit in the queue are dropped.
+ * @param sampleOffset The position of the strike in the block.
+ * @param amplitude The amplitude of the strike.
+ * @param x The grid column, or -1 to strike near the centre.
+ * @param y The grid row, or -1 to strike near the centre.
+ */
+void LookaheadRenderer::queueStrike(const int sampleOffset,
+                                    const float amplitude, const int x,
+                                    const int y) {
+    const auto scope = strikeFifo.write(1);
+    if (scope.blockSize1 > 0)
+        strikes[static_cast<size_t>(scope.startIndex1)] = {
+                hostPosition.load(std::memory_order_relaxed) + sampleOffset,
+                amplitude, x, y};
+}
+
+/**
+ * @brief Let the render thread render the current host block and copy
+ * out the samples due for it. Samples the render thread has not
+ * finished in time are replaced by silence.
+ * @param output Receives the samples.
+ * @param numSamples The number of samples of the block.
+ * @param waitForRender Wait for late samples instead of dropping them,
+ * for offline rendering.
+ */
+void LookaheadRenderer::process(float *output, const int numSamples,
+                                const bool waitForRender) {
+    /// Publish the strikes of this block before the samples may be rendered
+    hostPosition.fetch_add(numSamples, std::memory_order_release);
+    /// Waking the render thread takes a lock, so only offline blocks do;
+    /// live blocks leave it to poll
+    if (waitForRender) {
+        notify();
+        while (ringFifo.getNumReady() < numSamples && isThreadRunning())
+            samplesRendered.wait(10);
+    }
+    /// Skip the samples that were already played as silence
+    if (samplesOwed > 0) {
+        const int skipped = std::min(samplesOwed, ringFifo.getNumReady());
+        ringFifo.finishedRead(skipped);
+        samplesOwed -= skipped;
+    }
+    const int available = samplesOwed > 0 ? 0 : ringFifo.getNumReady();
+    const auto scope = ringFifo.read(std::min(numSamples, available));
+    std::copy_n(ring.data() + scope.startIndex1, scope.blockSize1, output);
+    std::copy_n(ring.data() + scope.startIndex2, scope.blockSize2,
+                output + scope.blockSize1);
+    if (const int missing = numSamples - scope.blockSize1 - scope.blockSize2;
+        missing > 0) {
+        /// Keep the timeline: the late samples are played as silence now and
+        /// skipped once they are rendered
+        std::fill_n(output + numSamples - missing, missing, 0.0f);
+        samplesOwed += missing;
+        droppedSamples.fetch_add(missing, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Render until the end of the last host block or until the ring
+ * is full, then poll for the next block.
+ */
+void LookaheadRenderer::run() {
+    while (!threadShouldExit()) {
+        const juce::int64 limit = hostPosition.load(std::memory_order_acquire);
+        const int freeSpace = ringFifo.getFreeSpace();
+        if (renderPosition >= limit || freeSpace == 0) {
+            wait(pollIntervalMs);
+            continue;
+        }
+        int numSamples = static_cast<int>(
+                std::min<juce::int64>({limit - renderPosition, freeSpace,
+                                       maxChunkSize}));
+        /// Apply due strikes and stop the chunk at the next one
+        while (true) {
+            int start1, size1, start2, size2;
+            strikeFifo.prepareToRead(1, start1, size1, start2, size2);
+            if (size1 == 0)
+                break;
+            const auto &next = strikes[static_cast<size_t>(start1)];
+            if (next.position > renderPosition) {
+                numSamples = static_cast<int>(std::min<juce::int64>(
+                        numSamples, next.position - renderPosition));
+                break;
+            }
+            source.strike(next.amplitude, next.x, next.y);
+            strikeFifo.finishedRead(1);
+        }
+        renderChunk(numSamples);
+    }
+}
+
+/**
+ * @brief Render samples and hand them to the ring.
+ * @param numSamples The number of samples to render.
+ */
+void LookaheadRenderer::renderChunk(const int numSamples) {
+    source.render(chunk.data(), numSamples);
+    renderPosition += numSamples;
+    const auto scope = ringFifo.write(numSamples);
+    std::copy_n(chunk.data(), scope.blockSize1,
+                ring.data() + scope.startIndex1);
+    std::copy_n(chunk.data() + scope.blockSize1, scope.blockSize2,
+                ring.data() + scope.startIndex2);
+    samplesRendered.signal();
+}
@@ -0,0 +1,97 @@
+#ifndef HALF_FLOAT_H
+#define HALF_FLOAT_H
+
+#include <bit>
+#include <cstdint>
+#if (defined(_M_X64) || defined(_M_IX86)) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+/**
+ * @brief Conversions between 32-bit floats and IEEE 754 16-bit floats
+ * stored as raw bits.
+ */
+struct HalfFloat {
+    /**
+     * @brief Converts a 16-bit float to a 32-bit float.
+     * @param bits The 16-bit float.
+     * @return The same value as a 32-bit float.
+     */
+    static float toFloat(const uint16_t bits) noexcept {
+#if defined(__aarch64__)
+        return static_cast<float>(std::bit_cast<__fp16>(bits));
+#else
+        const uint32_t sign = static_cast<uint32_t>(bits & 0x8000u) << 16;
+        const uint32_t exponent = (bits >> 10) & 0x1fu;
+        const uint32_t mantissa = bits & 0x3ffu;
+        if (exponent == 0) {
+            /// Zero or subnormal: the mantissa counts units of 2^-24
+            const float magnitude = static_cast<float>(mantissa) * 0x1p-24f;
+            return sign != 0 ? -magnitude : magnitude;
+        }
+        if (exponent == 0x1f)
+            return std::bit_cast<float>(sign | 0x7f800000u | (mantissa << 13));
+        return std::bit_cast<float>(sign | ((exponent + 112) << 23) |
+                                    (mantissa << 13));
+#endif
+    }
+
+    /**
+     * @brief Converts a 32-bit float to the nearest 16-bit float, ties to
+     * even.
+     * @param value The 32-bit float.
+     * @return The 16-bit float.
+     */
+    static uint16_t fromFloat(const float value) noexcept {
+#if defined(__aarch64__)
+        return std::bit_cast<uint16_t>(static_cast<__fp16>(value));
+#else
+        const uint32_t bits = std::bit_cast<uint32_t>(value);
+        const auto sign = static_cast<uint16_t>((bits >> 16) & 0x8000u);
+        const uint32_t magnitude = bits & 0x7fffffffu;
+        if (magnitude >= 0x7f800000u)
+            return static_cast<uint16_t>(
+                    sign | 0x7c00u | (magnitude > 0x7f800000u ? 0x200u : 0u));
+        if (magnitude >= 0x477ff000u)
+            return static_cast<uint16_t>(sign | 0x7c00u);
+        if (magnitude < 0x38800000u) {
+            /// Subnormal or zero: round in units of 2^-24
+            const float scaled = std::bit_cast<float>(magnitude) * 0x1p24f;
+            const auto units = static_cast<uint32_t>(scaled);
+            const float rest = scaled - static_cast<float>(units);
+            const uint32_t rounded =
+                    units + (rest > 0.5f || (rest == 0.5f && (units & 1u)));
+            return static_cast<uint16_t>(sign | rounded);
+        }
+        /// Rebias the exponent and round off 13 mantissa bits
+        const uint32_t rebased = magnitude - (112u << 23);
+        const uint32_t rounded =
+                rebased + 0xfffu + ((rebased >> 13) & 1u);
+        return static_cast<uint16_t>(sign | (rounded >> 13));
+#endif
+    }
+
+    /**
+     * @brief Checks whether the CPU converts between the formats in
+     * hardware, eight values at a time on x86 (F16C).
+     * @return True if the conversions are done in hardware.
+     */
+    static bool hasHardwareConversion() noexcept {
+#if defined(__aarch64__)
+        return true;
+#elif (defined(_M_X64) || defined(_M_IX86)) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 1);
+        /// F16C needs the AVX register state as well, which the operating
+        /// system must save: OSXSAVE, then the XMM and YMM bits of XCR0
+        return (info[2] & (1 << 29)) != 0 && (info[2] & (1 << 28)) != 0 &&
+               (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+#elif defined(__x86_64__) || defined(__i386__)
+        return __builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx");
+#else
+        return false;
+#endif
+    }
+};
+
+#endif // HALF_FLOAT_H
@@ -0,0 +1,196 @@
+#ifndef MEMBRANE_BATCH_H
+#define MEMBRANE_BATCH_H
+
+#include <array>
+#include <cstdint>
+#include <juce_core/juce_core.h>
+#include <vector>
+#include "MembraneSolver.h"
+#include "WorkerPool.h"
+
+/**
+ * @brief Simulates up to eight membranes of the same grid resolution at
+ * once.
+ *
+ * The states are interleaved: cell (x, y) of every lane is stored next to
+ * the same cell of the other lanes, so the five-point stencil advances all
+ * lanes with one AVX instruction per operation and only contiguous loads.
+ * Every lane has its own speed of sound, cell size and damping, and
+ * follows the strike and smoothing rules of VibratingMembraneModel. As the
+ * live membrane does, the batch picks the interval to its next step from
+ * the target Courant number, for the fastest of its active lanes, and
+ * interpolates the output of every lane linearly between steps, one step
+ * late. Idle lanes are masked to zero, and a batch without an active lane
+ * is not stepped at all.
+ */
+class MembraneBatch final {
+public:
+    /** Number of membranes simulated together */
+    static constexpr int numLanes = 8;
+
+    /**
+     * @brief Constructs a MembraneBatch with every lane idle.
+     * @param gridResolution Resolution of the grid of every lane.
+     */
+    explicit MembraneBatch(int gridResolution);
+
+    /**
+     * @brief Silences every lane, marks it idle and settles its smoothed
+     * size and speed of sound on their targets.
+     */
+    void reset();
+
+    /**
+     * @brief Sets the parameters of a lane, as the membraneSize and
+     * membraneTension parameters do for a VibratingMembraneModel.
+     * @param lane The index of the lane.
+     * @param membraneSize The size of the membrane.
+     * @param newTension The tension of the membrane.
+     */
+    void setParameters(int lane, float membraneSize, float newTension);
+
+    /**
+     * @brief Strikes a lane at an offset from the centre, as
+     * VibratingMembraneModel::exciteOffset does, and makes it active.
+     * @param lane The index of the lane.
+     * @param amplitude The amplitude of the excitation.
+     * @param offsetX The column offset from the center.
+     * @param offsetY The row offset from the center.
+     */
+    void strike(int lane, float amplitude, int offsetX, int offsetY);
+
+    /**
+     * @brief Masks a lane: an idle lane is stepped with zero damping, so it
+     * falls silent within two steps and stays silent.
+     * @param lane The index of the lane.
+     * @param active Whether the lane is simulated.
+     */
+    void setLaneActive(int lane, bool active);
+
+    /**
+     * @brief Checks whether a lane is simulated.
+     * @param lane The index of the lane.
+     * @return True if the lane is active.
+     */
+    [[nodiscard]] bool isLaneActive(int lane) const {
+        return (activeLanes >> lane & 1u) != 0;
+    }
+
+    /**
+     * @brief Sets the time by which the steps must be done. The shared
+     * worker pool runs the most urgent membrane steps first.
+     * @param deadline The deadline as a juce::Time::getMillisecondCounterHiRes
+     * value.
+     */
+    void setBlockDeadline(const double deadline) { blockDeadline = deadline; }
+
+    /**
+     * @brief Processes a single sample of every lane.
+     * @param timeStep The time step for the simulation.
+     * @param output Receives the value at the measurement point of every
+     * lane, numLanes values.
+     */
+    void processSample(float timeStep, float *output);
+
+    /**
+     * @brief Gets the grid resolution.
+     * @return The grid resolution.
+     */
+    [[nodiscard]] int getGridResolution() const { return gridResolution; }
+
+private:
+    /**
+     * @brief Picks the interval to the next step for the target Courant
+     * number, from the fastest speed of sound and smallest cell size of
+     * the active lanes.
+     * @param timeStep The time step for the simulation.
+     */
+    void pickStepInterval(float timeStep);
+
+    /**
+     * @brief Updates one band of rows of the next state of every lane.
+     * @param context The MembraneBatch.
+     * @param band The index of the band.
+     */
+    static void stepBand(void *context, int band);
+
+    /** Share of the gap to a target the smoothing closes every default step
+     * interval, as on the live membrane */
+    static constexpr float smoothingFactor = 0.005f;
+
+    /** Smallest number of lane cells worth handing to another thread */
+    static constexpr int minLaneCellsPerBand = 16384;
+
+    /** The resolution of the grid of every lane */
+    const int gridResolution;
+
+    /** Active cells of the membrane, one run per row */
+    const std::vector<MembraneSolver::Row> rows;
+
+    /** Mask for the inside region of the membrane */
+    std::vector<uint8_t> isInside;
+
+    /** Interleaved state buffers */
+    std::vector<float> bufferA, bufferB, bufferC;
+
+    /** Interleaved current, previous and next states */
+    float *current = nullptr;
+    float *previous = nullptr;
+    float *next = nullptr;
+
+    /** Speed of sound of every lane and its target */
+    std::array<float, numLanes> c{}, targetC{};
+
+    /** Position step size of every lane and its target */
+    std::array<float, numLanes> dx{}, targetDx{};
+
+    /** Damping factor and tension of every lane */
+    std::array<float, numLanes> damping{}, tension{};
+
+    /** Squared Courant number and damping of every lane for the step in
+     * progress, zero damping for idle lanes */
+    alignas(32) std::array<float, numLanes> stepC2{};
+    alignas(32) std::array<float, numLanes> stepDamping{};
+
+    /** Index of the measurement point of every lane */
+    std::array<int, numLanes> measureIndex{};
+
+    /** One bit per active lane */
+    uint32_t activeLanes = 0;
+
+    /** Samples elapsed since the last simulation step */
+    int stepCounter = 0;
+
+    /** Number of host samples between two simulation steps */
+    int stepInterval = 1;
+
+    /** Simulated time of a step relative to a step at the default interval */
+    float stepScale = 0.0f;
+
+    /** Output of every lane at the last step and its increment per host
+     * sample towards the output of the step after */
+    std::array<float, numLanes> outputStart{}, outputSlope{};
+
+    /** Output of every lane at the latest step, reached by the
+     * interpolation at the next step */
+    std::array<float, numLanes> outputEnd{};
+
+    /** First row of every band, followed by the number of rows */
+    std::vector<int> bandRows;
+
+    /** Whether the CPU runs the AVX kernel */
+    const bool useAvx;
+
+    /** Deadline of the steps */
+    double blockDeadline = 0.0;
+
+    /** Job system shared by every instance in the process */
+    juce::SharedResourcePointer<WorkerPool> workerPool;
+
+    /** Task that steps the row bands on the shared workers */
+    WorkerPool::Task stepTask{*workerPool, &MembraneBatch::stepBand, this};
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MembraneBatch)
+};
+
+#endif // MEMBRANE_BATCH_H
@@ -0,0 +1,100 @@
+#ifndef MEMBRANE_SOLVER_H
+#define MEMBRANE_SOLVER_H
+
+#include <array>
+#include <vector>
+
+/**
+ * @brief Stencil kernels that advance the 32-bit membrane state by one step.
+ *
+ * The common grid resolutions get their own instantiation, with the row
+ * stride and the span of every row known at compile time, so the compiler
+ * drops the index arithmetic and vectorizes each row. Other resolutions
+ * use the generic kernel, which reads both from the geometry.
+ */
+struct MembraneSolver {
+    /**
+     * @brief A run of active cells in one row.
+     */
+    struct Row {
+        /** Index of the first cell */
+        int begin = 0;
+        /** Number of cells */
+        int length = 0;
+    };
+
+    /**
+     * @brief Updates a range of rows of the next membrane state.
+     * @param current The current state.
+     * @param previous The previous state.
+     * @param next Receives the next state.
+     * @param rows The active cells of every row.
+     * @param firstRow The first row to update.
+     * @param endRow One past the last row to update.
+     * @param stride The distance between two rows.
+     * @param c2 The squared Courant number.
+     * @param damping The damping factor.
+     */
+    using Kernel = void (*)(const float *current, const float *previous,
+                            float *next, const Row *rows, int firstRow,
+                            int endRow, int stride, float c2, float damping);
+
+    /**
+     * @brief Computes the runs of the circular membrane of a grid. The top
+     * row of the circle is a single cell with no counterpart at the bottom,
+     * which the grid border cuts off, so it is left out to keep the
+     * membrane symmetric about its centre row.
+     * @param gridResolution The resolution of the grid.
+     * @return One run per row, from the third row to the second to last.
+     */
+    static std::vector<Row> circleRows(int gridResolution);
+
+    /**
+     * @brief Gets the kernel for a grid resolution.
+     * @param gridResolution The resolution of the grid.
+     * @return The specialized kernel, or the generic one if the resolution
+     * has none.
+     */
+    static Kernel find(int gridResolution);
+
+    /**
+     * @brief Checks that the runs the specialized kernel of a grid
+     * resolution steps are the runs of its geometry, since that kernel
+     * ignores the rows it is given.
+     * @param gridResolution The resolution of the grid.
+     * @param rows The runs of the geometry built at run time.
+     * @return True if they match, or if the resolution has no specialized
+     * kernel.
+     */
+    static bool matchesRows(int gridResolution, const std::vector<Row> &rows);
+
+    /**
+     * @brief Updates a range of rows with the stride and spans given at run
+     * time.
+     */
+    static void stepGeneric(const float *current, const float *previous,
+                            float *next, const Row *rows, int firstRow,
+                            int endRow, int stride, float c2, float damping);
+
+private:
+    /**
+     * @brief Computes the runs of the circular membrane at compile time,
+     * matching the geometry built at run time.
+     * @tparam Resolution The resolution of the grid.
+     * @return One run per row, from the third row to the second to last.
+     */
+    template<int Resolution>
+    static constexpr std::array<Row, Resolution - 3> buildRows();
+
+    /**
+     * @brief Updates a range of rows with the stride and spans fixed at
+     * compile time. Ignores the rows and stride arguments.
+     * @tparam Resolution The resolution of the grid.
+     */
+    template<int Resolution>
+    static void stepFixed(const float *current, const float *previous,
+                          float *next, const Row *rows, int firstRow,
+                          int endRow, int stride, float c2, float damping);
+};
+
+#endif // MEMBRANE_SOLVER_H
@@ -5,6 +5,7 @@
 #include <cmath>
 #include <juce_audio_basics/juce_audio_basics.h>
 #include <juce_audio_utils/juce_audio_utils.h>
+#include "UiEventQueue.h"
 #include "VibratingMembraneModel.h"
 
 /**
@@ -15,8 +16,11 @@ class VibratingMembrane final : public juce::Component, juce::Timer {
 public:
     /**
      * @brief Constructor for the VibratingMembrane class.
+     * @param membraneModel The membrane to draw.
+     * @param uiEvents The queue that carries clicks to the audio thread.
      */
-    explicit VibratingMembrane(VibratingMembraneModel &membraneModel);
+    VibratingMembrane(VibratingMembraneModel &membraneModel,
+                      UiEventQueue &uiEvents);
 
     /**
      * @brief Paint the component.
@@ -39,6 +43,9 @@ private:
     /** A reference to the vibrating membrane model. */
     VibratingMembraneModel &membraneModel;
 
+    /** Queue that carries clicks to the audio thread */
+    UiEventQueue &uiEvents;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(VibratingMembrane)
 };
 
@@ -2,30 +2,86 @@
 #define VIBRATING_MEMBRANE_MODEL_H
 
 #include <algorithm>
+#include <atomic>
 #include <juce_audio_basics/juce_audio_basics.h>
 #include <juce_audio_utils/juce_audio_utils.h>
 #include <random>
 #include <vector>
+#include "HalfFloat.h"
+#include "MembraneSolver.h"
+#include "MemoryArena.h"
+#include "SharedTableCache.h"
+#include "WorkerPool.h"
 
 /**
  * @brief Class to simulate a vibrating membrane using the wave equation.
+ *
+ * The size, tension and randomness parameters are read once per block from
+ * their atomic values into a snapshot, never from a listener on another
+ * thread. Over the block the speed of sound, the cell size and the damping
+ * follow linear ramps, evaluated at the sample each step lands on.
  */
-class VibratingMembraneModel final
-    : public juce::AudioProcessorValueTreeState::Listener {
+class VibratingMembraneModel final {
 public:
+    /**
+     * @brief Number formats for the membrane state.
+     */
+    enum class StateStorage {
+        /** 32-bit floats */
+        float32,
+        /** 16-bit floats, widened to 32 bits inside the step. Halves the
+         * memory streamed per step. Against float32 the output is off by
+         * about -42 dB at a 256 grid and -50 dB at 512, and the noise
+         * floor of the decayed tail sits near -120 dBFS */
+        float16
+    };
+
     /**
      * @brief Constructs a VibratingMembraneModel object.
      * @param state Reference to the AudioProcessorValueTreeState object.
      * @param gridResolution Resolution of the grid for the membrane simulation.
+     * @param storage Number format of the membrane state.
      */
     explicit VibratingMembraneModel(juce::AudioProcessorValueTreeState &state,
-                                    int gridResolution = 128);
+                                    int gridResolution = 128,
+                                    StateStorage storage =
+                                            StateStorage::float32);
 
     /**
      * @brief Initializes the simulation parameters.
      */
     void initialize();
 
+    /**
+     * @brief Gets the room the membrane state takes in a MemoryArena.
+     * @return The size in bytes.
+     */
+    [[nodiscard]] size_t getStateSize() const;
+
+    /**
+     * @brief Places the membrane state in an arena and silences it, as
+     * reset does. Until its state is placed, the membrane is silent and
+     * ignores strikes. Not real-time safe.
+     * @param arena The arena, with room for getStateSize bytes.
+     */
+    void placeState(MemoryArena &arena);
+
+    /**
+     * @brief Silences the membrane and settles the size, speed of sound and
+     * damping on the current parameters.
+     */
+    void reset();
+
+    /**
+     * @brief Reads the parameters into the snapshot of the block and plans
+     * the ramps of the speed of sound, cell size and damping over it. Call
+     * before every block of samples, or every part of a block between two
+     * strikes; a strike retargets the speed of sound from the next call on.
+     * Real-time safe.
+     * @param numSamples The number of samples of the block.
+     */
+    void beginBlock(int numSamples);
+
     /**
      * @brief Excites the membrane at a specific position with a given
      * amplitude.
@@ -40,8 +96,96 @@ public:
      * randomness parameter is used to add a random offset to the center
      * position.
      * @param amplitude The amplitude of the excitation.
+     * @param spread Scale of the random offset, the grid resolution over
+     * the one the randomness parameter is given on.
+     */
+    void exciteCenter(float amplitude, float spread);
+
+    /**
+     * @brief Excites the membrane at an offset from the cell struck by
+     * exciteCenter, as exciteCenter does for a random offset.
+     * @param amplitude The amplitude of the excitation.
+     * @param offsetX The column offset from the center.
+     * @param offsetY The row offset from the center.
+     */
+    void exciteOffset(float amplitude, int offsetX, int offsetY);
+
+    /**
+     * @brief Seeds the random number generator used by exciteCenter. Offline
+     * renders seed each instance so their output does not depend on thread
+     * scheduling.
+     * @param seed The seed for the random number generator.
+     */
+    void setRandomSeed(uint32_t seed) { rng.seed(seed); }
+
+    /**
+     * @brief Sets the time by which the current audio block must be done.
+     * The shared worker pool runs the most urgent membrane steps first.
+     * @param deadline The deadline as a juce::Time::getMillisecondCounterHiRes
+     * value.
+     */
+    void setBlockDeadline(const double deadline) { blockDeadline = deadline; }
+
+    /**
+     * @brief Sets the number of host samples between two simulation steps
+     * while no Courant number is targeted. The membrane covers the same
+     * simulated time per host sample at every interval, so a shorter
+     * interval refines the time step rather than raising the pitch.
+     * @param interval The step interval, a divisor of defaultStepInterval.
+     */
+    void setStepInterval(int interval);
+
+    /**
+     * @brief Picks the step interval before every step from the speed of
+     * sound and the cell size, so each step runs close to a target Courant
+     * number: a loose, large head takes up to maxAdaptiveStepInterval host
+     * samples per step and a tight, small head is no longer clamped and
+     * detuned. The output is interpolated linearly between steps, one step
+     * late.
+     * @param courantNumber The Courant number to target, below 1/sqrt(2),
+     * or 0 to step at the fixed step interval.
+     */
+    void setTargetCourantNumber(float courantNumber);
+
+    /**
+     * @brief Sets the longest step interval picked for a Courant number,
+     * maxAdaptiveStepInterval unless changed. A higher limit lets a loose,
+     * large head step less often, at the cost of a later output. Takes
+     * effect at the next step, so it may change while rendering.
+     * @param limit The longest step interval, at least 1.
+     */
+    void setStepIntervalLimit(const int limit) {
+        stepIntervalLimit = std::max(1, limit);
+    }
+
+    /**
+     * @brief Gets the step interval that runs a step close to a Courant
+     * number, as picked before every step while one is targeted. Shared
+     * with MembraneBatch, so cached hits step as the live membrane does.
+     * @param courantNumber The Courant number to target.
+     * @param speed The fastest speed of sound during the step.
+     * @param cellSize The smallest cell size during the step.
+     * @param timeStep The time step for the simulation.
+     * @param limit The longest step interval.
+     * @return The step interval, from 1 to limit.
+     */
+    static int stepIntervalFor(float courantNumber, float speed,
+                               float cellSize, float timeStep, int limit);
+
+    /**
+     * @brief Gets the number of host samples between two simulation steps,
+     * the one picked for the next step while a Courant number is targeted.
+     * @return The step interval.
      */
-    void exciteCenter(float amplitude);
+    [[nodiscard]] int getStepInterval() const { return stepInterval; }
+
+    /**
+     * @brief Continues the vibration of another membrane on this one,
+     * resampling its displacement and velocity onto this grid. Allocates
+     * nothing, but touches every cell of both grids.
+     * @param source The membrane to take the state from.
+     */
+    void transferStateFrom(const VibratingMembraneModel &source);
 
     /**
      * @brief Processes a single sample of the membrane simulation.
@@ -51,16 +195,31 @@ public:
     float processSample(float timeStep);
 
     /**
-     * @brief Returns the current buffer for the membrane simulation.
-     * @return Reference to the current buffer.
+     * @brief Gets the current displacement of a grid cell.
+     * @param index The index of the cell.
+     * @return The displacement of the cell.
+     */
+    [[nodiscard]] float getCell(int index) const;
+
+    /**
+     * @brief Copies the current displacement of a rectangle of cells, row
+     * after row. Real-time safe, one copy per row of the 32-bit state.
+     * @param x The first column.
+     * @param y The first row.
+     * @param width The number of columns.
+     * @param height The number of rows.
+     * @param destination Receives width * height displacements.
      */
-    std::vector<float> &getCurrentBuffer() { return bufferA; }
+    void copyField(int x, int y, int width, int height,
+                   float *destination) const;
 
     /**
      * @brief Gets the mask indicating the inside region of the membrane.
      * @return Reference to the mask vector.
      */
-    std::vector<uint8_t> &getIsInsideMask() { return isInside; }
+    const std::vector<uint8_t> &getIsInsideMask() const {
+        return geometry->isInside;
+    }
 
     /**
      * @brief Gets the grid resolution.
@@ -68,18 +227,220 @@ public:
      */
     [[nodiscard]] int getGridResolution() const { return gridResolution; }
 
+    /**
+     * @brief Gets the number format of the membrane state.
+     * @return The state storage.
+     */
+    [[nodiscard]] StateStorage getStateStorage() const { return storage; }
+
+    /**
+     * @brief Checks whether the membrane is stepped on its upper half only,
+     * which it is while every strike since it was silent was on the centre
+     * row.
+     * @return True if only the upper half is stepped.
+     */
+    [[nodiscard]] bool isMirrored() const { return mirrored; }
+
+    /** Number of host samples between two simulation steps in live
+     * playback. Every other step interval divides it. */
+    static constexpr int defaultStepInterval = 10;
+
+    /** Courant number targeted by the live membrane, a margin below the
+     * stability limit of 1/sqrt(2) for the speed of sound and cell size to
+     * glide during a step */
+    static constexpr float defaultCourantNumber = 0.68f;
+
+    /** Longest step interval picked for a Courant number, which bounds the
+     * delay of the interpolated output */
+    static constexpr int maxAdaptiveStepInterval = 4 * defaultStepInterval;
+
 private:
     /**
-     * @brief Handles parameter changes from the AudioProcessorValueTreeState.
-     * @param parameterID The ID of the parameter that changed.
-     * @param newValue The new value of the parameter.
+     * @brief Values of the parameters read by the membrane, taken once per
+     * block.
+     */
+    struct ParameterSnapshot {
+        /** Physical size of the membrane */
+        float size = 0.0f;
+
+        /** Tension of the membrane, from 0 to 1 */
+        float tension = 0.0f;
+
+        /** Largest random offset of a centre strike, in cells */
+        float randomness = 0.0f;
+    };
+
+    /**
+     * @brief A value gliding linearly over a block.
+     */
+    struct LinearRamp {
+        /** Value at the start of the block */
+        float start = 0.0f;
+
+        /** Change per host sample */
+        float slope = 0.0f;
+
+        /**
+         * @brief Gets the value of the ramp.
+         * @param position Host samples since the start of the block.
+         * @return The value.
+         */
+        [[nodiscard]] float at(const float position) const {
+            return start + slope * position;
+        }
+    };
+
+    /**
+     * @brief Reads the parameters into the snapshot and updates the targets
+     * of those that changed since the last snapshot.
+     * @param force Whether to update every target, changed or not.
+     */
+    void takeSnapshot(bool force);
+
+    /**
+     * @brief Holds the ramps on the current speed of sound, cell size and
+     * damping.
+     */
+    void holdRamps();
+
+    /**
+     * @brief Gets how far into the ramps the membrane is, after the samples
+     * processed since the last step.
+     * @return Host samples since the start of the block, up to its length.
      */
-    void parameterChanged(const juce::String &parameterID,
-                          float newValue) override;
+    [[nodiscard]] float getRampPosition() const;
+
+    /**
+     * @brief Cells of the grid that belong to the circular membrane. Shared
+     * read-only by every instance with the same grid resolution.
+     */
+    struct Geometry {
+        /** Mask for the inside region of the membrane */
+        std::vector<uint8_t> isInside;
+
+        /** Indices of the active cells in the membrane, in row order */
+        std::vector<int> activeIndices;
+
+        /** Active cells as one run per row, in row order */
+        std::vector<MembraneSolver::Row> rows;
+    };
+
+    /**
+     * @brief Computes the circular membrane region of a grid.
+     * @param gridResolution Resolution of the grid.
+     * @return The geometry of the membrane.
+     */
+    static Geometry buildGeometry(int gridResolution);
+
+    /**
+     * @brief Splits the first rows of the membrane into bands of about the
+     * same number of cells, each large enough to be worth a thread.
+     * @param numRows The number of rows to split.
+     * @return The first row of every band, followed by numRows.
+     */
+    [[nodiscard]] std::vector<int> splitRows(int numRows) const;
+
+    /**
+     * @brief Maps a cell of the lower half onto its mirror image in the
+     * upper half while only the upper half is stepped.
+     * @param index The index of the cell.
+     * @return The index of the cell holding its displacement.
+     */
+    [[nodiscard]] int mirrorIndex(int index) const;
+
+    /**
+     * @brief Copies a row of the upper half onto its mirror image in the
+     * lower half, in the current and previous state.
+     * @param row The row of the upper half.
+     * @param previousToo Whether to copy the previous state as well.
+     */
+    void copyMirrorRow(int row, bool previousToo);
+
+    /**
+     * @brief Keeps or restores the symmetry of the membrane about the centre
+     * row for a strike on a cell.
+     * @param index The index of the struck cell.
+     */
+    void updateSymmetry(int index);
+
+    /**
+     * @brief Picks the interval to the next step for the target Courant
+     * number.
+     * @param timeStep The time step for the simulation.
+     */
+    void pickStepInterval(float timeStep);
+
+    /**
+     * @brief Updates one band of rows of the next membrane state.
+     * @param context The VibratingMembraneModel.
+     * @param band The index of the band.
+     */
+    static void stepBand(void *context, int band);
+
+    /**
+     * @brief Updates one band of rows of the next membrane state in the
+     * 16-bit storage.
+     * @param band The index of the band.
+     */
+    void stepBandHalf(int band) const;
+
+    /**
+     * @brief Checks whether the state has been placed in an arena.
+     * @return True if the membrane has a state.
+     */
+    [[nodiscard]] bool hasState() const {
+        return current != nullptr || currentHalf != nullptr;
+    }
+
+    /**
+     * @brief Overwrites the current and previous displacement of a cell.
+     * @param index The index of the cell.
+     * @param value The current displacement.
+     * @param previousValue The previous displacement.
+     */
+    void setCell(int index, float value, float previousValue);
+
+    /**
+     * @brief Gets the previous displacement of a grid cell.
+     * @param index The index of the cell.
+     * @return The previous displacement of the cell.
+     */
+    [[nodiscard]] float getPreviousCell(int index) const;
+
+    /**
+     * @brief Samples the current and previous displacement between cells.
+     * @param x The fractional column.
+     * @param y The fractional row.
+     * @param value Receives the current displacement.
+     * @param previousValue Receives the previous displacement.
+     */
+    void sampleCells(float x, float y, float &value,
+                     float &previousValue) const;
+
+    /**
+     * @brief Excites a cell with the displacement of a strike and the
+     * velocity it implies at the current step interval.
+     * @param index The index of the cell.
+     * @param amplitude The amplitude of the excitation.
+     */
+    void strikeCell(int index, float amplitude);
+
+    /** Smallest number of cells worth handing to another thread */
+    static constexpr int minCellsPerBand = 2048;
+
+    /** Largest difference between mirrored cells at which a membrane struck
+     * on the centre row goes back to stepping its upper half */
+    static constexpr float mirrorTolerance = 1.0e-6f;
 
     /** The resolution of the grid for the membrane simulation. */
     const int gridResolution;
 
+    /** Number format of the membrane state */
+    const StateStorage storage;
+
+    /** Whether the CPU converts 16-bit floats in hardware */
+    const bool hardwareHalfFloat = HalfFloat::hasHardwareConversion();
+
     /** The physical size of the membrane. */
     float physicalSize = 5.0f;
 
@@ -92,7 +453,8 @@ private:
     /** The time step for the simulation. */
     float dt = 0.0f;
 
-    /** The damping factor for the simulation. */
+    /** The damping factor the tension asks for, reached by the end of the
+     * block. */
     float damping = 0.996f;
 
     /** The target speed of sound in the membrane. */
@@ -101,25 +463,107 @@ private:
     /** The target position step size for the simulation. */
     float targetDx = 0.0f;
 
-    /** State buffers */
-    std::vector<float> bufferA, bufferB, bufferC;
+    /** Glide of the speed of sound, the cell size and the damping over the
+     * current block */
+    LinearRamp speedRamp, cellSizeRamp, dampingRamp;
+
+    /** Host samples from the start of the block to the latest step, negative
+     * while the latest step lies in an earlier block */
+    int rampPosition = 0;
+
+    /** Number of samples of the current block, over which the ramps run */
+    int rampLength = 0;
+
+    /** Share of the gap to a target the smoothing closes every
+     * defaultStepInterval host samples */
+    static constexpr float smoothingFactor = 0.005f;
+
+    /** Parameters of the current block */
+    ParameterSnapshot snapshot;
 
-    /** Mask for the inside region of the membrane */
-    std::vector<uint8_t> isInside;
+    /** Values of the size, tension and randomness parameters, looked up once
+     * and read lock-free */
+    std::atomic<float> *sizeParameter = nullptr;
+    std::atomic<float> *tensionParameter = nullptr;
+    std::atomic<float> *randomnessParameter = nullptr;
 
-    /** Indices of the active cells in the membrane */
-    std::vector<int> activeIndices;
+    /** Cache of tables shared by every instance in the process */
+    juce::SharedResourcePointer<SharedTableCache> tableCache;
 
-    /** Buffers for the current, previous, and next states of the membrane */
+    /** Region of the grid covered by the membrane */
+    std::shared_ptr<const Geometry> geometry;
+
+    /** Current, previous and next states of the membrane, placed in a
+     * MemoryArena */
     float *current = nullptr;
     float *previous = nullptr;
     float *next = nullptr;
 
+    /** Current, previous and next states in the 16-bit storage, placed in a
+     * MemoryArena */
+    uint16_t *currentHalf = nullptr;
+    uint16_t *previousHalf = nullptr;
+    uint16_t *nextHalf = nullptr;
+
+    /** Squared Courant number and damping of the step in progress */
+    float stepC2 = 0.0f, stepDamping = 0.0f;
+
+    /** First row of every band, followed by the number of rows */
+    std::vector<int> bandRows;
+
+    /** First row of every band of the upper half, followed by the number of
+     * rows of the upper half */
+    std::vector<int> mirroredBandRows;
+
+    /** Whether the state is symmetric about the centre row, so only the
+     * rows down to the centre row are stepped and the lower half is read
+     * from its mirror image. Odd resolutions have no centre row */
+    bool mirrored = gridResolution % 2 == 0;
+
+    /** Stencil kernel for the 32-bit state, specialized for the grid
+     * resolution where possible */
+    const MembraneSolver::Kernel solverKernel =
+            MembraneSolver::find(gridResolution);
+
+    /** Deadline of the current audio block */
+    double blockDeadline = 0.0;
+
+    /** Job system shared by every instance in the process */
+    juce::SharedResourcePointer<WorkerPool> workerPool;
+
+    /** Task that steps the row bands on the shared workers */
+    WorkerPool::Task stepTask{*workerPool, &VibratingMembraneModel::stepBand,
+                              this};
+
     /** Index for the measurement point in the membrane */
     int measureIndex = 0;
 
-    /** Reference to the AudioProcessorValueTreeState object */
-    juce::AudioProcessorValueTreeState &state;
+    /** Samples elapsed since the last simulation step */
+    int stepCounter = 0;
+
+    /** Number of host samples between two simulation steps */
+    int stepInterval = defaultStepInterval;
+
+    /** Simulated time of a step relative to a step at the default interval */
+    float stepScale = 1.0f;
+
+    /** Courant number the step interval is picked for, 0 for a fixed
+     * step interval */
+    float targetCourant = 0.0f;
+
+    /** Longest step interval picked for a Courant number */
+    int stepIntervalLimit = maxAdaptiveStepInterval;
+
+    /** Output at the last step and its increment per host sample towards
+     * the output of the step after, while a Courant number is targeted */
+    float outputStart = 0.0f, outputSlope = 0.0f;
+
+    /** Output of the latest step, reached by the interpolation at the next
+     * step */
+    float outputEnd = 0.0f;
+
+    /** Random number generator for the strike position offsets */
+    std::mt19937 rng{std::random_device{}()};
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(VibratingMembraneModel)
 };
@@ -0,0 +1,352 @@
+#include "MembraneBatch.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "TraceRecorder.h"
+#include "VibratingMembraneModel.h"
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define PDRUM_HAS_AVX_KERNEL 1
+#if defined(__GNUC__) || defined(__clang__)
+#define PDRUM_AVX_TARGET __attribute__((target("avx")))
+#else
+#include <intrin.h>
+#define PDRUM_AVX_TARGET
+#endif
+#endif
+
+/** Number of lanes, shortened for the kernels */
+static constexpr int lanes = MembraneBatch::numLanes;
+
+/**
+ * @brief Updates a range of rows of every lane, lane by lane in portable
+ * code.
+ * @param current The interleaved current state.
+ * @param previous The interleaved previous state.
+ * @param next Receives the interleaved next state.
+ * @param rows The active cells of every row.
+ * @param firstRow The first row to update.
+ * @param endRow One past the last row to update.
+ * @param stride The distance between two rows, in cells.
+ * @param c2 The squared Courant number of every lane.
+ * @param damping The damping factor of every lane.
+ */
+static void stepLanes(const float *__restrict current,
+                      const float *__restrict previous,
+                      float *__restrict next, const MembraneSolver::Row *rows,
+                      const int firstRow, const int endRow, const int stride,
+                      const float *c2, const float *damping) {
+    for (int r = firstRow; r < endRow; ++r) {
+        for (int i = rows[r].begin; i < rows[r].begin + rows[r].length; ++i) {
+            const float *u = current + i * lanes;
+            const float *old = previous + i * lanes;
+            float *out = next + i * lanes;
+            for (int lane = 0; lane < lanes; ++lane) {
+                const float laplacian =
+                        u[lane - stride * lanes] + u[lane + stride * lanes] +
+                        u[lane - lanes] + u[lane + lanes] - 4.0f * u[lane];
+                out[lane] = damping[lane] *
+                            (2.0f * u[lane] - old[lane] + c2[lane] * laplacian);
+            }
+        }
+    }
+}
+
+#if PDRUM_HAS_AVX_KERNEL
+/**
+ * @brief Updates a range of rows of every lane, one cell of all eight
+ * lanes per instruction. Only call it on CPUs that support AVX.
+ * @param current The interleaved current state.
+ * @param previous The interleaved previous state.
+ * @param next Receives the interleaved next state.
+ * @param rows The active cells of every row.
+ * @param firstRow The first row to update.
+ * @param endRow One past the last row to update.
+ * @param stride The distance between two rows, in cells.
+ * @param c2 The squared Courant number of every lane.
+ * @param damping The damping factor of every lane.
+ */
+PDRUM_AVX_TARGET static void
+stepLanesAvx(const float *current, const float *previous, float *next,
+             const MembraneSolver::Row *rows, const int firstRow,
+             const int endRow, const int stride, const float *c2,
+             const float *damping) {
+    static_assert(lanes == 8, "one AVX register per cell");
+    const __m256 c2s = _mm256_loadu_ps(c2);
+    const __m256 dampings = _mm256_loadu_ps(damping);
+    const __m256 twos = _mm256_set1_ps(2.0f);
+    const __m256 fours = _mm256_set1_ps(4.0f);
+    const int rowStride = stride * lanes;
+    for (int r = firstRow; r < endRow; ++r) {
+        const float *u = current + rows[r].begin * lanes;
+        const float *old = previous + rows[r].begin * lanes;
+        float *out = next + rows[r].begin * lanes;
+        for (int x = 0; x < rows[r].length; ++x, u += lanes, old += lanes,
+                 out += lanes) {
+            const __m256 centre = _mm256_loadu_ps(u);
+            const __m256 laplacian = _mm256_sub_ps(
+                    _mm256_add_ps(
+                            _mm256_add_ps(
+                                    _mm256_add_ps(
+                                            _mm256_loadu_ps(u - rowStride),
+                                            _mm256_loadu_ps(u + rowStride)),
+                                    _mm256_loadu_ps(u - lanes)),
+                            _mm256_loadu_ps(u + lanes)),
+                    _mm256_mul_ps(fours, centre));
+            const __m256 value = _mm256_mul_ps(
+                    dampings,
+                    _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(twos, centre),
+                                                _mm256_loadu_ps(old)),
+                                  _mm256_mul_ps(c2s, laplacian)));
+            _mm256_storeu_ps(out, value);
+        }
+    }
+}
+
+/**
+ * @brief Checks whether the CPU and the operating system support AVX.
+ * @return True if the AVX kernel can run.
+ */
+static bool hasAvx() {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_cpu_supports("avx");
+#else
+    int info[4];
+    __cpuid(info, 1);
+    /// AVX needs the operating system to save the register state as well:
+    /// OSXSAVE, then the XMM and YMM bits of XCR0
+    return (info[2] & (1 << 28)) != 0 && (info[2] & (1 << 27)) != 0 &&
+           (_xgetbv(0) & 6) == 6;
+#endif
+}
+#endif
+
+/**
+ * @brief Constructs a MembraneBatch with every lane idle.
+ * @param gridResolution Resolution of the grid of every lane.
+ */
+MembraneBatch::MembraneBatch(const int gridResolution) :
+    gridResolution(gridResolution),
+    rows(MembraneSolver::circleRows(gridResolution)),
+#if PDRUM_HAS_AVX_KERNEL
+    useAvx(hasAvx())
+#else
+    useAvx(false)
+#endif
+{
+    const auto totalCells =
+            static_cast<size_t>(gridResolution * gridResolution);
+    isInside.assign(totalCells, 0);
+    int numCells = 0;
+    for (const auto &row: rows) {
+        std::fill_n(isInside.begin() + row.begin, row.length, uint8_t{1});
+        numCells += row.length;
+    }
+    /// Batches are only built to be run, so start the shared workers
+    workerPool->start();
+    bufferA.assign(totalCells * numLanes, 0.0f);
+    bufferB.assign(totalCells * numLanes, 0.0f);
+    bufferC.assign(totalCells * numLanes, 0.0f);
+    current = bufferA.data();
+    previous = bufferB.data();
+    next = bufferC.data();
+    /// Split the rows into bands of about the same number of cells, each
+    /// large enough to be worth a thread
+    const int numBands =
+            std::clamp(numCells * numLanes / minLaneCellsPerBand, 1,
+                       workerPool->getNumWorkers() + 1);
+    bandRows.assign(static_cast<size_t>(numBands + 1), 0);
+    int cellsSoFar = 0, band = 1;
+    for (int row = 0; row < static_cast<int>(rows.size()); ++row) {
+        while (band < numBands && cellsSoFar >= numCells * band / numBands)
+            bandRows[static_cast<size_t>(band++)] = row;
+        cellsSoFar += rows[static_cast<size_t>(row)].length;
+    }
+    while (band <= numBands)
+        bandRows[static_cast<size_t>(band++)] = static_cast<int>(rows.size());
+    for (int lane = 0; lane < numLanes; ++lane)
+        setParameters(lane, 5.0f, 0.5f);
+    reset();
+}
+
+/**
+ * @brief Silences every lane, marks it idle and settles its smoothed
+ * size and speed of sound on their targets.
+ */
+void MembraneBatch::reset() {
+    std::fill(bufferA.begin(), bufferA.end(), 0.0f);
+    std::fill(bufferB.begin(), bufferB.end(), 0.0f);
+    std::fill(bufferC.begin(), bufferC.end(), 0.0f);
+    dx = targetDx;
+    c = targetC;
+    measureIndex.fill(0);
+    activeLanes = 0;
+    /// Step on the next sample, which picks the interval from there on
+    stepCounter = 0;
+    stepInterval = 1;
+    stepScale = 1.0f /
+                static_cast<float>(VibratingMembraneModel::defaultStepInterval);
+    outputStart.fill(0.0f);
+    outputSlope.fill(0.0f);
+    outputEnd.fill(0.0f);
+}
+
+/**
+ * @brief Sets the parameters of a lane, as the membraneSize and
+ * membraneTension parameters do for a VibratingMembraneModel.
+ * @param lane The index of the lane.
+ * @param membraneSize The size of the membrane.
+ * @param newTension The tension of the membrane.
+ */
+void MembraneBatch::setParameters(const int lane, const float membraneSize,
+                                  const float newTension) {
+    const auto l = static_cast<size_t>(lane);
+    targetDx[l] = membraneSize / static_cast<float>(gridResolution);
+    targetC[l] = 100.0f + (newTension * 50.0f) - 25.0f;
+    damping[l] = 0.996f + (newTension - 0.5f) * 2.0f * 0.0035f;
+    tension[l] = newTension;
+}
+
+/**
+ * @brief Strikes a lane at an offset from the centre, as
+ * VibratingMembraneModel::exciteOffset does, and makes it active.
+ * @param lane The index of the lane.
+ * @param amplitude The amplitude of the excitation.
+ * @param offsetX The column offset from the center.
+ * @param offsetY The row offset from the center.
+ */
+void MembraneBatch::strike(const int lane, const float amplitude,
+                           const int offsetX, const int offsetY) {
+    jassert(lane >= 0 && lane < numLanes);
+    const int centerX = gridResolution / 2 + offsetX;
+    const int centerY = gridResolution / 2 + offsetY;
+    const int index = centerY * gridResolution + centerX + 1;
+    if (index < 0 || index >= gridResolution * gridResolution ||
+        !isInside[static_cast<size_t>(index)])
+        return;
+    const auto l = static_cast<size_t>(lane);
+    /// The previous state holds the velocity times the step length
+    current[index * numLanes + lane] = amplitude;
+    previous[index * numLanes + lane] = amplitude * (1.0f - 0.5f * stepScale);
+    measureIndex[l] = index;
+    /// The tension grows with the distance from the center
+    const double distance = std::sqrt(offsetX * offsetX + offsetY * offsetY);
+    const double normalizedDistance =
+            distance / (static_cast<float>(gridResolution) / 2);
+    const double scaledDistance = (normalizedDistance - 0.5) * 0.5;
+    const float strikeTension = std::max(
+            0.01f,
+            std::min(1.0f, tension[l] + static_cast<float>(scaledDistance)));
+    targetC[l] = 100.0f + (strikeTension * 50.0f) - 25.0f;
+    setLaneActive(lane, true);
+}
+
+/**
+ * @brief Masks a lane: an idle lane is stepped with zero damping, so it
+ * falls silent within two steps and stays silent.
+ * @param lane The index of the lane.
+ * @param active Whether the lane is simulated.
+ */
+void MembraneBatch::setLaneActive(const int lane, const bool active) {
+    if (active)
+        activeLanes |= 1u << lane;
+    else
+        activeLanes &= ~(1u << lane);
+}
+
+/**
+ * @brief Processes a single sample of every lane.
+ * @param timeStep The time step for the simulation.
+ * @param output Receives the value at the measurement point of every
+ * lane, numLanes values.
+ */
+void MembraneBatch::processSample(const float timeStep, float *output) {
+    if (++stepCounter < stepInterval) {
+        const auto position = static_cast<float>(stepCounter);
+        for (size_t l = 0; l < static_cast<size_t>(numLanes); ++l)
+            output[l] = outputStart[l] + outputSlope[l] * position;
+        return;
+    }
+    stepCounter = 0;
+    if (activeLanes != 0) {
+        PDRUM_TRACE_ZONE("membraneBatchStep");
+        /// Glide as fast per host sample as the live membrane
+        const float smoothing = 1.0f - std::pow(1.0f - smoothingFactor,
+                                                stepScale);
+        /// Every step interval covers the same simulated time per host
+        /// sample
+        const float dt = timeStep * stepScale;
+        for (size_t l = 0; l < static_cast<size_t>(numLanes); ++l) {
+            dx[l] += (targetDx[l] - dx[l]) * smoothing;
+            c[l] += (targetC[l] - c[l]) * smoothing;
+            const float courant = c[l] * dt / dx[l];
+            stepC2[l] = std::min(courant * courant, 0.49f);
+            stepDamping[l] = (activeLanes >> l & 1u) != 0
+                                     ? std::pow(damping[l], stepScale)
+                                     : 0.0f;
+        }
+        stepTask.run(static_cast<int>(bandRows.size()) - 1, blockDeadline);
+        std::swap(previous, current);
+        std::swap(current, next);
+    }
+    /// Ramp from the previous step to this one over the next interval
+    pickStepInterval(timeStep);
+    for (size_t l = 0; l < static_cast<size_t>(numLanes); ++l) {
+        outputStart[l] = outputEnd[l];
+        outputEnd[l] = current[static_cast<size_t>(measureIndex[l]) *
+                                       numLanes +
+                               l];
+        outputSlope[l] = (outputEnd[l] - outputStart[l]) /
+                         static_cast<float>(stepInterval);
+        output[l] = outputStart[l];
+    }
+}
+
+/**
+ * @brief Picks the interval to the next step for the target Courant
+ * number, from the fastest speed of sound and smallest cell size of
+ * the active lanes.
+ * @param timeStep The time step for the simulation.
+ */
+void MembraneBatch::pickStepInterval(const float timeStep) {
+    float speed = 0.0f, cellSize = std::numeric_limits<float>::max();
+    for (size_t l = 0; l < static_cast<size_t>(numLanes); ++l) {
+        if ((activeLanes >> l & 1u) == 0)
+            continue;
+        speed = std::max({speed, c[l], targetC[l]});
+        cellSize = std::min({cellSize, dx[l], targetDx[l]});
+    }
+    /// Idle batches keep stepping at the default interval
+    stepInterval = speed > 0.0f
+                           ? VibratingMembraneModel::stepIntervalFor(
+                                     VibratingMembraneModel::
+                                             defaultCourantNumber,
+                                     speed, cellSize, timeStep,
+                                     VibratingMembraneModel::
+                                             maxAdaptiveStepInterval)
+                           : VibratingMembraneModel::defaultStepInterval;
+    stepScale = static_cast<float>(stepInterval) /
+                static_cast<float>(VibratingMembraneModel::defaultStepInterval);
+}
+
+/**
+ * @brief Updates one band of rows of the next state of every lane.
+ * @param context The MembraneBatch.
+ * @param band The index of the band.
+ */
+void MembraneBatch::stepBand(void *context, const int band) {
+    const auto &batch = *static_cast<MembraneBatch *>(context);
+    const int firstRow = batch.bandRows[static_cast<size_t>(band)];
+    const int endRow = batch.bandRows[static_cast<size_t>(band + 1)];
+#if PDRUM_HAS_AVX_KERNEL
+    if (batch.useAvx) {
+        stepLanesAvx(batch.current, batch.previous, batch.next,
+                     batch.rows.data(), firstRow, endRow, batch.gridResolution,
+                     batch.stepC2.data(), batch.stepDamping.data());
+        return;
+    }
+#endif
+    stepLanes(batch.current, batch.previous, batch.next, batch.rows.data(),
+              firstRow, endRow, batch.gridResolution, batch.stepC2.data(),
+              batch.stepDamping.data());
+}
@@ -0,0 +1,171 @@
+#include "MembraneSolver.h"
+#include <algorithm>
+#include <cstddef>
+
+/**
+ * @brief Computes the runs of the circular membrane of a grid. The top
+ * row of the circle is a single cell with no counterpart at the bottom,
+ * which the grid border cuts off, so it is left out to keep the
+ * membrane symmetric about its centre row.
+ * @param gridResolution The resolution of the grid.
+ * @return One run per row, from the third row to the second to last.
+ */
+std::vector<MembraneSolver::Row>
+MembraneSolver::circleRows(const int gridResolution) {
+    std::vector<Row> rows;
+    const int center = gridResolution / 2;
+    const int radius = center - 1;
+    for (int y = 2; y < gridResolution - 1; ++y) {
+        Row row;
+        for (int x = 1; x < gridResolution - 1; ++x) {
+            const int dx = x - center;
+            const int dy = y - center;
+            if (dx * dx + dy * dy <= radius * radius) {
+                /// The circle is convex, so each row is a single run
+                if (row.length++ == 0)
+                    row.begin = y * gridResolution + x;
+            }
+        }
+        if (row.length > 0)
+            rows.push_back(row);
+    }
+    return rows;
+}
+
+/**
+ * @brief Gets the kernel for a grid resolution.
+ * @param gridResolution The resolution of the grid.
+ * @return The specialized kernel, or the generic one if the resolution
+ * has none.
+ */
+MembraneSolver::Kernel MembraneSolver::find(const int gridResolution) {
+    switch (gridResolution) {
+        case 64:
+            return &stepFixed<64>;
+        case 128:
+            return &stepFixed<128>;
+        case 192:
+            return &stepFixed<192>;
+        case 256:
+            return &stepFixed<256>;
+        case 384:
+            return &stepFixed<384>;
+        case 512:
+            return &stepFixed<512>;
+        default:
+            return &stepGeneric;
+    }
+}
+
+/**
+ * @brief Updates a range of rows with the stride and spans given at run
+ * time.
+ */
+void MembraneSolver::stepGeneric(const float *__restrict current,
+                                 const float *__restrict previous,
+                                 float *__restrict next, const Row *rows,
+                                 const int firstRow, const int endRow,
+                                 const int stride, const float c2,
+                                 const float damping) {
+    for (int r = firstRow; r < endRow; ++r) {
+        const float *u = current + rows[r].begin;
+        const float *old = previous + rows[r].begin;
+        float *out = next + rows[r].begin;
+        for (int x = 0; x < rows[r].length; ++x) {
+            const float laplacian = u[x - stride] + u[x + stride] + u[x - 1] +
+                                    u[x + 1] - 4.0f * u[x];
+            out[x] = damping * (2.0f * u[x] - old[x] + c2 * laplacian);
+        }
+    }
+}
+
+/**
+ * @brief Computes the runs of the circular membrane at compile time,
+ * matching the geometry built at run time.
+ * @tparam Resolution The resolution of the grid.
+ * @return One run per row, from the third row to the second to last.
+ */
+template<int Resolution>
+constexpr std::array<MembraneSolver::Row, Resolution - 3>
+MembraneSolver::buildRows() {
+    std::array<Row, Resolution - 3> rows{};
+    constexpr int center = Resolution / 2;
+    constexpr int radius = center - 1;
+    for (int y = 2; y < Resolution - 1; ++y) {
+        /// Widest half chord inside the circle, without a per-cell loop to
+        /// stay well within the compile-time evaluation limits
+        const int dy = y - center;
+        int halfWidth = radius;
+        while (halfWidth * halfWidth + dy * dy > radius * radius)
+            --halfWidth;
+        const int first = center - halfWidth;
+        const int last = center + halfWidth < Resolution - 2
+                                 ? center + halfWidth
+                                 : Resolution - 2;
+        rows[static_cast<size_t>(y - 2)] = {y * Resolution + first,
+                                            last - first + 1};
+    }
+    return rows;
+}
+
+/**
+ * @brief Updates a range of rows with the stride and spans fixed at
+ * compile time. Ignores the rows and stride arguments.
+ * @tparam Resolution The resolution of the grid.
+ */
+template<int Resolution>
+void MembraneSolver::stepFixed(const float *__restrict current,
+                               const float *__restrict previous,
+                               float *__restrict next, const Row *,
+                               const int firstRow, const int endRow, int,
+                               const float c2, const float damping) {
+    static constexpr auto rows = buildRows<Resolution>();
+    for (int r = firstRow; r < endRow; ++r) {
+        const int begin = rows[static_cast<size_t>(r)].begin;
+        const int length = rows[static_cast<size_t>(r)].length;
+        const float *u = current + begin;
+        const float *old = previous + begin;
+        float *out = next + begin;
+        for (int x = 0; x < length; ++x) {
+            const float laplacian = u[x - Resolution] + u[x + Resolution] +
+                                    u[x - 1] + u[x + 1] - 4.0f * u[x];
+            out[x] = damping * (2.0f * u[x] - old[x] + c2 * laplacian);
+        }
+    }
+}
+
+/**
+ * @brief Checks that the runs the specialized kernel of a grid
+ * resolution steps are the runs of its geometry, since that kernel
+ * ignores the rows it is given.
+ * @param gridResolution The resolution of the grid.
+ * @param rows The runs of the geometry built at run time.
+ * @return True if they match, or if the resolution has no specialized
+ * kernel.
+ */
+bool MembraneSolver::matchesRows(const int gridResolution,
+                                 const std::vector<Row> &rows) {
+    const auto matches = [&rows](const auto &fixedRows) {
+        return std::equal(fixedRows.begin(), fixedRows.end(), rows.begin(),
+                          rows.end(), [](const Row &a, const Row &b) {
+                              return a.begin == b.begin &&
+                                     a.length == b.length;
+                          });
+    };
+    switch (gridResolution) {
+        case 64:
+            return matches(buildRows<64>());
+        case 128:
+            return matches(buildRows<128>());
+        case 192:
+            return matches(buildRows<192>());
+        case 256:
+            return matches(buildRows<256>());
+        case 384:
+            return matches(buildRows<384>());
+        case 512:
+            return matches(buildRows<512>());
+        default:
+            return true;
+    }
+}
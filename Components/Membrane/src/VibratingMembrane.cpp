@@ -4,13 +4,17 @@
 #include <cmath>
 #include <juce_audio_utils/juce_audio_utils.h>
 #include <vector>
+#include "TraceRecorder.h"
 
 /**
  * @brief Class representing a vibrating membrane simulation with physical
  * dimensions, optimized for performance by using contiguous memory.
+ * @param membraneModel The membrane to draw.
+ * @param uiEvents The queue that carries clicks to the audio thread.
  */
-VibratingMembrane::VibratingMembrane(VibratingMembraneModel &membraneModel) :
-    membraneModel(membraneModel) {
+VibratingMembrane::VibratingMembrane(VibratingMembraneModel &membraneModel,
+                                     UiEventQueue &uiEvents) :
+    membraneModel(membraneModel), uiEvents(uiEvents) {
     startTimerHz(60);
 }
 
@@ -19,10 +23,10 @@ VibratingMembrane::VibratingMembrane(VibratingMembraneModel &membraneModel) :
  * @param g The graphics context used for painting.
  */
 void VibratingMembrane::paint(juce::Graphics &g) {
+    PDRUM_TRACE_ZONE("VibratingMembrane::paint");
     const int gridResolution = membraneModel.getGridResolution();
     // Use const references to avoid copying large buffers.
     const auto &isInside = membraneModel.getIsInsideMask();
-    const auto &current = membraneModel.getCurrentBuffer();
 
     const auto bounds = getLocalBounds().toFloat();
     const float side = std::min(bounds.getWidth(), bounds.getHeight());
@@ -44,7 +48,7 @@ void VibratingMembrane::paint(juce::Graphics &g) {
             if (!isInside[index])
                 continue;
 
-            const float value = current[index];
+            const float value = membraneModel.getCell(index);
             // Logarithmic scaling calculation.
             const float logValue =
                     std::log10(1.0f + std::abs(value) * 300.0f) / logDenom;
@@ -91,5 +95,6 @@ void VibratingMembrane::mouseDown(const juce::MouseEvent &e) {
     const int y = static_cast<int>((relativeY / squareBounds.getHeight()) *
                                    static_cast<float>(gridResolution));
 
-    membraneModel.excite(0.9f, x, y);
+    /// The audio thread applies the strike, the model is not touched here
+    uiEvents.postStrike(0.9f, x, y);
 }
@@ -4,47 +4,152 @@
 #include <juce_audio_utils/juce_audio_utils.h>
 #include <random>
 #include <vector>
-#ifdef _OPENMP
-#include <omp.h>
+#include "TraceRecorder.h"
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define PDRUM_HAS_F16C_KERNEL 1
+#if defined(__GNUC__) || defined(__clang__)
+#define PDRUM_F16C_TARGET __attribute__((target("avx,f16c")))
+#else
+#define PDRUM_F16C_TARGET
+#endif
+#endif
+
+#if PDRUM_HAS_F16C_KERNEL
+/**
+ * @brief Updates a run of cells in the 16-bit storage, eight at a time
+ * with the F16C conversions. Only call it on CPUs that support F16C.
+ * @param current The current state.
+ * @param previous The previous state.
+ * @param next Receives the next state.
+ * @param begin The index of the first cell.
+ * @param length The number of cells.
+ * @param stride The distance between two rows.
+ * @param c2 The squared Courant number.
+ * @param damping The damping factor.
+ */
+PDRUM_F16C_TARGET static void
+stepRowF16C(const uint16_t *current, const uint16_t *previous, uint16_t *next,
+            const int begin, const int length, const int stride,
+            const float c2, const float damping) {
+    const __m256 c2s = _mm256_set1_ps(c2);
+    const __m256 dampings = _mm256_set1_ps(damping);
+    const __m256 twos = _mm256_set1_ps(2.0f);
+    const __m256 fours = _mm256_set1_ps(4.0f);
+    int i = begin;
+    for (const int end = begin + length - 7; i < end; i += 8) {
+        const __m256 u = _mm256_cvtph_ps(_mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(current + i)));
+        const __m256 up = _mm256_cvtph_ps(_mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(current + i - stride)));
+        const __m256 down = _mm256_cvtph_ps(_mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(current + i + stride)));
+        const __m256 left = _mm256_cvtph_ps(_mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(current + i - 1)));
+        const __m256 right = _mm256_cvtph_ps(_mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(current + i + 1)));
+        const __m256 old = _mm256_cvtph_ps(_mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(previous + i)));
+        const __m256 laplacian =
+                _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(up, down),
+                                            _mm256_add_ps(left, right)),
+                              _mm256_mul_ps(fours, u));
+        const __m256 value = _mm256_mul_ps(
+                dampings,
+                _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(twos, u), old),
+                              _mm256_mul_ps(c2s, laplacian)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(next + i),
+                         _mm256_cvtps_ph(value, _MM_FROUND_TO_NEAREST_INT));
+    }
+    for (const int end = begin + length; i < end; ++i) {
+        const float u = _cvtsh_ss(current[i]);
+        const float laplacian = _cvtsh_ss(current[i - stride]) +
+                                _cvtsh_ss(current[i + stride]) +
+                                _cvtsh_ss(current[i - 1]) +
+                                _cvtsh_ss(current[i + 1]) - 4.0f * u;
+        next[i] = _cvtss_sh(
+                damping * (2.0f * u - _cvtsh_ss(previous[i]) + c2 * laplacian),
+                _MM_FROUND_TO_NEAREST_INT);
+    }
+}
 #endif
 
 /**
  * @brief Constructs a VibratingMembraneModel object.
  * @param state Reference to the AudioProcessorValueTreeState object.
  * @param gridResolution Resolution of the grid for the membrane simulation.
+ * @param storage Number format of the membrane state.
  */
 VibratingMembraneModel::VibratingMembraneModel(
-        juce::AudioProcessorValueTreeState &state, const int gridResolution) :
-    gridResolution(gridResolution), state(state) {
+        juce::AudioProcessorValueTreeState &state, const int gridResolution,
+        const StateStorage storage) :
+    gridResolution(gridResolution), storage(storage),
+    sizeParameter(state.getRawParameterValue("membraneSize")),
+    tensionParameter(state.getRawParameterValue("membraneTension")),
+    randomnessParameter(state.getRawParameterValue("randomness")) {
     initialize();
-    /// Setup grid
-    const int totalCells = gridResolution * gridResolution;
-    bufferA.resize(totalCells, 0.0f);
-    bufferB.resize(totalCells, 0.0f);
-    bufferC.resize(totalCells, 0.0f);
-    isInside.resize(totalCells, 0);
-    /// Pre-allocate buffers
-    current = bufferA.data();
-    previous = bufferB.data();
-    next = bufferC.data();
-    /// Pre-calculate circle region
-    const int center = gridResolution / 2;
-    const int radius = center - 1;
-    for (int y = 1; y < gridResolution - 1; ++y) {
-        for (int x = 1; x < gridResolution - 1; ++x) {
-            const int index = y * gridResolution + x;
-            const int dx = x - center;
-            const int dy = y - center;
-            if (dx * dx + dy * dy <= radius * radius) {
-                isInside[index] = 1;
-                activeIndices.push_back(index);
-            }
+    /// Share the circle region with every instance of the same resolution
+    geometry = tableCache->get<Geometry>(
+            "membraneGeometry/circle/" + juce::String(gridResolution),
+            [gridResolution] { return buildGeometry(gridResolution); });
+    /// The specialized kernels step their own copy of the runs
+    jassert(MembraneSolver::matchesRows(gridResolution, geometry->rows));
+    bandRows = splitRows(static_cast<int>(geometry->rows.size()));
+    /// The runs start on the third row of the grid, so the centre row is
+    /// run gridResolution / 2 - 2
+    mirroredBandRows = splitRows(gridResolution / 2 - 1);
+    /// Start from the current parameters, which differ from the defaults
+    /// when the membrane is created after the state was restored
+    takeSnapshot(true);
+    dx = targetDx;
+    c = targetC;
+    holdRamps();
+}
+
+/**
+ * @brief Computes the circular membrane region of a grid.
+ * @param gridResolution Resolution of the grid.
+ * @return The geometry of the membrane.
+ */
+VibratingMembraneModel::Geometry
+VibratingMembraneModel::buildGeometry(const int gridResolution) {
+    Geometry geometry;
+    geometry.rows = MembraneSolver::circleRows(gridResolution);
+    geometry.isInside.resize(
+            static_cast<size_t>(gridResolution * gridResolution), 0);
+    for (const auto &row: geometry.rows) {
+        for (int index = row.begin; index < row.begin + row.length; ++index) {
+            geometry.isInside[static_cast<size_t>(index)] = 1;
+            geometry.activeIndices.push_back(index);
         }
     }
-    /// Start listening to parameter changes
-    state.addParameterListener("membraneSize", this);
-    state.addParameterListener("membraneTension", this);
-    state.addParameterListener("randomness", this);
+    return geometry;
+}
+
+/**
+ * @brief Splits the first rows of the membrane into bands of about the
+ * same number of cells, each large enough to be worth a thread.
+ * @param numRows The number of rows to split.
+ * @return The first row of every band, followed by numRows.
+ */
+std::vector<int> VibratingMembraneModel::splitRows(const int numRows) const {
+    const auto &rows = geometry->rows;
+    int numCells = 0;
+    for (int row = 0; row < numRows; ++row)
+        numCells += rows[static_cast<size_t>(row)].length;
+    const int numBands = std::clamp(numCells / minCellsPerBand, 1,
+                                    workerPool->getNumWorkers() + 1);
+    /// Give every band about the same number of cells
+    std::vector<int> bands(static_cast<size_t>(numBands + 1), 0);
+    int cellsSoFar = 0, band = 1;
+    for (int row = 0; row < numRows; ++row) {
+        while (band < numBands && cellsSoFar >= numCells * band / numBands)
+            bands[static_cast<size_t>(band++)] = row;
+        cellsSoFar += rows[static_cast<size_t>(row)].length;
+    }
+    while (band <= numBands)
+        bands[static_cast<size_t>(band++)] = numRows;
+    return bands;
 }
 
 /**
@@ -57,6 +162,155 @@ void VibratingMembraneModel::initialize() {
     targetC = c;
 }
 
+/**
+ * @brief Gets the room the membrane state takes in a MemoryArena.
+ * @return The size in bytes.
+ */
+size_t VibratingMembraneModel::getStateSize() const {
+    const auto totalCells =
+            static_cast<size_t>(gridResolution * gridResolution);
+    return 3 * (storage == StateStorage::float16
+                        ? MemoryArena::sizeFor<uint16_t>(totalCells)
+                        : MemoryArena::sizeFor<float>(totalCells));
+}
+
+/**
+ * @brief Places the membrane state in an arena and silences it, as
+ * reset does. Until its state is placed, the membrane is silent and
+ * ignores strikes. Not real-time safe.
+ * @param arena The arena, with room for getStateSize bytes.
+ */
+void VibratingMembraneModel::placeState(MemoryArena &arena) {
+    /// The first prepared instance starts the shared workers
+    workerPool->start();
+    const auto totalCells =
+            static_cast<size_t>(gridResolution * gridResolution);
+    current = previous = next = nullptr;
+    currentHalf = previousHalf = nextHalf = nullptr;
+    /// The arena hands out zeroed pieces, and zero is all bits clear in
+    /// both formats
+    if (storage == StateStorage::float16) {
+        currentHalf = arena.allocate<uint16_t>(totalCells);
+        previousHalf = arena.allocate<uint16_t>(totalCells);
+        nextHalf = arena.allocate<uint16_t>(totalCells);
+        if (previousHalf == nullptr || nextHalf == nullptr)
+            currentHalf = nullptr;
+    } else {
+        current = arena.allocate<float>(totalCells);
+        previous = arena.allocate<float>(totalCells);
+        next = arena.allocate<float>(totalCells);
+        if (previous == nullptr || next == nullptr)
+            current = nullptr;
+    }
+    reset();
+}
+
+/**
+ * @brief Silences the membrane and settles the size, speed of sound and
+ * damping on the current parameters.
+ */
+void VibratingMembraneModel::reset() {
+    const auto totalCells =
+            static_cast<size_t>(gridResolution * gridResolution);
+    if (currentHalf != nullptr) {
+        std::fill_n(currentHalf, totalCells, uint16_t{0});
+        std::fill_n(previousHalf, totalCells, uint16_t{0});
+        std::fill_n(nextHalf, totalCells, uint16_t{0});
+    }
+    if (current != nullptr) {
+        std::fill_n(current, totalCells, 0.0f);
+        std::fill_n(previous, totalCells, 0.0f);
+        std::fill_n(next, totalCells, 0.0f);
+    }
+    takeSnapshot(true);
+    dx = targetDx;
+    c = targetC;
+    holdRamps();
+    measureIndex = 0;
+    stepCounter = 0;
+    outputStart = outputSlope = outputEnd = 0.0f;
+    mirrored = gridResolution % 2 == 0;
+}
+
+/**
+ * @brief Reads the parameters into the snapshot of the block and plans
+ * the ramps of the speed of sound, cell size and damping over it. Call
+ * before every block of samples, or every part of a block between two
+ * strikes; a strike retargets the speed of sound from the next call on.
+ * Real-time safe.
+ * @param numSamples The number of samples of the block.
+ */
+void VibratingMembraneModel::beginBlock(const int numSamples) {
+    /// Carry on from where the ramps of the last block got to
+    const float position = getRampPosition();
+    const float speed = speedRamp.at(position);
+    const float cellSize = cellSizeRamp.at(position);
+    const float currentDamping = dampingRamp.at(position);
+    takeSnapshot(false);
+    /// Close as much of the gaps to the targets as the smoothing would over
+    /// the block, in a straight line
+    const float length = static_cast<float>(std::max(numSamples, 1));
+    const float glide =
+            numSamples > 0
+                    ? (1.0f - std::pow(1.0f - smoothingFactor,
+                                       static_cast<float>(numSamples) /
+                                               defaultStepInterval)) /
+                              length
+                    : 0.0f;
+    speedRamp = {speed, (targetC - speed) * glide};
+    cellSizeRamp = {cellSize, (targetDx - cellSize) * glide};
+    /// The damping follows the tension within the block
+    dampingRamp = {currentDamping,
+                   numSamples > 0 ? (damping - currentDamping) / length
+                                  : 0.0f};
+    rampLength = numSamples;
+    /// The latest step happened stepCounter samples before the block
+    rampPosition = -stepCounter;
+}
+
+/**
+ * @brief Reads the parameters into the snapshot and updates the targets
+ * of those that changed since the last snapshot.
+ * @param force Whether to update every target, changed or not.
+ */
+void VibratingMembraneModel::takeSnapshot(const bool force) {
+    const ParameterSnapshot latest{
+            sizeParameter->load(std::memory_order_relaxed),
+            tensionParameter->load(std::memory_order_relaxed),
+            randomnessParameter->load(std::memory_order_relaxed)};
+    if (force || latest.size != snapshot.size)
+        targetDx = latest.size / static_cast<float>(gridResolution);
+    /// A strike retargets the speed of sound until the tension moves
+    if (force || latest.tension != snapshot.tension) {
+        const float cOffset = (latest.tension * 50.0f) - 25.0f;
+        targetC = 100.0f + cOffset;
+        damping = 0.996f + (latest.tension - 0.5f) * 2.0f * 0.0035f;
+    }
+    snapshot = latest;
+}
+
+/**
+ * @brief Holds the ramps on the current speed of sound, cell size and
+ * damping.
+ */
+void VibratingMembraneModel::holdRamps() {
+    speedRamp = {c, 0.0f};
+    cellSizeRamp = {dx, 0.0f};
+    dampingRamp = {damping, 0.0f};
+    rampPosition = 0;
+    rampLength = 0;
+}
+
+/**
+ * @brief Gets how far into the ramps the membrane is, after the samples
+ * processed since the last step.
+ * @return Host samples since the start of the block, up to its length.
+ */
+float VibratingMembraneModel::getRampPosition() const {
+    return static_cast<float>(
+            std::clamp(rampPosition + stepCounter, 0, rampLength));
+}
+
 /**
  * @brief Excites the membrane at a specific position with a given
  * amplitude.
@@ -67,10 +321,9 @@ void VibratingMembraneModel::initialize() {
 void VibratingMembraneModel::excite(const float amplitude, const int x,
                                     const int y) {
     if (x > 1 && x < gridResolution - 1 && y > 1 && y < gridResolution - 1) {
-        if (const int index = y * gridResolution + x; isInside[index]) {
-            current[index] = amplitude;
-            previous[index] = amplitude * 0.5f;
-            measureIndex = index;
+        if (const int index = y * gridResolution + x;
+            geometry->isInside[index]) {
+            strikeCell(index, amplitude);
             /// Calculate the distance from the center:
             const int centerX = gridResolution / 2;
             const int centerY = gridResolution / 2;
@@ -83,10 +336,9 @@ void VibratingMembraneModel::excite(const float amplitude, const int x,
             const double scaledDistance = offsetDistance * 0.5;
             /// Get the current value of the membrane tension parameter
             const float tension = std::max(
-                    0.01f,
-                    std::min(1.0f, state.getRawParameterValue("membraneTension")
-                                                   ->load() +
-                                           static_cast<float>(scaledDistance)));
+                    0.01f, std::min(1.0f, snapshot.tension +
+                                                  static_cast<float>(
+                                                          scaledDistance)));
             /// Use the distance to add an offset to the tension
             const float cOffset = (tension * 50.0f) - 25.0f;
             targetC = 100.0f + cOffset;
@@ -99,21 +351,37 @@ void VibratingMembraneModel::excite(const float amplitude, const int x,
  * randomness parameter is used to add a random offset to the center
  * position.
  * @param amplitude The amplitude of the excitation.
+ * @param spread Scale of the random offset, the grid resolution over
+ * the one the randomness parameter is given on.
  */
-void VibratingMembraneModel::exciteCenter(const float amplitude) {
-    const float randomness = state.getRawParameterValue("randomness")->load();
-    std::random_device dev;
-    std::mt19937 rng(dev());
-    std::uniform_real_distribution<> dist(-randomness, randomness);
+void VibratingMembraneModel::exciteCenter(const float amplitude,
+                                          const float spread) {
+    const double range = snapshot.randomness * spread;
+    std::uniform_real_distribution<> dist(-range, range);
     const int offsetX = static_cast<int>(dist(rng));
     const int offsetY = static_cast<int>(dist(rng));
+    exciteOffset(amplitude, offsetX, offsetY);
+}
+
+/**
+ * @brief Excites the membrane at an offset from the cell struck by
+ * exciteCenter, as exciteCenter does for a random offset.
+ * @param amplitude The amplitude of the excitation.
+ * @param offsetX The column offset from the center.
+ * @param offsetY The row offset from the center.
+ */
+void VibratingMembraneModel::exciteOffset(const float amplitude,
+                                          const int offsetX,
+                                          const int offsetY) {
     const int centerX = gridResolution / 2 + offsetX;
     const int centerY = gridResolution / 2 + offsetY;
+    /// The randomness reaches past the rim of coarse grids
+    if (centerX + 1 <= 1 || centerX + 1 >= gridResolution - 1 ||
+        centerY <= 1 || centerY >= gridResolution - 1)
+        return;
     if (const int index = centerY * gridResolution + centerX + 1;
-        isInside[index]) {
-        current[index] = amplitude;
-        previous[index] = amplitude * 0.5f;
-        measureIndex = index;
+        geometry->isInside[index]) {
+        strikeCell(index, amplitude);
         /// Calculate the distance from the center:
         const double distance =
                 std::sqrt(offsetX * offsetX + offsetY * offsetY);
@@ -123,10 +391,9 @@ void VibratingMembraneModel::exciteCenter(const float amplitude) {
         const double scaledDistance = offsetDistance * 0.5;
         /// Get the current value of the membrane tension parameter
         const float tension = std::max(
-                0.01f,
-                std::min(1.0f,
-                         state.getRawParameterValue("membraneTension")->load() +
-                                 static_cast<float>(scaledDistance)));
+                0.01f, std::min(1.0f, snapshot.tension +
+                                              static_cast<float>(
+                                                      scaledDistance)));
         /// Use the distance to add an offset to the tension
         const float cOffset = (tension * 50.0f) - 25.0f;
         targetC = 100.0f + cOffset;
@@ -139,51 +406,430 @@ void VibratingMembraneModel::exciteCenter(const float amplitude) {
  * @return The current value of the membrane at the measurement index.
  */
 float VibratingMembraneModel::processSample(const float timeStep) {
-    static constexpr int updateInterval = 10;
-    static int counter = 0;
-    if (++counter < updateInterval)
-        return current[measureIndex];
-    counter = 0;
-
-    constexpr float smoothingFactor = 0.005f;
+    if (++stepCounter < stepInterval)
+        return targetCourant > 0.0f
+                       ? outputStart +
+                                 outputSlope * static_cast<float>(stepCounter)
+                       : getCell(measureIndex);
+    /// The step lands on the sample the ramps are evaluated at
+    rampPosition = std::min(rampPosition + stepCounter, rampLength);
+    stepCounter = 0;
+    if (!hasState())
+        return 0.0f;
+    PDRUM_TRACE_ZONE("membraneStep");
 
-    dx += (targetDx - dx) * smoothingFactor;
-    c += (targetC - c) * smoothingFactor;
+    const float position = getRampPosition();
+    dx = cellSizeRamp.at(position);
+    c = speedRamp.at(position);
+    const float blockDamping = dampingRamp.at(position);
 
-    dt = timeStep;
+    /// Every step interval covers the same simulated time per host sample
+    dt = timeStep * stepScale;
 
     const float newC2 = c * dt / dx;
-    const float clampedC2 = std::min(newC2 * newC2, 0.49f);
+    stepC2 = std::min(newC2 * newC2, 0.49f);
+    stepDamping = stepScale == 1.0f ? blockDamping
+                                    : std::pow(blockDamping, stepScale);
 
-#pragma omp parallel for schedule(static)
-    for (const int idx: activeIndices) {
-        // Load neighbors only once
-        const float u = current[idx];
-        const float laplacian = current[idx - gridResolution] +
-                                current[idx + gridResolution] +
-                                current[idx - 1] + current[idx + 1] - 4.0f * u;
-        next[idx] =
-                damping * (2.0f * u - previous[idx] + clampedC2 * laplacian);
-    }
+    const auto &bands = mirrored ? mirroredBandRows : bandRows;
+    stepTask.run(static_cast<int>(bands.size()) - 1, blockDeadline);
 
     std::swap(previous, current);
     std::swap(current, next);
+    std::swap(previousHalf, currentHalf);
+    std::swap(currentHalf, nextHalf);
+
+    /// The centre row reads the row below it, the mirror of the row above
+    if (mirrored)
+        copyMirrorRow(gridResolution / 2 - 1, false);
 
-    return current[measureIndex];
+    if (targetCourant <= 0.0f)
+        return getCell(measureIndex);
+    /// Ramp from the previous step to this one over the next interval
+    pickStepInterval(timeStep);
+    outputStart = outputEnd;
+    outputEnd = getCell(measureIndex);
+    outputSlope = (outputEnd - outputStart) / static_cast<float>(stepInterval);
+    return outputStart;
 }
 
 /**
- * @brief Handles parameter changes from the AudioProcessorValueTreeState.
- * @param parameterID The ID of the parameter that changed.
- * @param newValue The new value of the parameter.
+ * @brief Picks the interval to the next step for the target Courant
+ * number.
+ * @param timeStep The time step for the simulation.
  */
-void VibratingMembraneModel::parameterChanged(const juce::String &parameterID,
-                                              const float newValue) {
-    if (parameterID == "membraneSize") {
-        targetDx = newValue / static_cast<float>(gridResolution);
-    } else if (parameterID == "membraneTension") {
-        const float cOffset = (newValue * 50.0f) - 25.0f;
-        targetC = 100.0f + cOffset;
-        damping = 0.996f + (newValue - 0.5f) * 2.0f * 0.0035f;
+void VibratingMembraneModel::pickStepInterval(const float timeStep) {
+    /// Size the step for the end of the glide towards the targets or its
+    /// start, whichever is faster, so the step stays below the target
+    stepInterval = stepIntervalFor(targetCourant, std::max(c, targetC),
+                                   std::min(dx, targetDx), timeStep,
+                                   stepIntervalLimit);
+    stepScale = static_cast<float>(stepInterval) /
+                static_cast<float>(defaultStepInterval);
+}
+
+/**
+ * @brief Gets the step interval that runs a step close to a Courant
+ * number, as picked before every step while one is targeted. Shared
+ * with MembraneBatch, so cached hits step as the live membrane does.
+ * @param courantNumber The Courant number to target.
+ * @param speed The fastest speed of sound during the step.
+ * @param cellSize The smallest cell size during the step.
+ * @param timeStep The time step for the simulation.
+ * @param limit The longest step interval.
+ * @return The step interval, from 1 to limit.
+ */
+int VibratingMembraneModel::stepIntervalFor(const float courantNumber,
+                                            const float speed,
+                                            const float cellSize,
+                                            const float timeStep,
+                                            const int limit) {
+    const float samples = courantNumber * cellSize *
+                          static_cast<float>(defaultStepInterval) /
+                          (speed * timeStep);
+    return juce::jlimit(1, limit, static_cast<int>(samples));
+}
+
+/**
+ * @brief Sets the number of host samples between two simulation steps.
+ * The membrane covers the same simulated time per host sample at every
+ * interval, so a shorter interval refines the time step rather than
+ * raising the pitch.
+ * @param interval The step interval, a divisor of defaultStepInterval.
+ */
+void VibratingMembraneModel::setStepInterval(const int interval) {
+    jassert(interval > 0 && defaultStepInterval % interval == 0);
+    targetCourant = 0.0f;
+    stepInterval = juce::jlimit(1, defaultStepInterval, interval);
+    stepScale = static_cast<float>(stepInterval) /
+                static_cast<float>(defaultStepInterval);
+    stepCounter = 0;
+}
+
+/**
+ * @brief Picks the step interval before every step from the speed of
+ * sound and the cell size, so each step runs close to a target Courant
+ * number: a loose, large head takes up to maxAdaptiveStepInterval host
+ * samples per step and a tight, small head is no longer clamped and
+ * detuned. The output is interpolated linearly between steps, one step
+ * late.
+ * @param courantNumber The Courant number to target, below 1/sqrt(2),
+ * or 0 to step at the fixed step interval.
+ */
+void VibratingMembraneModel::setTargetCourantNumber(
+        const float courantNumber) {
+    jassert(courantNumber >= 0.0f && courantNumber < 0.7071f);
+    targetCourant = juce::jlimit(0.0f, 0.7f, courantNumber);
+    /// Step on the next sample, which picks the interval from there on
+    stepInterval = 1;
+    stepScale = 1.0f / static_cast<float>(defaultStepInterval);
+    stepCounter = 0;
+    outputStart = outputEnd = getCell(measureIndex);
+    outputSlope = 0.0f;
+}
+
+/**
+ * @brief Continues the vibration of another membrane on this one,
+ * resampling its displacement and velocity onto this grid. Allocates
+ * nothing, but touches every cell of both grids.
+ * @param source The membrane to take the state from.
+ */
+void VibratingMembraneModel::transferStateFrom(
+        const VibratingMembraneModel &source) {
+    if (!hasState() || !source.hasState())
+        return;
+    /// Map the circles onto each other, centre to centre and rim to rim
+    const float center = static_cast<float>(gridResolution / 2);
+    const float sourceCenter = static_cast<float>(source.gridResolution / 2);
+    const float scale = (sourceCenter - 1.0f) / (center - 1.0f);
+    /// The previous state holds the velocity times the step length
+    const float velocityScale = stepScale / source.stepScale;
+    /// Every cell is written, so the source's symmetry need not be kept
+    mirrored = false;
+    for (const int index: geometry->activeIndices) {
+        const float x = sourceCenter +
+                        (static_cast<float>(index % gridResolution) - center) *
+                                scale;
+        const float y = sourceCenter +
+                        (static_cast<float>(index / gridResolution) - center) *
+                                scale;
+        float value, previousValue;
+        source.sampleCells(x, y, value, previousValue);
+        setCell(index, value, value - (value - previousValue) * velocityScale);
+    }
+    const int measureX = juce::roundToInt(
+            center + (static_cast<float>(source.measureIndex %
+                                         source.gridResolution) -
+                      sourceCenter) /
+                             scale);
+    const int measureY = juce::roundToInt(
+            center + (static_cast<float>(source.measureIndex /
+                                         source.gridResolution) -
+                      sourceCenter) /
+                             scale);
+    if (const int index = measureY * gridResolution + measureX;
+        index >= 0 && index < gridResolution * gridResolution &&
+        geometry->isInside[static_cast<size_t>(index)])
+        measureIndex = index;
+    const float cellRatio = static_cast<float>(source.gridResolution) /
+                            static_cast<float>(gridResolution);
+    c = source.c;
+    targetC = source.targetC;
+    dx = source.dx * cellRatio;
+    targetDx = source.targetDx * cellRatio;
+    damping = source.damping;
+    snapshot = source.snapshot;
+    blockDeadline = source.blockDeadline;
+    stepCounter = 0;
+    /// The next block ramps on from the state taken over
+    holdRamps();
+    /// Start the interpolation from the output the source ended on
+    outputStart = outputEnd = getCell(measureIndex);
+    outputSlope = 0.0f;
+}
+
+/**
+ * @brief Gets the current displacement of a grid cell.
+ * @param index The index of the cell.
+ * @return The displacement of the cell.
+ */
+float VibratingMembraneModel::getCell(int index) const {
+    index = mirrorIndex(index);
+    if (storage == StateStorage::float16)
+        return currentHalf != nullptr ? HalfFloat::toFloat(currentHalf[index])
+                                      : 0.0f;
+    return current != nullptr ? current[index] : 0.0f;
+}
+
+/**
+ * @brief Copies the current displacement of a rectangle of cells, row
+ * after row. Real-time safe, one copy per row of the 32-bit state.
+ * @param x The first column.
+ * @param y The first row.
+ * @param width The number of columns.
+ * @param height The number of rows.
+ * @param destination Receives width * height displacements.
+ */
+void VibratingMembraneModel::copyField(const int x, const int y,
+                                       const int width, const int height,
+                                       float *destination) const {
+    jassert(x >= 0 && y >= 0 && x + width <= gridResolution &&
+            y + height <= gridResolution);
+    for (int row = y; row < y + height; ++row, destination += width) {
+        /// A mirrored lower row is read from its image in the upper half
+        const int index = mirrorIndex(row * gridResolution + x);
+        if (current != nullptr) {
+            std::copy_n(current + index, width, destination);
+        } else if (currentHalf != nullptr) {
+            for (int i = 0; i < width; ++i)
+                destination[i] = HalfFloat::toFloat(currentHalf[index + i]);
+        } else {
+            std::fill_n(destination, width, 0.0f);
+        }
+    }
+}
+
+/**
+ * @brief Gets the previous displacement of a grid cell.
+ * @param index The index of the cell.
+ * @return The previous displacement of the cell.
+ */
+float VibratingMembraneModel::getPreviousCell(int index) const {
+    index = mirrorIndex(index);
+    if (storage == StateStorage::float16)
+        return HalfFloat::toFloat(previousHalf[index]);
+    return previous[index];
+}
+
+/**
+ * @brief Samples the current and previous displacement between cells.
+ * @param x The fractional column.
+ * @param y The fractional row.
+ * @param value Receives the current displacement.
+ * @param previousValue Receives the previous displacement.
+ */
+void VibratingMembraneModel::sampleCells(const float x, const float y,
+                                         float &value,
+                                         float &previousValue) const {
+    /// Cells outside the membrane are always zero, so the border needs no
+    /// special case
+    const int column = juce::jlimit(0, gridResolution - 2,
+                                    static_cast<int>(std::floor(x)));
+    const int row = juce::jlimit(0, gridResolution - 2,
+                                 static_cast<int>(std::floor(y)));
+    const float fx = juce::jlimit(0.0f, 1.0f, x - static_cast<float>(column));
+    const float fy = juce::jlimit(0.0f, 1.0f, y - static_cast<float>(row));
+    const int index = row * gridResolution + column;
+    const float w00 = (1.0f - fx) * (1.0f - fy), w01 = fx * (1.0f - fy);
+    const float w10 = (1.0f - fx) * fy, w11 = fx * fy;
+    value = w00 * getCell(index) + w01 * getCell(index + 1) +
+            w10 * getCell(index + gridResolution) +
+            w11 * getCell(index + gridResolution + 1);
+    previousValue = w00 * getPreviousCell(index) +
+                    w01 * getPreviousCell(index + 1) +
+                    w10 * getPreviousCell(index + gridResolution) +
+                    w11 * getPreviousCell(index + gridResolution + 1);
+}
+
+/**
+ * @brief Excites a cell with the displacement of a strike and the
+ * velocity it implies at the current step interval.
+ * @param index The index of the cell.
+ * @param amplitude The amplitude of the excitation.
+ */
+void VibratingMembraneModel::strikeCell(const int index,
+                                        const float amplitude) {
+    if (!hasState())
+        return;
+    updateSymmetry(index);
+    /// The previous state holds the velocity times the step length
+    setCell(index, amplitude, amplitude * (1.0f - 0.5f * stepScale));
+    measureIndex = index;
+}
+
+/**
+ * @brief Maps a cell of the lower half onto its mirror image in the
+ * upper half while only the upper half is stepped.
+ * @param index The index of the cell.
+ * @return The index of the cell holding its displacement.
+ */
+int VibratingMembraneModel::mirrorIndex(const int index) const {
+    if (!mirrored)
+        return index;
+    const int row = index / gridResolution;
+    return row > gridResolution / 2
+                   ? index - (2 * row - gridResolution) * gridResolution
+                   : index;
+}
+
+/**
+ * @brief Copies a row of the upper half onto its mirror image in the
+ * lower half, in the current and previous state.
+ * @param row The row of the upper half.
+ * @param previousToo Whether to copy the previous state as well.
+ */
+void VibratingMembraneModel::copyMirrorRow(const int row,
+                                           const bool previousToo) {
+    /// Only the active run is copied: the cells around it must stay zero
+    const int mirrorRow = gridResolution - row;
+    const auto &run = geometry->rows[static_cast<size_t>(mirrorRow - 2)];
+    const int source = run.begin - (mirrorRow - row) * gridResolution;
+    if (storage == StateStorage::float16) {
+        std::copy_n(currentHalf + source, run.length, currentHalf + run.begin);
+        if (previousToo)
+            std::copy_n(previousHalf + source, run.length,
+                        previousHalf + run.begin);
+    } else {
+        std::copy_n(current + source, run.length, current + run.begin);
+        if (previousToo)
+            std::copy_n(previous + source, run.length, previous + run.begin);
+    }
+}
+
+/**
+ * @brief Keeps or restores the symmetry of the membrane about the centre
+ * row for a strike on a cell.
+ * @param index The index of the struck cell.
+ */
+void VibratingMembraneModel::updateSymmetry(const int index) {
+    const int centreRow = gridResolution / 2;
+    if (index / gridResolution != centreRow) {
+        if (mirrored) {
+            /// Give the lower half a state of its own before the strike
+            /// breaks the symmetry
+            for (int row = centreRow - 1; row > 1; --row)
+                copyMirrorRow(row, true);
+            mirrored = false;
+        }
+        return;
+    }
+    if (mirrored || gridResolution % 2 != 0)
+        return;
+    /// Step the upper half again once whatever broke the symmetry has died
+    /// away
+    for (int row = centreRow - 1; row > 1; --row) {
+        const int mirrorRow = gridResolution - row;
+        const auto &run = geometry->rows[static_cast<size_t>(mirrorRow - 2)];
+        const int offset = (mirrorRow - row) * gridResolution;
+        for (int i = run.begin; i < run.begin + run.length; ++i) {
+            if (std::abs(getCell(i) - getCell(i - offset)) > mirrorTolerance ||
+                std::abs(getPreviousCell(i) - getPreviousCell(i - offset)) >
+                        mirrorTolerance)
+                return;
+        }
+    }
+    mirrored = true;
+}
+
+/**
+ * @brief Overwrites the current and previous displacement of a cell.
+ * @param index The index of the cell.
+ * @param value The current displacement.
+ * @param previousValue The previous displacement.
+ */
+void VibratingMembraneModel::setCell(const int index, const float value,
+                                     const float previousValue) {
+    if (storage == StateStorage::float16) {
+        currentHalf[index] = HalfFloat::fromFloat(value);
+        previousHalf[index] = HalfFloat::fromFloat(previousValue);
+    } else {
+        current[index] = value;
+        previous[index] = previousValue;
+    }
+}
+
+/**
+ * @brief Updates one band of rows of the next membrane state.
+ * @param context The VibratingMembraneModel.
+ * @param band The index of the band.
+ */
+void VibratingMembraneModel::stepBand(void *context, const int band) {
+    PDRUM_TRACE_ZONE("membraneBand");
+    auto &model = *static_cast<VibratingMembraneModel *>(context);
+    if (model.storage == StateStorage::float16) {
+        model.stepBandHalf(band);
+        return;
+    }
+    const auto &bands =
+            model.mirrored ? model.mirroredBandRows : model.bandRows;
+    model.solverKernel(model.current, model.previous, model.next,
+                       model.geometry->rows.data(),
+                       bands[static_cast<size_t>(band)],
+                       bands[static_cast<size_t>(band + 1)],
+                       model.gridResolution, model.stepC2, model.stepDamping);
+}
+
+/**
+ * @brief Updates one band of rows of the next membrane state in the
+ * 16-bit storage.
+ * @param band The index of the band.
+ */
+void VibratingMembraneModel::stepBandHalf(const int band) const {
+    /// Whole rows per band, so each run can be converted eight cells at once
+    const auto &rows = geometry->rows;
+    const auto &bands = mirrored ? mirroredBandRows : bandRows;
+    const auto begin = static_cast<size_t>(bands[static_cast<size_t>(band)]);
+    const auto end = static_cast<size_t>(bands[static_cast<size_t>(band + 1)]);
+#if PDRUM_HAS_F16C_KERNEL
+    if (hardwareHalfFloat) {
+        for (size_t r = begin; r < end; ++r)
+            stepRowF16C(currentHalf, previousHalf, nextHalf, rows[r].begin,
+                        rows[r].length, gridResolution, stepC2, stepDamping);
+        return;
+    }
+#endif
+    for (size_t r = begin; r < end; ++r) {
+        for (int idx = rows[r].begin; idx < rows[r].begin + rows[r].length;
+             ++idx) {
+            const float u = HalfFloat::toFloat(currentHalf[idx]);
+            const float old = HalfFloat::toFloat(previousHalf[idx]);
+            const float laplacian =
+                    HalfFloat::toFloat(currentHalf[idx - gridResolution]) +
+                    HalfFloat::toFloat(currentHalf[idx + gridResolution]) +
+                    HalfFloat::toFloat(currentHalf[idx - 1]) +
+                    HalfFloat::toFloat(currentHalf[idx + 1]) - 4.0f * u;
+            nextHalf[idx] = HalfFloat::fromFloat(
+                    stepDamping * (2.0f * u - old + stepC2 * laplacian));
+        }
     }
 }
@@ -0,0 +1,219 @@
+#ifndef FIELD_RECORDER_H
+#define FIELD_RECORDER_H
+
+#include <algorithm>
+#include <atomic>
+#include <juce_core/juce_core.h>
+#include <memory>
+#include <vector>
+#include "VibratingMembraneModel.h"
+
+/**
+ * @brief Records the displacement field of a membrane over time to a
+ * NumPy .npy file.
+ *
+ * The thread that renders copies a frame of the field into a queue of
+ * preallocated frames at a fixed frame rate, one row copy per row of the
+ * region and nothing else, so recording does not risk dropouts in a live
+ * session. A background thread converts the frames to the file precision
+ * and appends them to the file through a memory-mapped chunk of frames,
+ * growing the file one chunk at a time. The .npy header is brought up to
+ * date at every chunk, so an interrupted recording still loads up to its
+ * last full chunk, and numpy.load(path, mmap_mode="r") reads the frames as
+ * a (frames, height, width) array without copying them. A JSON file next
+ * to it holds the frame rate, sample rate, region and number of frames
+ * dropped because the queue was full.
+ */
+class FieldRecorder final : juce::Thread {
+public:
+    /**
+     * @brief Number formats of the recorded frames.
+     */
+    enum class Precision {
+        /** 32-bit floats, NumPy <f4 */
+        float32,
+        /** 16-bit floats, NumPy <f2 */
+        float16
+    };
+
+    /**
+     * @brief What to record.
+     */
+    struct Settings {
+        /** Frames per second of audio */
+        double frameRate = 240.0;
+        /** First column and row of the region */
+        int x = 0, y = 0;
+        /** Size of the region in cells, 0 for the rest of the grid */
+        int width = 0, height = 0;
+        /** Number format of the file */
+        Precision precision = Precision::float16;
+    };
+
+    /**
+     * @brief Constructs a FieldRecorder that is not recording.
+     */
+    FieldRecorder();
+
+    /**
+     * @brief Destructor for FieldRecorder. Finishes the recording.
+     */
+    ~FieldRecorder() override;
+
+    /**
+     * @brief Starts recording to a file, finishing any recording in
+     * progress. Not real-time safe.
+     * @param file The .npy file to write. The settings go to the same file
+     * name with a .json extension.
+     * @param settings The frame rate, region and precision.
+     * @param gridResolution The grid resolution of the membrane.
+     * @param sampleRate The sample rate of the audio stream.
+     * @return False if the file could not be created.
+     */
+    bool start(const juce::File &file, const Settings &settings,
+               int gridResolution, double sampleRate);
+
+    /**
+     * @brief Finishes the recording: writes the queued frames, trims the
+     * file and writes the final header. Not real-time safe.
+     */
+    void stop();
+
+    /**
+     * @brief Checks whether a recording is in progress.
+     * @return True while recording.
+     */
+    [[nodiscard]] bool isRecording() const { return recording.load(); }
+
+    /**
+     * @brief Gets the number of samples to render before the next frame is
+     * due, so the renderer can stop there and call advance.
+     * @param numSamples The number of samples left to render.
+     * @return The number of samples to render, at most numSamples.
+     */
+    [[nodiscard]] int getSamplesToNextFrame(const int numSamples) const {
+        if (!recording.load(std::memory_order_relaxed))
+            return numSamples;
+        return std::min(numSamples,
+                        samplesToNextFrame.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * @brief Counts rendered samples and queues a frame of the membrane when
+     * one is due. Called by the thread that renders; copies at most one
+     * frame and never waits.
+     * @param numSamples The number of samples rendered since the last call.
+     * @param membrane The membrane that rendered them.
+     */
+    void advance(int numSamples, const VibratingMembraneModel &membrane);
+
+    /**
+     * @brief Gets the number of frames dropped because the queue was full
+     * or the membrane had another grid resolution.
+     * @return The number of dropped frames.
+     */
+    [[nodiscard]] int getNumDroppedFrames() const {
+        return droppedFrames.load();
+    }
+
+private:
+    /**
+     * @brief Append the queued frames to the file until the recording stops,
+     * then finish the file.
+     */
+    void run() override;
+
+    /**
+     * @brief Append a frame to the file.
+     * @param frame The frame as 32-bit floats.
+     * @return False if the file could not be written.
+     */
+    bool writeFrame(const float *frame);
+
+    /**
+     * @brief Map the next chunk of frames, growing the file.
+     * @return False if the file could not be grown or mapped.
+     */
+    bool mapNextChunk();
+
+    /**
+     * @brief Write the .npy header for a number of frames.
+     * @param numFrames The number of frames in the file.
+     * @return False if the file could not be written.
+     */
+    bool writeHeader(juce::int64 numFrames) const;
+
+    /**
+     * @brief Trim the file to the written frames, write the final header
+     * and the JSON settings.
+     */
+    void finish();
+
+    /** Size of the .npy header, a multiple of 64 so the frames are
+     * aligned */
+    static constexpr int headerSize = 128;
+
+    /** Seconds of frames the queue holds */
+    static constexpr double queueSeconds = 0.5;
+
+    /** Largest size of the queue in bytes */
+    static constexpr size_t maxQueueBytes = size_t{64} << 20;
+
+    /** Smallest size of a mapped chunk in bytes */
+    static constexpr juce::int64 minChunkBytes = juce::int64{8} << 20;
+
+    /** The file being written */
+    juce::File file;
+
+    /** Settings of the recording, with the region clipped to the grid */
+    Settings settings;
+
+    /** Grid resolution and sample rate of the recording */
+    int gridResolution = 0;
+    double sampleRate = 0.0;
+
+    /** Cells and bytes of one frame in the file */
+    int frameCells = 0;
+    juce::int64 frameBytes = 0;
+
+    /** Queued frames as 32-bit floats, one slot per frame */
+    std::vector<float> frames;
+
+    /** Read and write positions of the frame queue */
+    juce::AbstractFifo fifo{1};
+
+    /** Guards the recording state against start and stop; the thread that
+     * renders only tries it */
+    juce::SpinLock captureLock;
+
+    /** Whether a recording is in progress */
+    std::atomic<bool> recording{false};
+
+    /** Samples between two frames */
+    double frameInterval = 1.0;
+
+    /** Samples until the next frame, fractional, renderer only */
+    double samplesToFrame = 0.0;
+
+    /** Samples until the next frame, rounded up */
+    std::atomic<int> samplesToNextFrame{1};
+
+    /** Frames dropped so far */
+    std::atomic<int> droppedFrames{0};
+
+    /** Chunk of the file being filled, writer only */
+    std::unique_ptr<juce::MemoryMappedFile> chunk;
+
+    /** Frames per chunk and frames written to the current chunk */
+    int framesPerChunk = 1, framesInChunk = 0;
+
+    /** Frames written to the file */
+    juce::int64 framesWritten = 0;
+
+    /** Set when the file could not be written */
+    bool writeFailed = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(FieldRecorder)
+};
+
+#endif // FIELD_RECORDER_H
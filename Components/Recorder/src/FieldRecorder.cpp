@@ -0,0 +1,261 @@
+#include "FieldRecorder.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "HalfFloat.h"
+
+/**
+ * @brief Constructs a FieldRecorder that is not recording.
+ */
+FieldRecorder::FieldRecorder() : Thread("PDrum Field Recorder") {}
+
+/**
+ * @brief Destructor for FieldRecorder. Finishes the recording.
+ */
+FieldRecorder::~FieldRecorder() { stop(); }
+
+/**
+ * @brief Starts recording to a file, finishing any recording in
+ * progress. Not real-time safe.
+ * @param file The .npy file to write. The settings go to the same file
+ * name with a .json extension.
+ * @param settings The frame rate, region and precision.
+ * @param gridResolution The grid resolution of the membrane.
+ * @param sampleRate The sample rate of the audio stream.
+ * @return False if the file could not be created.
+ */
+bool FieldRecorder::start(const juce::File &file, const Settings &settings,
+                          const int gridResolution, const double sampleRate) {
+    stop();
+    if (gridResolution <= 0 || sampleRate <= 0.0 || settings.frameRate <= 0.0)
+        return false;
+    this->file = file;
+    this->settings = settings;
+    this->gridResolution = gridResolution;
+    this->sampleRate = sampleRate;
+    /// Clip the region to the grid
+    auto &region = this->settings;
+    region.x = juce::jlimit(0, gridResolution - 1, settings.x);
+    region.y = juce::jlimit(0, gridResolution - 1, settings.y);
+    region.width = juce::jlimit(1, gridResolution - region.x,
+                                settings.width > 0 ? settings.width
+                                                   : gridResolution);
+    region.height = juce::jlimit(1, gridResolution - region.y,
+                                 settings.height > 0 ? settings.height
+                                                     : gridResolution);
+    frameCells = region.width * region.height;
+    frameBytes = static_cast<juce::int64>(frameCells) *
+                 (settings.precision == Precision::float16 ? 2 : 4);
+    frameInterval = std::max(1.0, sampleRate / settings.frameRate);
+    framesPerChunk = static_cast<int>(
+            std::max(juce::int64{1}, minChunkBytes / frameBytes));
+
+    /// The queue is allocated while the renderer cannot capture
+    const size_t slotBytes = static_cast<size_t>(frameCells) * sizeof(float);
+    const int numSlots = juce::jlimit(
+            2, std::max(2, static_cast<int>(maxQueueBytes / slotBytes)),
+            static_cast<int>(settings.frameRate * queueSeconds));
+    frames.assign(static_cast<size_t>(numSlots + 1) *
+                          static_cast<size_t>(frameCells),
+                  0.0f);
+    fifo.setTotalSize(numSlots + 1);
+    fifo.reset();
+
+    chunk.reset();
+    framesInChunk = 0;
+    framesWritten = 0;
+    writeFailed = false;
+    droppedFrames.store(0);
+    file.deleteFile();
+    if (!writeHeader(0))
+        return false;
+    {
+        const juce::SpinLock::ScopedLockType lock(captureLock);
+        samplesToFrame = 0.0;
+        samplesToNextFrame.store(1);
+        recording.store(true);
+    }
+    startThread();
+    return true;
+}
+
+/**
+ * @brief Finishes the recording: writes the queued frames, trims the
+ * file and writes the final header. Not real-time safe.
+ */
+void FieldRecorder::stop() {
+    {
+        /// Wait for a capture in progress, no new one starts after this
+        const juce::SpinLock::ScopedLockType lock(captureLock);
+        recording.store(false);
+    }
+    /// The writer drains the queue and finishes the file before it exits
+    stopThread(-1);
+}
+
+/**
+ * @brief Counts rendered samples and queues a frame of the membrane when
+ * one is due. Called by the thread that renders; copies at most one
+ * frame and never waits.
+ * @param numSamples The number of samples rendered since the last call.
+ * @param membrane The membrane that rendered them.
+ */
+void FieldRecorder::advance(const int numSamples,
+                            const VibratingMembraneModel &membrane) {
+    if (!recording.load(std::memory_order_relaxed))
+        return;
+    const juce::SpinLock::ScopedTryLockType lock(captureLock);
+    if (!lock.isLocked() || !recording.load(std::memory_order_relaxed))
+        return;
+    samplesToFrame -= numSamples;
+    if (samplesToFrame <= 0.0) {
+        /// Offline profiles may run a membrane of another resolution
+        if (membrane.getGridResolution() != gridResolution ||
+            fifo.getFreeSpace() == 0) {
+            droppedFrames.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            const auto scope = fifo.write(1);
+            membrane.copyField(settings.x, settings.y, settings.width,
+                               settings.height,
+                               frames.data() + static_cast<size_t>(
+                                                       scope.startIndex1) *
+                                                       frameCells);
+        }
+        /// Skip the frames the caller rendered past rather than bunch them
+        samplesToFrame = std::max(samplesToFrame + frameInterval, 1.0);
+    }
+    samplesToNextFrame.store(static_cast<int>(std::ceil(samplesToFrame)),
+                             std::memory_order_relaxed);
+}
+
+/**
+ * @brief Append the queued frames to the file until the recording stops,
+ * then finish the file.
+ */
+void FieldRecorder::run() {
+    for (;;) {
+        /// Check first, so the frames queued before the stop are written
+        const bool stopping = threadShouldExit();
+        while (fifo.getNumReady() > 0) {
+            const auto scope = fifo.read(1);
+            if (!writeFailed)
+                writeFailed = !writeFrame(
+                        frames.data() +
+                        static_cast<size_t>(scope.startIndex1) * frameCells);
+        }
+        if (stopping)
+            break;
+        /// The renderer never signals, which would take a lock; the queue
+        /// holds far more than a polling period of frames
+        wait(20);
+    }
+    finish();
+}
+
+/**
+ * @brief Append a frame to the file.
+ * @param frame The frame as 32-bit floats.
+ * @return False if the file could not be written.
+ */
+bool FieldRecorder::writeFrame(const float *frame) {
+    if ((chunk == nullptr || framesInChunk == framesPerChunk) &&
+        !mapNextChunk())
+        return false;
+    auto *target = static_cast<char *>(chunk->getData()) +
+                   static_cast<size_t>(framesInChunk * frameBytes);
+    if (settings.precision == Precision::float16) {
+        auto *half = reinterpret_cast<uint16_t *>(target);
+        for (int i = 0; i < frameCells; ++i)
+            half[i] = HalfFloat::fromFloat(frame[i]);
+    } else {
+        std::memcpy(target, frame, static_cast<size_t>(frameBytes));
+    }
+    ++framesInChunk;
+    ++framesWritten;
+    return true;
+}
+
+/**
+ * @brief Map the next chunk of frames, growing the file.
+ * @return False if the file could not be grown or mapped.
+ */
+bool FieldRecorder::mapNextChunk() {
+    chunk.reset();
+    /// Every full chunk is covered by the header
+    if (framesWritten > 0 && !writeHeader(framesWritten))
+        return false;
+    const juce::int64 chunkStart = headerSize + framesWritten * frameBytes;
+    const juce::int64 chunkEnd = chunkStart + framesPerChunk * frameBytes;
+    {
+        juce::FileOutputStream stream(file);
+        if (!stream.openedOk() || !stream.setPosition(chunkEnd - 1) ||
+            !stream.writeByte(0))
+            return false;
+    }
+    chunk = std::make_unique<juce::MemoryMappedFile>(
+            file, juce::Range<juce::int64>(chunkStart, chunkEnd),
+            juce::MemoryMappedFile::readWrite);
+    framesInChunk = 0;
+    return chunk->getData() != nullptr;
+}
+
+/**
+ * @brief Write the .npy header for a number of frames.
+ * @param numFrames The number of frames in the file.
+ * @return False if the file could not be written.
+ */
+bool FieldRecorder::writeHeader(const juce::int64 numFrames) const {
+    /// Format version 1.0: magic, version, length of the dictionary, then
+    /// the dictionary padded with spaces and ended by a newline
+    char header[headerSize];
+    std::memset(header, ' ', sizeof(header));
+    std::memcpy(header, "\x93NUMPY\x01\x00", 8);
+    constexpr int dictionarySize = headerSize - 10;
+    header[8] = static_cast<char>(dictionarySize & 0xff);
+    header[9] = static_cast<char>(dictionarySize >> 8);
+    const int length = std::snprintf(
+            header + 10, dictionarySize,
+            "{'descr': '%s', 'fortran_order': False, "
+            "'shape': (%lld, %d, %d), }",
+            settings.precision == Precision::float16 ? "<f2" : "<f4",
+            static_cast<long long>(numFrames), settings.height,
+            settings.width);
+    if (length <= 0 || length >= dictionarySize)
+        return false;
+    header[10 + length] = ' ';
+    header[headerSize - 1] = '\n';
+    juce::FileOutputStream stream(file);
+    return stream.openedOk() && stream.setPosition(0) &&
+           stream.write(header, sizeof(header));
+}
+
+/**
+ * @brief Trim the file to the written frames, write the final header
+ * and the JSON settings.
+ */
+void FieldRecorder::finish() {
+    chunk.reset();
+    {
+        juce::FileOutputStream stream(file);
+        if (stream.openedOk() &&
+            stream.setPosition(headerSize + framesWritten * frameBytes))
+            stream.truncate();
+    }
+    writeHeader(framesWritten);
+    const juce::String json =
+            "{\n  \"data\": \"" + file.getFileName() + "\",\n"
+            "  \"frames\": " + juce::String(framesWritten) + ",\n"
+            "  \"droppedFrames\": " + juce::String(droppedFrames.load()) +
+            ",\n  \"frameRate\": " + juce::String(settings.frameRate) +
+            ",\n  \"sampleRate\": " + juce::String(sampleRate) +
+            ",\n  \"gridResolution\": " + juce::String(gridResolution) +
+            ",\n  \"region\": [" + juce::String(settings.x) + ", " +
+            juce::String(settings.y) + ", " + juce::String(settings.width) +
+            ", " + juce::String(settings.height) + "],\n"
+            "  \"precision\": \"" +
+            (settings.precision == Precision::float16 ? "float16"
+                                                      : "float32") +
+            "\",\n  \"complete\": " + (writeFailed ? "false" : "true") +
+            "\n}\n";
+    file.withFileExtension("json").replaceWithText(json);
+}
@@ -0,0 +1,117 @@
+#ifndef CONVOLUTION_RESONATOR_MODEL_H
+#define CONVOLUTION_RESONATOR_MODEL_H
+
+#include <atomic>
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <juce_audio_utils/juce_audio_utils.h>
+#include <juce_dsp/juce_dsp.h>
+#include "ModalResonatorModel.h"
+
+/**
+ * @brief Drum body engine that convolves with the impulse response of the
+ * ModalResonatorModel instead of running every mode as a recursive filter.
+ * Its cost does not grow with the number of modes.
+ *
+ * The impulse response for the current size and depth is rendered on a
+ * background thread and handed to a partitioned FFT convolver, which
+ * crossfades to it from the previous response.
+ */
+class ConvolutionResonatorModel final
+    : public juce::AudioProcessorValueTreeState::Listener,
+      juce::Thread {
+public:
+    /**
+     * @brief Constructor for ConvolutionResonatorModel.
+     * @param state The AudioProcessorValueTreeState to use for parameter
+     * changes.
+     * @param modalModel The modal model whose impulse response is used.
+     */
+    ConvolutionResonatorModel(juce::AudioProcessorValueTreeState &state,
+                              const ModalResonatorModel &modalModel);
+
+    /**
+     * @brief Destructor for ConvolutionResonatorModel.
+     */
+    ~ConvolutionResonatorModel() override;
+
+    /**
+     * @brief Prepare the convolver and render the first impulse response.
+     * Not real-time safe.
+     * @param sampleRate The sample rate of the audio processor.
+     * @param maximumBlockSize The largest block passed to process.
+     * @param latencySamples Zero for a non-uniformly partitioned convolver
+     * without latency, or the partition size of a uniformly partitioned
+     * convolver that trades latency for lower cost.
+     */
+    void prepare(double sampleRate, int maximumBlockSize, int latencySamples);
+
+    /**
+     * @brief Stops the impulse response renderer, which reads the mode set
+     * of the modal model, so the mode set can change. Not real-time safe.
+     */
+    void release();
+
+    /**
+     * @brief Process a block of samples in place.
+     * @param samples The samples to process.
+     * @param numSamples The number of samples.
+     */
+    void process(float *samples, int numSamples);
+
+    /**
+     * @brief Gets the latency of the convolver.
+     * @return The latency in samples.
+     */
+    [[nodiscard]] int getLatency() const;
+
+private:
+    /**
+     * @brief Callback for when a parameter changes.
+     * @param parameterID The ID of the parameter that changed.
+     * @param newValue The new value of the parameter.
+     */
+    void parameterChanged(const juce::String &parameterID,
+                          float newValue) override;
+
+    /**
+     * @brief Render impulse responses whenever the size or depth change.
+     */
+    void run() override;
+
+    /**
+     * @brief Render the impulse response for the pending size and depth and
+     * load it into the convolver.
+     */
+    void loadImpulseResponse();
+
+    /** Longest impulse response rendered, in seconds */
+    static constexpr double maxImpulseResponseSeconds = 4.0;
+
+    /** Head partition size of the zero latency convolver */
+    static constexpr int headSize = 256;
+
+    /** AudioProcessorValueTreeState reference */
+    juce::AudioProcessorValueTreeState &state;
+
+    /** Modal model whose impulse response is rendered */
+    const ModalResonatorModel &modalModel;
+
+    /** Partitioned FFT convolver */
+    std::unique_ptr<juce::dsp::Convolution> convolution;
+
+    /** Largest block passed to the convolver */
+    int maxBlockSize = 0;
+
+    /** Sample rate of the audio processor */
+    std::atomic<double> m_sampleRate{44100.0};
+
+    /** Size and depth most recently delivered by the parameter listener */
+    std::atomic<float> pendingRadius{5.0f}, pendingDepth{5.0f};
+
+    /** Set when the impulse response no longer matches the parameters */
+    std::atomic<bool> impulseResponseStale{false};
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ConvolutionResonatorModel)
+};
+
+#endif // CONVOLUTION_RESONATOR_MODEL_H
@@ -8,7 +8,7 @@
 /**
  * @brief Class representing a 3D modal resonator simulation GUI.
  */
-class ModalResonator final : public juce::OpenGLAppComponent {
+class ModalResonator final : public juce::OpenGLAppComponent, juce::Timer {
 public:
     /**
      * @brief Constructor for the ModalResonator class.
@@ -22,7 +22,22 @@ public:
     /**
      * @brief Destructor for the ModalResonator class.
      */
-    ~ModalResonator() override { openGLContext.detach(); }
+    ~ModalResonator() override {
+        stopTimer();
+        openGLContext.detach();
+    }
+
+    /**
+     * @brief Attach or detach the OpenGL context when the component is shown
+     * or hidden.
+     */
+    void visibilityChanged() override { updateContextAttachment(); }
+
+    /**
+     * @brief Attach or detach the OpenGL context when the component is added
+     * to or removed from a window.
+     */
+    void parentHierarchyChanged() override { updateContextAttachment(); }
 
     /**
      * @brief Initialise the OpenGL context.
@@ -61,6 +76,22 @@ public:
                                float zFar);
 
 private:
+    /**
+     * @brief Attach the OpenGL context while the component is showing on
+     * screen and detach it otherwise, so a closed, hidden or minimised
+     * editor neither holds a context nor renders.
+     */
+    void updateContextAttachment();
+
+    /**
+     * @brief Catch the window being minimised or restored, which changes
+     * whether the component is showing without telling it.
+     */
+    void timerCallback() override { updateContextAttachment(); }
+
+    /** Times per second the showing state is checked */
+    static constexpr int showingCheckRate = 4;
+
     /** Reference to the processor's parameter tree */
     juce::AudioProcessorValueTreeState &parameters;
 
@@ -1,8 +1,14 @@
 #ifndef MODAL_RESONATOR_MODEL_H
 #define MODAL_RESONATOR_MODEL_H
 
+#include <array>
+#include <atomic>
 #include <juce_audio_basics/juce_audio_basics.h>
 #include <juce_audio_utils/juce_audio_utils.h>
+#include <span>
+#include <vector>
+#include "MemoryArena.h"
+#include "SharedTableCache.h"
 
 /**
  * @brief Modal resonator class.
@@ -17,7 +23,30 @@ public:
     explicit ModalResonatorModel(juce::AudioProcessorValueTreeState &state);
 
     /**
-     * @brief Set the physical parameters of the resonator.
+     * @brief Destructor for ModalResonatorModel.
+     */
+    ~ModalResonatorModel() override;
+
+    /**
+     * @brief Gets the room the mode states take in a MemoryArena for the
+     * current mode count.
+     * @return The size in bytes.
+     */
+    [[nodiscard]] size_t getStateSize() const;
+
+    /**
+     * @brief Places the mode states in an arena. Call it after setModeCount
+     * and before setParameters. Until the modes are placed, the resonator
+     * is silent. Not real-time safe.
+     * @param arena The arena, with room for getStateSize bytes.
+     */
+    void placeState(MemoryArena &arena);
+
+    /**
+     * @brief Set the physical parameters of the resonator. The new mode
+     * coefficients take effect immediately and the mode states are cleared.
+     * Rebuilds the coefficient table if the sample rate or mode count
+     * changed. Not real-time safe.
      * @param radiusMeters The radius of the resonator in meters.
      * @param depthMeters The depth of the resonator in meters.
      * @param sampleRate The sample rate of the audio processor.
@@ -31,6 +60,91 @@ public:
      */
     float process(float input);
 
+    /**
+     * @brief Render the impulse response of the mode set for a size and
+     * depth. Safe to call from a background thread; it does not touch the
+     * state used by process.
+     * @param radiusMeters The radius of the resonator in meters.
+     * @param depthMeters The depth of the resonator in meters.
+     * @param sampleRate The sample rate of the impulse response.
+     * @param maxLength The maximum length of the response in samples.
+     * @return The impulse response, trimmed once every mode has decayed
+     * below the gate threshold.
+     */
+    [[nodiscard]] juce::AudioBuffer<float>
+    renderImpulseResponse(float radiusMeters, float depthMeters,
+                          float sampleRate, int maxLength) const;
+
+    /**
+     * @brief Writes the coefficient table in use, so a restored session can
+     * adopt it instead of building it again. Writes an empty table until
+     * setParameters has been called.
+     * @param stream The stream to write to.
+     */
+    void writeCoefficientTable(juce::OutputStream &stream) const;
+
+    /**
+     * @brief Reads a coefficient table written by writeCoefficientTable
+     * into the table cache shared by every instance, unless the cache
+     * already holds it. The next call to setParameters with the same sample
+     * rate and mode count then finds it there. A table of another format,
+     * of the wrong size or with a value that is not finite is rejected, and
+     * setParameters builds it instead. Not real-time safe.
+     * @param stream The stream to read from, positioned at the table.
+     * @return The table, to be held until the resonators are prepared, or
+     * null if the stream does not hold a valid table.
+     */
+    static std::shared_ptr<const void>
+    readCoefficientTable(juce::InputStream &stream);
+
+    /**
+     * @brief Set the size of the mode set. Takes effect on the next call to
+     * setParameters.
+     * @param numRadialModes The number of Bessel zeros to use.
+     * @param numAxialModes The number of axial orders per Bessel zero.
+     */
+    void setModeCount(int numRadialModes, int numAxialModes);
+
+    /**
+     * @brief Continue the ringing of another resonator at the same sample
+     * rate on this one. Modes present in both mode sets keep their state,
+     * the others start silent.
+     * @param source The resonator to take the mode states from.
+     */
+    void transferStateFrom(const ModalResonatorModel &source);
+
+    /**
+     * @brief Set the highest mode frequency as a fraction of Nyquist. Modes
+     * above it are culled. Takes effect on the next call to setParameters.
+     * @param ratio The fraction of Nyquist, between 0 and 1.
+     */
+    void setMaxFrequencyRatio(float ratio);
+
+    /**
+     * @brief Set the level below which a mode is gated off while the input
+     * is quiet. Takes effect from the next processed sample.
+     * @param threshold The linear amplitude threshold.
+     */
+    void setGateThreshold(float threshold);
+
+    /**
+     * @brief Gets the number of modes currently being processed.
+     * @return The number of active modes.
+     */
+    [[nodiscard]] int getNumActiveModes() const { return numActiveModes; }
+
+    /**
+     * @brief Gets the number of modes below the frequency limit.
+     * @return The number of audible modes.
+     */
+    [[nodiscard]] int getNumAudibleModes() const { return numAudibleModes; }
+
+    /** Largest number of Bessel zeros supported by setModeCount */
+    static constexpr int maxRadialModes = 64;
+
+    /** Largest number of axial orders supported by setModeCount */
+    static constexpr int maxAxialModes = 8;
+
 private:
     /**
      * @brief Callback for when a parameter changes.
@@ -41,41 +155,228 @@ private:
                           float newValue) override;
 
     /**
-     * @brief Biquad filter mode structure.
+     * @brief Wake every sleeping mode.
+     */
+    void wakeModes();
+
+    /**
+     * @brief Gate off the active modes whose energy has decayed below the
+     * threshold.
+     */
+    void gateModes();
+
+    /**
+     * @brief Map a size or depth onto the coefficient table.
+     * @param meters The size or depth in meters.
+     * @return The fractional node index.
+     */
+    [[nodiscard]] float tablePosition(float meters) const;
+
+    /**
+     * @brief Ramp every mode towards the coefficients for a new size and
+     * depth, starting from the coefficients currently in use. Modes above
+     * the frequency limit are culled and modes that fall below it again are
+     * restored as sleeping modes. The coefficients are interpolated from the
+     * coefficient table.
+     * @param radiusMeters The radius of the resonator in meters.
+     * @param depthMeters The depth of the resonator in meters.
+     */
+    void retarget(float radiusMeters, float depthMeters);
+
+    /**
+     * @brief Compute the frequency of a cylindrical cavity mode.
+     * @param besselZero The Bessel zero of the radial mode.
+     * @param axialOrder The order of the axial mode.
+     * @param radiusMeters The radius of the resonator in meters.
+     * @param depthMeters The depth of the resonator in meters.
+     * @return The frequency of the mode in Hz.
      */
-    struct BiquadMode {
+    static float modeFrequency(float besselZero, int axialOrder,
+                               float radiusMeters, float depthMeters);
+
+    /**
+     * @brief Coefficients of one mode at one node of the coefficient table.
+     */
+    struct ModeCoefficients {
+        /** Pole coefficients and input gain */
+        float poleReal = 0, poleImag = 0, gain = 0;
+        /** Frequency of the mode in Hz, used for culling */
+        float frequency = 0;
+    };
+
+    /**
+     * @brief Name the coefficient table in the shared cache.
+     * @param sampleRate The sample rate of the audio processor.
+     * @param numRadialModes The number of Bessel zeros.
+     * @param numAxialModes The number of axial orders per Bessel zero.
+     * @return The key of the table.
+     */
+    static juce::String coefficientTableKey(float sampleRate,
+                                            int numRadialModes,
+                                            int numAxialModes);
+
+    /**
+     * @brief Evaluate the coefficients of every mode at every node of the
+     * coefficient table.
+     * @param sampleRate The sample rate of the audio processor.
+     * @param numRadialModes The number of Bessel zeros.
+     * @param numAxialModes The number of axial orders per Bessel zero.
+     * @return The table, indexed by [depth node][size node][mode].
+     */
+    static std::vector<ModeCoefficients>
+    buildCoefficientTable(float sampleRate, int numRadialModes,
+                          int numAxialModes);
+
+    /**
+     * @brief Resonant mode implemented as a complex one-pole filter. The
+     * pole is stored as its real and imaginary parts, which can be
+     * interpolated sample by sample without the transients a biquad shows
+     * when its coefficients move.
+     */
+    struct ResonatorMode {
         /**
-         * @brief Constructor for BiquadMode.
+         * @brief Set the target coefficients of the mode.
          * @param freq The frequency of the mode.
          * @param q The Q factor of the mode.
-         * @param sampleRate
+         * @param sampleRate The sample rate of the audio processor.
          */
-        BiquadMode(float freq, float q, float sampleRate);
+        void setTarget(float freq, float q, float sampleRate);
 
         /**
-         * @brief Set the coefficients for the Biquad filter.
-         * @param freq The frequency of the mode.
-         * @param q The Q factor of the mode.
-         * @param sampleRate The sample rate of the audio processor.
+         * @brief Set the target coefficients of the mode.
+         * @param coefficients The coefficients to ramp towards.
+         */
+        void setTarget(const ModeCoefficients &coefficients) {
+            targetReal = coefficients.poleReal;
+            targetImag = coefficients.poleImag;
+            targetGain = coefficients.gain;
+        }
+
+        /**
+         * @brief Start a linear ramp from the current to the target
+         * coefficients.
+         * @param rampLength The length of the ramp in samples.
+         */
+        void startRamp(int rampLength);
+
+        /**
+         * @brief Advance the coefficient ramp by one sample.
+         */
+        void advanceRamp() {
+            poleReal += poleRealStep;
+            poleImag += poleImagStep;
+            gain += gainStep;
+        }
+
+        /**
+         * @brief Jump to the target coefficients.
          */
-        void setCoefficients(float freq, float q, float sampleRate);
+        void snapToTarget();
 
         /**
-         * @brief Process the input signal through the Biquad filter.
+         * @brief Clear the filter state.
+         */
+        void clearState() { stateReal = stateImag = 0.0f; }
+
+        /**
+         * @brief Get the energy stored in the filter state.
+         * @return The squared magnitude of the state.
+         */
+        [[nodiscard]] float energy() const {
+            return stateReal * stateReal + stateImag * stateImag;
+        }
+
+        /**
+         * @brief Process the input signal through the mode.
          * @param input The input signal to process.
          * @return The processed output signal.
          */
-        float process(float input);
+        float process(const float input) {
+            const float real = poleReal * stateReal - poleImag * stateImag +
+                               gain * input;
+            stateImag = poleImag * stateReal + poleReal * stateImag;
+            stateReal = real;
+            return stateImag;
+        }
+
+        /** Pole coefficients and input gain currently in use */
+        float poleReal = 0, poleImag = 0, gain = 0;
+        /** Pole coefficients and input gain being ramped towards */
+        float targetReal = 0, targetImag = 0, targetGain = 0;
+        /** Per-sample ramp increments */
+        float poleRealStep = 0, poleImagStep = 0, gainStep = 0;
+        /** Complex filter state */
+        float stateReal = 0, stateImag = 0;
 
-        /** Biquad filter coefficients */
-        float b0 = 0, b1 = 0, b2 = 0;
-        float a1 = 0, a2 = 0;
-        float x1 = 0, x2 = 0;
-        float y1 = 0, y2 = 0;
+        /** Index of the mode within each node of the coefficient table */
+        int tableIndex = 0;
+
+        /** Gating state of the mode */
+        enum class Gate : uint8_t { active, sleeping, culled };
+        Gate gate = Gate::active;
     };
 
-    /** List of Biquad modes */
-    std::vector<BiquadMode> modes;
+    /** Bessel zeros of the radial modes. The first five are the original
+     * bank, the rest follow in ascending order. */
+    static constexpr std::array<float, maxRadialModes> besselZeros = {
+            2.405f,  3.832f,  5.520f,  7.016f,  8.417f,  5.136f,  6.380f,
+            7.588f,  8.654f,  8.771f,  9.761f,  9.936f,  10.173f, 11.065f,
+            11.086f, 11.620f, 11.792f, 12.225f, 12.339f, 13.015f, 13.324f,
+            13.354f, 13.589f, 14.373f, 14.476f, 14.796f, 14.821f, 14.931f,
+            15.590f, 15.700f, 16.038f, 16.223f, 16.471f, 16.698f, 17.004f,
+            17.241f, 17.616f, 17.801f, 17.960f, 18.071f, 18.288f, 18.433f,
+            18.900f, 18.980f, 19.409f, 19.555f, 19.616f, 19.616f, 19.994f,
+            20.321f, 20.790f, 20.807f, 20.827f, 21.085f, 21.117f, 21.212f,
+            21.642f, 21.956f, 22.047f, 22.172f, 22.218f, 22.583f, 22.760f,
+            22.945f};
+
+    /** Number of Bessel zeros in use */
+    int numRadialModes = 5;
+
+    /** Number of axial modes per radial mode */
+    int numAxialModes = 3;
+
+    /** Highest mode frequency as a fraction of Nyquist */
+    float maxFrequencyRatio = 0.9f;
+
+    /** Level below which a quiet mode is gated off */
+    float gateThreshold = 1.0e-5f;
+
+    /** Samples between two gating checks */
+    static constexpr int gateCheckInterval = 32;
+
+    /** Q factor of every mode */
+    static constexpr float modeQ = 10.0f;
+
+    /** Length of a coefficient ramp in samples */
+    static constexpr int rampDuration = 256;
+
+    /** Number of nodes of the coefficient table along size and depth */
+    static constexpr int tableResolution = 33;
+
+    /** Version of the layout and mode formulas of the coefficient table.
+     * Bump it when either changes, so tables of other builds are neither
+     * adopted from a saved state nor shared under the same key */
+    static constexpr int coefficientTableFormat = 1;
+
+    /** Smallest and largest size and depth covered by the coefficient table,
+     * matching the parameter ranges */
+    static constexpr float tableMinMeters = 0.75f, tableMaxMeters = 10.0f;
+
+    /** Cache of tables shared by every instance in the process */
+    juce::SharedResourcePointer<SharedTableCache> tableCache;
+
+    /** Mode coefficients on a grid of sizes and depths spaced evenly on a
+     * log scale, indexed by [depth node][size node][mode]. Shared by every
+     * instance with the same sample rate and mode count */
+    std::shared_ptr<const std::vector<ModeCoefficients>> coefficientTable;
+
+    /** Room for the modes of the current mode count, placed in a
+     * MemoryArena */
+    std::span<ResonatorMode> modeStorage;
+
+    /** List of resonator modes, the start of the mode storage */
+    std::span<ResonatorMode> modes;
 
     /** AudioProcessorValueTreeState reference */
     juce::AudioProcessorValueTreeState &state;
@@ -83,11 +384,24 @@ private:
     /** Sample rate of the audio processor */
     float m_sampleRate = 44100.0f;
 
-    /** Crossfading parameters */
-    std::vector<BiquadMode> oldModes;
-    int crossfadeCounter = 0;
-    const int crossfadeDuration = 512;
-    bool isCrossfading = false;
+    /** Size and depth most recently delivered by the parameter listener */
+    std::atomic<float> pendingRadius{5.0f}, pendingDepth{5.0f};
+
+    /** Set when the pending size or depth has not yet been applied */
+    std::atomic<bool> parametersChanged{false};
+
+    /** Samples remaining in the current coefficient ramp */
+    int rampSamplesRemaining = 0;
+
+    /** Modes [0, numActiveModes) are processed, modes up to numAudibleModes
+     * are sleeping and the rest are culled */
+    int numActiveModes = 0, numAudibleModes = 0;
+
+    /** Samples since the last gating check */
+    int gateCounter = 0;
+
+    /** Largest input magnitude since the last gating check */
+    float inputPeak = 0.0f;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ModalResonatorModel)
 };
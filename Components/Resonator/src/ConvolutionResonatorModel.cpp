@@ -0,0 +1,135 @@
+#include "ConvolutionResonatorModel.h"
+#include "TraceRecorder.h"
+
+/**
+ * @brief Constructor for ConvolutionResonatorModel.
+ * @param state The AudioProcessorValueTreeState to use for parameter
+ * changes.
+ * @param modalModel The modal model whose impulse response is used.
+ */
+ConvolutionResonatorModel::ConvolutionResonatorModel(
+        juce::AudioProcessorValueTreeState &state,
+        const ModalResonatorModel &modalModel) :
+    Thread("PDrum Impulse Response Renderer"), state(state),
+    modalModel(modalModel) {
+    state.addParameterListener("membraneSize", this);
+    state.addParameterListener("depth", this);
+}
+
+/**
+ * @brief Destructor for ConvolutionResonatorModel.
+ */
+ConvolutionResonatorModel::~ConvolutionResonatorModel() {
+    state.removeParameterListener("membraneSize", this);
+    state.removeParameterListener("depth", this);
+    release();
+}
+
+/**
+ * @brief Prepare the convolver and render the first impulse response.
+ * Not real-time safe.
+ * @param sampleRate The sample rate of the audio processor.
+ * @param maximumBlockSize The largest block passed to process.
+ * @param latencySamples Zero for a non-uniformly partitioned convolver
+ * without latency, or the partition size of a uniformly partitioned
+ * convolver that trades latency for lower cost.
+ */
+void ConvolutionResonatorModel::prepare(const double sampleRate,
+                                        const int maximumBlockSize,
+                                        const int latencySamples) {
+    release();
+    m_sampleRate.store(sampleRate);
+    maxBlockSize = maximumBlockSize;
+    if (latencySamples > 0)
+        convolution = std::make_unique<juce::dsp::Convolution>(
+                juce::dsp::Convolution::Latency{latencySamples});
+    else
+        convolution = std::make_unique<juce::dsp::Convolution>(
+                juce::dsp::Convolution::NonUniform{headSize});
+    convolution->prepare({sampleRate,
+                          static_cast<juce::uint32>(maximumBlockSize), 1});
+    pendingRadius.store(state.getRawParameterValue("membraneSize")->load());
+    pendingDepth.store(state.getRawParameterValue("depth")->load());
+    loadImpulseResponse();
+    startThread(Priority::low);
+}
+
+/**
+ * @brief Stops the impulse response renderer, which reads the mode set
+ * of the modal model, so the mode set can change. Not real-time safe.
+ */
+void ConvolutionResonatorModel::release() { stopThread(2000); }
+
+/**
+ * @brief Process a block of samples in place.
+ * @param samples The samples to process.
+ * @param numSamples The number of samples.
+ */
+void ConvolutionResonatorModel::process(float *samples, const int numSamples) {
+    if (convolution == nullptr)
+        return;
+    for (int offset = 0; offset < numSamples; offset += maxBlockSize) {
+        float *channel = samples + offset;
+        juce::dsp::AudioBlock<float> block(
+                &channel, 1,
+                static_cast<size_t>(std::min(maxBlockSize,
+                                             numSamples - offset)));
+        convolution->process(
+                juce::dsp::ProcessContextReplacing<float>(block));
+    }
+}
+
+/**
+ * @brief Gets the latency of the convolver.
+ * @return The latency in samples.
+ */
+int ConvolutionResonatorModel::getLatency() const {
+    return convolution != nullptr ? convolution->getLatency() : 0;
+}
+
+/**
+ * @brief Callback for when a parameter changes.
+ * @param parameterID The ID of the parameter that changed.
+ * @param newValue The new value of the parameter.
+ */
+void ConvolutionResonatorModel::parameterChanged(
+        const juce::String &parameterID, const float newValue) {
+    PDRUM_TRACE_ZONE("ConvolutionResonatorModel::parameterChanged");
+    if (parameterID == "membraneSize")
+        pendingRadius.store(newValue);
+    else if (parameterID == "depth")
+        pendingDepth.store(newValue);
+    else
+        return;
+    impulseResponseStale.store(true);
+    notify();
+}
+
+/**
+ * @brief Render impulse responses whenever the size or depth change.
+ */
+void ConvolutionResonatorModel::run() {
+    while (!threadShouldExit()) {
+        if (impulseResponseStale.exchange(false))
+            loadImpulseResponse();
+        else
+            wait(-1);
+    }
+}
+
+/**
+ * @brief Render the impulse response for the pending size and depth and
+ * load it into the convolver.
+ */
+void ConvolutionResonatorModel::loadImpulseResponse() {
+    const double sampleRate = m_sampleRate.load();
+    auto impulseResponse = modalModel.renderImpulseResponse(
+            pendingRadius.load(), pendingDepth.load(),
+            static_cast<float>(sampleRate),
+            static_cast<int>(maxImpulseResponseSeconds * sampleRate));
+    /// The convolver swaps to the new response with a short crossfade
+    convolution->loadImpulseResponse(std::move(impulseResponse), sampleRate,
+                                     juce::dsp::Convolution::Stereo::no,
+                                     juce::dsp::Convolution::Trim::no,
+                                     juce::dsp::Convolution::Normalise::no);
+}
@@ -1,4 +1,5 @@
 #include "ModalResonator.h"
+#include "TraceRecorder.h"
 
 /**
  * @brief Constructor for the ModalResonator class.
@@ -16,6 +17,24 @@ ModalResonator::ModalResonator(juce::AudioProcessorValueTreeState &state,
     setSize(400, 400);
     openGLContext.setContinuousRepainting(true);
     openGLContext.setSwapInterval(60);
+    /// The base class attaches the context, which waits until shown
+    openGLContext.detach();
+    startTimerHz(showingCheckRate);
+}
+
+/**
+ * @brief Attach the OpenGL context while the component is showing on
+ * screen and detach it otherwise, so a closed, hidden or minimised
+ * editor neither holds a context nor renders.
+ */
+void ModalResonator::updateContextAttachment() {
+    const bool showing = isShowing();
+    if (showing == openGLContext.isAttached())
+        return;
+    if (showing)
+        openGLContext.attachTo(*this);
+    else
+        openGLContext.detach();
 }
 
 /**
@@ -32,6 +51,8 @@ void ModalResonator::initialise() {
 void ModalResonator::render() {
     if (!juce::OpenGLHelpers::isContextActive())
         return;
+    PDRUM_TRACE_THREAD("OpenGL");
+    PDRUM_TRACE_ZONE("ModalResonator::render");
     /// Compute time delta
     const uint32_t currentTime = juce::Time::getMillisecondCounter();
     const float deltaTime =
@@ -139,7 +160,6 @@ void ModalResonator::drawCylinder(const float radius, const float height,
 
 void ModalResonator::drawMembraneMesh(const float radius,
                                       const float height) const {
-    const auto &current = m_membraneModel.getCurrentBuffer();
     const auto &isInside = m_membraneModel.getIsInsideMask();
     const int gridResolution = m_membraneModel.getGridResolution();
 
@@ -155,7 +175,7 @@ void ModalResonator::drawMembraneMesh(const float radius,
             if (!isInside[idx])
                 continue;
 
-            const float value = current[idx];
+            const float value = m_membraneModel.getCell(idx);
             const float logValue =
                     std::log10(1.0f + std::abs(value) * 3000.0f) / logDenom;
             const float scaled = juce::jlimit(0.0f, 1.0f, logValue);
@@ -1,4 +1,7 @@
 #include "ModalResonatorModel.h"
+#include <algorithm>
+#include <cmath>
+#include "TraceRecorder.h"
 
 /**
  * @brief Constructor for ModalResonator.
@@ -11,7 +14,43 @@ ModalResonatorModel::ModalResonatorModel(
 }
 
 /**
- * @brief Set the physical parameters of the resonator.
+ * @brief Destructor for ModalResonatorModel.
+ */
+ModalResonatorModel::~ModalResonatorModel() {
+    state.removeParameterListener("membraneSize", this);
+    state.removeParameterListener("depth", this);
+}
+
+/**
+ * @brief Gets the room the mode states take in a MemoryArena for the
+ * current mode count.
+ * @return The size in bytes.
+ */
+size_t ModalResonatorModel::getStateSize() const {
+    return MemoryArena::sizeFor<ResonatorMode>(
+            static_cast<size_t>(numRadialModes * numAxialModes));
+}
+
+/**
+ * @brief Places the mode states in an arena. Call it after setModeCount
+ * and before setParameters. Until the modes are placed, the resonator
+ * is silent. Not real-time safe.
+ * @param arena The arena, with room for getStateSize bytes.
+ */
+void ModalResonatorModel::placeState(MemoryArena &arena) {
+    const auto numModes = static_cast<size_t>(numRadialModes * numAxialModes);
+    auto *storage = arena.allocate<ResonatorMode>(numModes);
+    modeStorage = storage != nullptr ? std::span(storage, numModes)
+                                     : std::span<ResonatorMode>();
+    modes = {};
+    numActiveModes = numAudibleModes = 0;
+}
+
+/**
+ * @brief Set the physical parameters of the resonator. The new mode
+ * coefficients take effect immediately and the mode states are cleared.
+ * Rebuilds the coefficient table if the sample rate or mode count
+ * changed. Not real-time safe.
  * @param radiusMeters The radius of the resonator in meters.
  * @param depthMeters The depth of the resonator in meters.
  * @param sampleRate The sample rate of the audio processor.
@@ -20,31 +59,29 @@ void ModalResonatorModel::setParameters(const float radiusMeters,
                                         const float depthMeters,
                                         const float sampleRate) {
     m_sampleRate = sampleRate;
-
-    std::vector<BiquadMode> newModes;
-
-    for (const std::vector besselZeros = {2.405f, 3.832f, 5.520f, 7.016f,
-                                          8.417f};
-         const float alpha: besselZeros) {
-        constexpr int numAxialModes = 3;
-        for (int n = 0; n < numAxialModes; ++n) {
-            constexpr float c = 343.0f;
-            float freq =
-                    (c / (2.0f * juce::MathConstants<float>::pi)) *
-                    std::sqrt(std::pow(alpha / radiusMeters, 2.0f) +
-                              std::pow(static_cast<float>(n) *
-                                               juce::MathConstants<float>::pi /
-                                               depthMeters,
-                                       2.0f));
-            float q = 10.0f;
-            newModes.emplace_back(freq, q, sampleRate);
-        }
-    }
-    // Begin crossfade: move current modes to oldModes and swap in newModes
-    oldModes = std::move(modes);
-    modes = std::move(newModes);
-    crossfadeCounter = 0;
-    isCrossfading = true;
+    pendingRadius.store(radiusMeters);
+    pendingDepth.store(depthMeters);
+    parametersChanged.store(false);
+    coefficientTable = tableCache->get<std::vector<ModeCoefficients>>(
+            coefficientTableKey(sampleRate, numRadialModes, numAxialModes),
+            [&] {
+                return buildCoefficientTable(sampleRate, numRadialModes,
+                                             numAxialModes);
+            });
+    /// The storage is short only if it was placed for another mode count
+    const auto numModes = static_cast<size_t>(numRadialModes * numAxialModes);
+    jassert(modeStorage.size() >= numModes);
+    modes = modeStorage.first(std::min(numModes, modeStorage.size()));
+    std::fill(modes.begin(), modes.end(), ResonatorMode{});
+    for (size_t i = 0; i < modes.size(); ++i)
+        modes[i].tableIndex = static_cast<int>(i);
+    numActiveModes = numAudibleModes = static_cast<int>(modes.size());
+    retarget(radiusMeters, depthMeters);
+    for (auto &mode: modes)
+        mode.snapToTarget();
+    rampSamplesRemaining = 0;
+    gateCounter = 0;
+    inputPeak = 0.0f;
 }
 
 /**
@@ -53,23 +90,234 @@ void ModalResonatorModel::setParameters(const float radiusMeters,
  * @return The processed output signal.
  */
 float ModalResonatorModel::process(const float input) {
-    float newOutput = 0.0f;
-    for (auto &mode: modes)
-        newOutput += mode.process(input);
-    if (isCrossfading) {
-        float oldOutput = 0.0f;
-        for (auto &oldMode: oldModes)
-            oldOutput += oldMode.process(input);
-        const float alpha = static_cast<float>(crossfadeCounter) /
-                            static_cast<float>(crossfadeDuration);
-        const float output = (1.0f - alpha) * oldOutput + alpha * newOutput;
-        if (++crossfadeCounter >= crossfadeDuration) {
-            isCrossfading = false;
-            oldModes.clear();
+    if (parametersChanged.load(std::memory_order_relaxed) &&
+        parametersChanged.exchange(false, std::memory_order_acquire))
+        retarget(pendingRadius.load(), pendingDepth.load());
+    const float inputMagnitude = std::abs(input);
+    if (inputMagnitude > gateThreshold && numActiveModes < numAudibleModes)
+        wakeModes();
+    inputPeak = std::max(inputPeak, inputMagnitude);
+    if (++gateCounter >= gateCheckInterval)
+        gateModes();
+    float output = 0.0f;
+    const auto activeEnd = modes.begin() + numActiveModes;
+    if (rampSamplesRemaining > 0) {
+        for (auto mode = modes.begin(); mode != activeEnd; ++mode) {
+            output += mode->process(input);
+            mode->advanceRamp();
+        }
+        /// Land exactly on the target to avoid accumulating rounding errors
+        if (--rampSamplesRemaining == 0) {
+            for (auto &mode: modes)
+                mode.snapToTarget();
         }
         return output;
     }
-    return newOutput;
+    for (auto mode = modes.begin(); mode != activeEnd; ++mode)
+        output += mode->process(input);
+    return output;
+}
+
+/**
+ * @brief Render the impulse response of the mode set for a size and
+ * depth. Safe to call from a background thread; it does not touch the
+ * state used by process.
+ * @param radiusMeters The radius of the resonator in meters.
+ * @param depthMeters The depth of the resonator in meters.
+ * @param sampleRate The sample rate of the impulse response.
+ * @param maxLength The maximum length of the response in samples.
+ * @return The impulse response, trimmed once every mode has decayed
+ * below the gate threshold.
+ */
+juce::AudioBuffer<float> ModalResonatorModel::renderImpulseResponse(
+        const float radiusMeters, const float depthMeters,
+        const float sampleRate, const int maxLength) const {
+    const float maxFrequency = maxFrequencyRatio * 0.5f * sampleRate;
+    std::vector<ResonatorMode> bank;
+    bank.reserve(static_cast<size_t>(numRadialModes * numAxialModes));
+    for (int k = 0; k < numRadialModes; ++k) {
+        for (int n = 0; n < numAxialModes; ++n) {
+            const float frequency =
+                    modeFrequency(besselZeros[static_cast<size_t>(k)], n,
+                                  radiusMeters, depthMeters);
+            if (frequency > maxFrequency)
+                continue;
+            auto &mode = bank.emplace_back();
+            mode.setTarget(frequency, modeQ, sampleRate);
+            mode.snapToTarget();
+        }
+    }
+    juce::AudioBuffer<float> impulseResponse(1, std::max(1, maxLength));
+    impulseResponse.clear();
+    float *out = impulseResponse.getWritePointer(0);
+    const float energyThreshold = gateThreshold * gateThreshold;
+    int length = impulseResponse.getNumSamples();
+    for (int i = 0; i < impulseResponse.getNumSamples(); ++i) {
+        const float input = i == 0 ? 1.0f : 0.0f;
+        float output = 0.0f;
+        for (auto &mode: bank)
+            output += mode.process(input);
+        out[i] = output;
+        /// Drop decayed modes as the response rings out
+        if ((i + 1) % gateCheckInterval == 0) {
+            std::erase_if(bank, [&](const ResonatorMode &mode) {
+                return mode.energy() < energyThreshold;
+            });
+            if (bank.empty()) {
+                length = i + 1;
+                break;
+            }
+        }
+    }
+    impulseResponse.setSize(1, length, true);
+    return impulseResponse;
+}
+
+/**
+ * @brief Writes the coefficient table in use, so a restored session can
+ * adopt it instead of building it again. Writes an empty table until
+ * setParameters has been called.
+ * @param stream The stream to write to.
+ */
+void ModalResonatorModel::writeCoefficientTable(
+        juce::OutputStream &stream) const {
+    const bool hasTable = coefficientTable != nullptr;
+    stream.writeInt(coefficientTableFormat);
+    stream.writeFloat(hasTable ? m_sampleRate : 0.0f);
+    stream.writeInt(hasTable ? numRadialModes : 0);
+    stream.writeInt(hasTable ? numAxialModes : 0);
+    if (!hasTable)
+        return;
+    /// Four little-endian floats per entry, the layout in memory on every
+    /// supported platform
+    static_assert(sizeof(ModeCoefficients) == 4 * sizeof(float));
+#if JUCE_LITTLE_ENDIAN
+    stream.write(coefficientTable->data(),
+                 coefficientTable->size() * sizeof(ModeCoefficients));
+#else
+    for (const auto &entry: *coefficientTable) {
+        stream.writeFloat(entry.poleReal);
+        stream.writeFloat(entry.poleImag);
+        stream.writeFloat(entry.gain);
+        stream.writeFloat(entry.frequency);
+    }
+#endif
+}
+
+/**
+ * @brief Reads a coefficient table written by writeCoefficientTable
+ * into the table cache shared by every instance, unless the cache
+ * already holds it. The next call to setParameters with the same sample
+ * rate and mode count then finds it there. A table of another format,
+ * of the wrong size or with a value that is not finite is rejected, and
+ * setParameters builds it instead. Not real-time safe.
+ * @param stream The stream to read from, positioned at the table.
+ * @return The table, to be held until the resonators are prepared, or
+ * null if the stream does not hold a valid table.
+ */
+std::shared_ptr<const void>
+ModalResonatorModel::readCoefficientTable(juce::InputStream &stream) {
+    /// The layout and formulas of another build may differ
+    if (stream.readInt() != coefficientTableFormat)
+        return nullptr;
+    const float sampleRate = stream.readFloat();
+    const int radialModes = stream.readInt();
+    const int axialModes = stream.readInt();
+    if (!(sampleRate > 0.0f) || radialModes < 1 ||
+        radialModes > maxRadialModes || axialModes < 1 ||
+        axialModes > maxAxialModes)
+        return nullptr;
+    const auto numEntries = static_cast<size_t>(
+            tableResolution * tableResolution * radialModes * axialModes);
+    const auto numBytes =
+            static_cast<juce::int64>(numEntries * sizeof(ModeCoefficients));
+    if (stream.getNumBytesRemaining() < numBytes)
+        return nullptr;
+    std::vector<ModeCoefficients> entries(numEntries);
+#if JUCE_LITTLE_ENDIAN
+    if (stream.read(entries.data(), static_cast<int>(numBytes)) != numBytes)
+        return nullptr;
+#else
+    for (auto &entry: entries) {
+        entry.poleReal = stream.readFloat();
+        entry.poleImag = stream.readFloat();
+        entry.gain = stream.readFloat();
+        entry.frequency = stream.readFloat();
+    }
+#endif
+    /// A corrupt table would reach every instance through the cache
+    const bool finite = std::all_of(
+            entries.begin(), entries.end(), [](const ModeCoefficients &e) {
+                return std::isfinite(e.poleReal) &&
+                       std::isfinite(e.poleImag) && std::isfinite(e.gain) &&
+                       std::isfinite(e.frequency);
+            });
+    if (!finite)
+        return nullptr;
+    const juce::SharedResourcePointer<SharedTableCache> cache;
+    /// A table an instance already holds wins over the stored one
+    return cache->get<std::vector<ModeCoefficients>>(
+            coefficientTableKey(sampleRate, radialModes, axialModes),
+            [&entries] { return std::move(entries); });
+}
+
+/**
+ * @brief Set the size of the mode set. Takes effect on the next call to
+ * setParameters.
+ * @param numRadialModes The number of Bessel zeros to use.
+ * @param numAxialModes The number of axial orders per Bessel zero.
+ */
+void ModalResonatorModel::setModeCount(const int numRadialModes,
+                                       const int numAxialModes) {
+    this->numRadialModes = juce::jlimit(1, maxRadialModes, numRadialModes);
+    this->numAxialModes = juce::jlimit(1, maxAxialModes, numAxialModes);
+}
+
+/**
+ * @brief Continue the ringing of another resonator at the same sample
+ * rate on this one. Modes present in both mode sets keep their state,
+ * the others start silent.
+ * @param source The resonator to take the mode states from.
+ */
+void ModalResonatorModel::transferStateFrom(const ModalResonatorModel &source) {
+    for (auto &mode: modes) {
+        mode.clearState();
+        if (mode.gate == ResonatorMode::Gate::culled)
+            continue;
+        /// Match the modes by Bessel zero and axial order
+        const int radial = mode.tableIndex / numAxialModes;
+        const int axial = mode.tableIndex % numAxialModes;
+        if (radial >= source.numRadialModes || axial >= source.numAxialModes)
+            continue;
+        const int sourceIndex = radial * source.numAxialModes + axial;
+        for (const auto &other: source.modes) {
+            if (other.tableIndex == sourceIndex) {
+                mode.stateReal = other.stateReal;
+                mode.stateImag = other.stateImag;
+                break;
+            }
+        }
+    }
+    /// Gating sends the silent modes back to sleep
+    wakeModes();
+}
+
+/**
+ * @brief Set the highest mode frequency as a fraction of Nyquist. Modes
+ * above it are culled. Takes effect on the next call to setParameters.
+ * @param ratio The fraction of Nyquist, between 0 and 1.
+ */
+void ModalResonatorModel::setMaxFrequencyRatio(const float ratio) {
+    maxFrequencyRatio = juce::jlimit(0.0f, 1.0f, ratio);
+}
+
+/**
+ * @brief Set the level below which a mode is gated off while the input
+ * is quiet. Takes effect from the next processed sample.
+ * @param threshold The linear amplitude threshold.
+ */
+void ModalResonatorModel::setGateThreshold(const float threshold) {
+    gateThreshold = std::max(0.0f, threshold);
 }
 
 /**
@@ -79,65 +327,245 @@ float ModalResonatorModel::process(const float input) {
  */
 void ModalResonatorModel::parameterChanged(const juce::String &parameterID,
                                            const float newValue) {
+    PDRUM_TRACE_ZONE("ModalResonatorModel::parameterChanged");
     if (parameterID == "membraneSize") {
-        const float depth = state.getRawParameterValue("depth")->load();
-        setParameters(newValue, depth, m_sampleRate);
+        pendingRadius.store(newValue);
+        parametersChanged.store(true, std::memory_order_release);
     } else if (parameterID == "depth") {
-        const float size = state.getRawParameterValue("membraneSize")->load();
-        setParameters(size, newValue, m_sampleRate);
+        pendingDepth.store(newValue);
+        parametersChanged.store(true, std::memory_order_release);
     }
 }
 
 /**
- * @brief Constructor for BiquadMode.
- * @param freq The frequency of the mode.
- * @param q The Q factor of the mode.
- * @param sampleRate
+ * @brief Wake every sleeping mode.
  */
-ModalResonatorModel::BiquadMode::BiquadMode(const float freq, const float q,
-                                            const float sampleRate) {
-    setCoefficients(freq, q, sampleRate);
+void ModalResonatorModel::wakeModes() {
+    for (int i = numActiveModes; i < numAudibleModes; ++i)
+        modes[static_cast<size_t>(i)].gate = ResonatorMode::Gate::active;
+    numActiveModes = numAudibleModes;
+}
+
+/**
+ * @brief Gate off the active modes whose energy has decayed below the
+ * threshold.
+ */
+void ModalResonatorModel::gateModes() {
+    gateCounter = 0;
+    if (inputPeak < gateThreshold) {
+        const float energyThreshold = gateThreshold * gateThreshold;
+        for (int i = 0; i < numActiveModes;) {
+            if (auto &mode = modes[static_cast<size_t>(i)];
+                mode.energy() < energyThreshold) {
+                /// A sleeping mode has no state, so it can skip the ramp
+                mode.clearState();
+                mode.snapToTarget();
+                mode.gate = ResonatorMode::Gate::sleeping;
+                std::swap(mode, modes[static_cast<size_t>(--numActiveModes)]);
+            } else {
+                ++i;
+            }
+        }
+    }
+    inputPeak = 0.0f;
 }
 
 /**
- * @brief Set the coefficients for the Biquad filter.
+ * @brief Name the coefficient table in the shared cache.
+ * @param sampleRate The sample rate of the audio processor.
+ * @param numRadialModes The number of Bessel zeros.
+ * @param numAxialModes The number of axial orders per Bessel zero.
+ * @return The key of the table.
+ */
+juce::String ModalResonatorModel::coefficientTableKey(const float sampleRate,
+                                                      const int numRadialModes,
+                                                      const int numAxialModes) {
+    return "resonatorCoefficients/v" + juce::String(coefficientTableFormat) +
+           "/" + juce::String(sampleRate) + "/" +
+           juce::String(numRadialModes) + "x" + juce::String(numAxialModes);
+}
+
+/**
+ * @brief Evaluate the coefficients of every mode at every node of the
+ * coefficient table.
+ * @param sampleRate The sample rate of the audio processor.
+ * @param numRadialModes The number of Bessel zeros.
+ * @param numAxialModes The number of axial orders per Bessel zero.
+ * @return The table, indexed by [depth node][size node][mode].
+ */
+std::vector<ModalResonatorModel::ModeCoefficients>
+ModalResonatorModel::buildCoefficientTable(const float sampleRate,
+                                           const int numRadialModes,
+                                           const int numAxialModes) {
+    std::vector<ModeCoefficients> table(static_cast<size_t>(
+            tableResolution * tableResolution * numRadialModes *
+            numAxialModes));
+    const float ratio = tableMaxMeters / tableMinMeters;
+    auto entry = table.begin();
+    for (int row = 0; row < tableResolution; ++row) {
+        const float depthMeters =
+                tableMinMeters *
+                std::pow(ratio,
+                         static_cast<float>(row) / (tableResolution - 1));
+        for (int column = 0; column < tableResolution; ++column) {
+            const float radiusMeters =
+                    tableMinMeters *
+                    std::pow(ratio, static_cast<float>(column) /
+                                            (tableResolution - 1));
+            for (int k = 0; k < numRadialModes; ++k) {
+                for (int n = 0; n < numAxialModes; ++n) {
+                    const float frequency = modeFrequency(
+                            besselZeros[static_cast<size_t>(k)], n,
+                            radiusMeters, depthMeters);
+                    ResonatorMode mode;
+                    mode.setTarget(frequency, modeQ, sampleRate);
+                    *entry++ = {mode.targetReal, mode.targetImag,
+                                mode.targetGain, frequency};
+                }
+            }
+        }
+    }
+    return table;
+}
+
+/**
+ * @brief Map a size or depth onto the coefficient table.
+ * @param meters The size or depth in meters.
+ * @return The fractional node index.
+ */
+float ModalResonatorModel::tablePosition(const float meters) const {
+    /// Log spacing keeps the interpolation error roughly constant in cents
+    static const float nodesPerLog =
+            static_cast<float>(tableResolution - 1) /
+            std::log(tableMaxMeters / tableMinMeters);
+    const float clamped = juce::jlimit(tableMinMeters, tableMaxMeters, meters);
+    return std::log(clamped / tableMinMeters) * nodesPerLog;
+}
+
+/**
+ * @brief Ramp every mode towards the coefficients for a new size and
+ * depth, starting from the coefficients currently in use. Modes above
+ * the frequency limit are culled and modes that fall below it again are
+ * restored as sleeping modes. The coefficients are interpolated from the
+ * coefficient table.
+ * @param radiusMeters The radius of the resonator in meters.
+ * @param depthMeters The depth of the resonator in meters.
+ */
+void ModalResonatorModel::retarget(const float radiusMeters,
+                                   const float depthMeters) {
+    if (modes.empty())
+        return;
+    const float x = tablePosition(radiusMeters);
+    const float y = tablePosition(depthMeters);
+    const int column = std::min(static_cast<int>(x), tableResolution - 2);
+    const int row = std::min(static_cast<int>(y), tableResolution - 2);
+    const float fx = x - static_cast<float>(column);
+    const float fy = y - static_cast<float>(row);
+    const float w00 = (1.0f - fx) * (1.0f - fy), w01 = fx * (1.0f - fy);
+    const float w10 = (1.0f - fx) * fy, w11 = fx * fy;
+    const auto numModes = static_cast<size_t>(numRadialModes * numAxialModes);
+    const ModeCoefficients *node00 =
+            coefficientTable->data() +
+            static_cast<size_t>(row * tableResolution + column) * numModes;
+    const ModeCoefficients *node01 = node00 + numModes;
+    const ModeCoefficients *node10 = node00 + tableResolution * numModes;
+    const ModeCoefficients *node11 = node10 + numModes;
+    const auto blend = [&](const int i, float ModeCoefficients::*field) {
+        return w00 * (node00[i].*field) + w01 * (node01[i].*field) +
+               w10 * (node10[i].*field) + w11 * (node11[i].*field);
+    };
+
+    const float maxFrequency = maxFrequencyRatio * 0.5f * m_sampleRate;
+    for (auto &mode: modes) {
+        const int i = mode.tableIndex;
+        if (blend(i, &ModeCoefficients::frequency) > maxFrequency) {
+            mode.clearState();
+            mode.gate = ResonatorMode::Gate::culled;
+            continue;
+        }
+        mode.setTarget({blend(i, &ModeCoefficients::poleReal),
+                        blend(i, &ModeCoefficients::poleImag),
+                        blend(i, &ModeCoefficients::gain), 0.0f});
+        if (mode.gate == ResonatorMode::Gate::active) {
+            mode.startRamp(rampDuration);
+        } else {
+            /// Sleeping and restored modes have no state to carry over
+            mode.snapToTarget();
+            mode.gate = ResonatorMode::Gate::sleeping;
+        }
+    }
+    /// Order the modes as active, sleeping, culled
+    const auto audibleEnd =
+            std::partition(modes.begin(), modes.end(), [](const auto &mode) {
+                return mode.gate != ResonatorMode::Gate::culled;
+            });
+    const auto activeEnd =
+            std::partition(modes.begin(), audibleEnd, [](const auto &mode) {
+                return mode.gate == ResonatorMode::Gate::active;
+            });
+    numAudibleModes = static_cast<int>(audibleEnd - modes.begin());
+    numActiveModes = static_cast<int>(activeEnd - modes.begin());
+    rampSamplesRemaining = rampDuration;
+}
+
+/**
+ * @brief Compute the frequency of a cylindrical cavity mode.
+ * @param besselZero The Bessel zero of the radial mode.
+ * @param axialOrder The order of the axial mode.
+ * @param radiusMeters The radius of the resonator in meters.
+ * @param depthMeters The depth of the resonator in meters.
+ * @return The frequency of the mode in Hz.
+ */
+float ModalResonatorModel::modeFrequency(const float besselZero,
+                                         const int axialOrder,
+                                         const float radiusMeters,
+                                         const float depthMeters) {
+    constexpr float c = 343.0f;
+    return (c / (2.0f * juce::MathConstants<float>::pi)) *
+           std::sqrt(std::pow(besselZero / radiusMeters, 2.0f) +
+                     std::pow(static_cast<float>(axialOrder) *
+                                      juce::MathConstants<float>::pi /
+                                      depthMeters,
+                              2.0f));
+}
+
+/**
+ * @brief Set the target coefficients of the mode.
  * @param freq The frequency of the mode.
  * @param q The Q factor of the mode.
  * @param sampleRate The sample rate of the audio processor.
  */
-void ModalResonatorModel::BiquadMode::setCoefficients(const float freq,
-                                                      const float q,
-                                                      const float sampleRate) {
+void ModalResonatorModel::ResonatorMode::setTarget(const float freq,
+                                                   const float q,
+                                                   const float sampleRate) {
     const float omega =
             2.0f * juce::MathConstants<float>::pi * freq / sampleRate;
-    const float alpha = std::sin(omega) / (2.0f * q);
-    const float cos_omega = std::cos(omega);
-
-    b0 = alpha;
-    b1 = 0.0f;
-    b2 = -alpha;
-    const float a0 = 1.0f + alpha;
-    a1 = -2.0f * cos_omega;
-    a2 = 1.0f - alpha;
+    /// Pole radius for a -3 dB bandwidth of freq / q
+    const float radius =
+            std::exp(-juce::MathConstants<float>::pi * freq / (q * sampleRate));
+    targetReal = radius * std::cos(omega);
+    targetImag = radius * std::sin(omega);
+    /// Normalise the peak gain of the imaginary output to roughly unity
+    targetGain = 1.0f - radius * radius;
+}
 
-    // Normalize
-    b0 /= a0;
-    b1 /= a0;
-    b2 /= a0;
-    a1 /= a0;
-    a2 /= a0;
+/**
+ * @brief Start a linear ramp from the current to the target coefficients.
+ * @param rampLength The length of the ramp in samples.
+ */
+void ModalResonatorModel::ResonatorMode::startRamp(const int rampLength) {
+    const float inverseLength = 1.0f / static_cast<float>(rampLength);
+    poleRealStep = (targetReal - poleReal) * inverseLength;
+    poleImagStep = (targetImag - poleImag) * inverseLength;
+    gainStep = (targetGain - gain) * inverseLength;
 }
 
 /**
- * @brief Process the input signal through the Biquad filter.
- * @param input The input signal to process.
- * @return The processed output signal.
+ * @brief Jump to the target coefficients.
  */
-float ModalResonatorModel::BiquadMode::process(const float input) {
-    const float output = b0 * input + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
-    x2 = x1;
-    x1 = input;
-    y2 = y1;
-    y1 = output;
-    return output;
+void ModalResonatorModel::ResonatorMode::snapToTarget() {
+    poleReal = targetReal;
+    poleImag = targetImag;
+    gain = targetGain;
+    poleRealStep = poleImagStep = gainStep = 0.0f;
 }
@@ -0,0 +1,69 @@
+#ifndef SHARED_TABLE_CACHE_H
+#define SHARED_TABLE_CACHE_H
+
+#include <juce_core/juce_core.h>
+#include <map>
+#include <memory>
+
+/**
+ * @brief Process-wide cache of immutable precomputed tables.
+ *
+ * Hold it through a juce::SharedResourcePointer<SharedTableCache>. A table
+ * is built the first time its key is requested and handed out read-only to
+ * every later caller with the same key, so instances with the same grid
+ * size or sample rate share one copy. The cache only keeps weak references:
+ * a table is freed when the last instance using it lets go.
+ */
+class SharedTableCache final {
+public:
+    /**
+     * @brief Constructs an empty SharedTableCache.
+     */
+    SharedTableCache() = default;
+
+    /**
+     * @brief Gets the table for a key, building it if no instance holds it.
+     * Builds under a lock, so call it when preparing, not while processing.
+     * @tparam Table The type of the table.
+     * @tparam Builder A callable returning a Table.
+     * @param key A key naming the table and every input it depends on,
+     * such as the grid size, shape or sample rate.
+     * @param build Builds the table if it is not cached.
+     * @return The shared table.
+     */
+    template<typename Table, typename Builder>
+    std::shared_ptr<const Table> get(const juce::String &key,
+                                     Builder &&build) {
+        const juce::ScopedLock lock(mutex);
+        if (const auto entry = tables.find(key); entry != tables.end()) {
+            if (auto cached = entry->second.lock())
+                return std::static_pointer_cast<const Table>(cached);
+        }
+        removeExpired();
+        auto table = std::make_shared<const Table>(build());
+        tables[key] = table;
+        return table;
+    }
+
+    /**
+     * @brief Gets the number of tables currently alive.
+     * @return The number of tables.
+     */
+    [[nodiscard]] int getNumTables();
+
+private:
+    /**
+     * @brief Drop the entries of tables no instance holds anymore.
+     */
+    void removeExpired();
+
+    /** Guards the tables */
+    juce::CriticalSection mutex;
+
+    /** Tables by key */
+    std::map<juce::String, std::weak_ptr<const void>> tables;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SharedTableCache)
+};
+
+#endif // SHARED_TABLE_CACHE_H
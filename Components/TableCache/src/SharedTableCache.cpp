@@ -0,0 +1,23 @@
+#include "SharedTableCache.h"
+
+/**
+ * @brief Gets the number of tables currently alive.
+ * @return The number of tables.
+ */
+int SharedTableCache::getNumTables() {
+    const juce::ScopedLock lock(mutex);
+    removeExpired();
+    return static_cast<int>(tables.size());
+}
+
+/**
+ * @brief Drop the entries of tables no instance holds anymore.
+ */
+void SharedTableCache::removeExpired() {
+    for (auto it = tables.begin(); it != tables.end();) {
+        if (it->second.expired())
+            it = tables.erase(it);
+        else
+            ++it;
+    }
+}
@@ -0,0 +1,193 @@
+#ifndef TRACE_RECORDER_H
+#define TRACE_RECORDER_H
+
+#include <juce_core/juce_core.h>
+
+#ifndef PDRUM_ENABLE_TRACING
+#define PDRUM_ENABLE_TRACING 0
+#endif
+
+#if PDRUM_ENABLE_TRACING
+#include <array>
+#include <atomic>
+#include <cstdint>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#else
+#include <chrono>
+#endif
+
+/**
+ * @brief Records timed zones into per-thread rings for Chrome's trace
+ * viewer and Perfetto.
+ *
+ * Every thread that enters a zone gets a ring of its own on first use, so
+ * recording a zone takes two time stamp counter reads and four relaxed
+ * stores, without locks or shared cache lines. A ring keeps the latest
+ * events and overwrites the oldest ones. When the thread exits, its ring is
+ * handed to the next new thread, so threads that come and go do not add
+ * memory. The rings are read while the threads keep recording, and events
+ * overwritten during the read are dropped from the dump.
+ *
+ * Only compiled in with the PDRUM_ENABLE_TRACING build option. Otherwise
+ * the macros below expand to nothing.
+ */
+class TraceRecorder final {
+public:
+    /**
+     * @brief Records the time from its construction to its destruction as
+     * a zone of the current thread.
+     */
+    class Zone final {
+    public:
+        /**
+         * @brief Starts a zone.
+         * @param name The name of the zone, a string literal.
+         */
+        explicit Zone(const char *name) noexcept :
+            name(name), begin(now()) {}
+
+        /**
+         * @brief Ends the zone and records it.
+         */
+        ~Zone() { record(name, begin, now()); }
+
+    private:
+        /** Name of the zone */
+        const char *const name;
+
+        /** Time stamp of the start of the zone */
+        const uint64_t begin;
+
+        JUCE_DECLARE_NON_COPYABLE(Zone)
+    };
+
+    /**
+     * @brief Reads the time stamp counter.
+     * @return The current time, in counter ticks.
+     */
+    static uint64_t now() noexcept {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+        return __rdtsc();
+#elif defined(__aarch64__)
+        uint64_t ticks;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+        return ticks;
+#else
+        return static_cast<uint64_t>(
+                std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+    /**
+     * @brief Records a zone of the current thread.
+     * @param name The name of the zone, a string literal.
+     * @param begin The time stamp of the start of the zone.
+     * @param end The time stamp of the end of the zone.
+     */
+    static void record(const char *name, const uint64_t begin,
+                       const uint64_t end) noexcept {
+        Ring *ring = threadRing;
+        if (ring == nullptr)
+            ring = attachThread();
+        const uint64_t index = ring->written.load(std::memory_order_relaxed);
+        /// Readers that see any of the stores below also see that the slot
+        /// was being overwritten
+        std::atomic_thread_fence(std::memory_order_release);
+        auto &event = ring->events[index & (ringCapacity - 1)];
+        event.name.store(name, std::memory_order_relaxed);
+        event.begin.store(begin, std::memory_order_relaxed);
+        event.end.store(end, std::memory_order_relaxed);
+        event.thread.store(ring->thread, std::memory_order_relaxed);
+        ring->written.store(index + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Names the current thread in the trace. Threads started as a
+     * juce::Thread are named after it, other threads are numbered unless
+     * they call this. Cheap to call again with the same name.
+     * @param name The name of the thread, a string literal.
+     */
+    static void setThreadName(const char *name);
+
+    /**
+     * @brief Writes the recorded zones of every thread as a Chrome trace
+     * JSON file, which chrome://tracing and ui.perfetto.dev open. Not
+     * real-time safe.
+     * @param file The file to write.
+     * @return True if the file was written.
+     */
+    static bool writeChromeTrace(const juce::File &file);
+
+private:
+    /** Events kept per thread, a power of two */
+    static constexpr uint64_t ringCapacity = 1u << 15;
+
+    /**
+     * @brief A recorded zone, stored field by field so a ring can be read
+     * while its thread overwrites it.
+     */
+    struct Event {
+        /** Name of the zone */
+        std::atomic<const char *> name{nullptr};
+        /** Time stamps of the start and end of the zone */
+        std::atomic<uint64_t> begin{0}, end{0};
+        /** Number of the thread that recorded the zone */
+        std::atomic<uint64_t> thread{0};
+    };
+
+    /**
+     * @brief The events of one thread at a time.
+     */
+    struct Ring {
+        /** Number of events ever written, the next one goes at this index
+         * modulo ringCapacity */
+        alignas(64) std::atomic<uint64_t> written{0};
+        /** Number of the thread that owns the ring */
+        uint64_t thread = 0;
+        /** Name the owning thread last set, or nullptr */
+        const char *threadName = nullptr;
+        /** The latest events */
+        std::array<Event, ringCapacity> events;
+    };
+
+    /** The rings and thread names of the process */
+    struct Registry;
+
+    /**
+     * @brief Gets the rings and thread names of the process.
+     * @return The registry, created on first use.
+     */
+    static Registry &getRegistry();
+
+    /**
+     * @brief Gives the current thread a ring, reusing the ring of a thread
+     * that has exited if there is one.
+     * @return The ring of the current thread.
+     */
+    static Ring *attachThread();
+
+    /** Ring of the current thread, or nullptr before its first zone */
+    static inline thread_local Ring *threadRing = nullptr;
+};
+
+/** Joins the line number to a name, for unique zone variable names */
+#define PDRUM_TRACE_JOIN(a, b) PDRUM_TRACE_JOIN_IMPL(a, b)
+#define PDRUM_TRACE_JOIN_IMPL(a, b) a##b
+
+/** Records the rest of the enclosing scope as a zone */
+#define PDRUM_TRACE_ZONE(name)                                                 \
+    const TraceRecorder::Zone PDRUM_TRACE_JOIN(traceZone, __LINE__)(name)
+
+/** Names the current thread in the trace */
+#define PDRUM_TRACE_THREAD(name) TraceRecorder::setThreadName(name)
+#else
+#define PDRUM_TRACE_ZONE(name)
+#define PDRUM_TRACE_THREAD(name)
+#endif
+
+#endif // TRACE_RECORDER_H
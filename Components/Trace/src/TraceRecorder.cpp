@@ -0,0 +1,208 @@
+#include "TraceRecorder.h"
+
+#if PDRUM_ENABLE_TRACING
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The rings and thread names of the process.
+ */
+struct TraceRecorder::Registry {
+    /** Guards every member but the start of the trace */
+    std::mutex mutex;
+    /** Every ring ever created */
+    std::vector<std::unique_ptr<Ring>> rings;
+    /** Rings of threads that have exited */
+    std::vector<Ring *> freeRings;
+    /** Thread names by thread number */
+    std::map<uint64_t, std::string> threadNames;
+    /** Number of the next thread to attach */
+    uint64_t nextThread = 1;
+    /** Time stamp the trace starts at */
+    const uint64_t startTicks = now();
+    /** Steady clock time of the start, to calibrate the counter with */
+    const std::chrono::steady_clock::time_point startTime =
+            std::chrono::steady_clock::now();
+};
+
+/**
+ * @brief Gets the rings and thread names of the process.
+ * @return The registry, created on first use.
+ */
+TraceRecorder::Registry &TraceRecorder::getRegistry() {
+    static Registry registry;
+    return registry;
+}
+
+/**
+ * @brief Gives the current thread a ring, reusing the ring of a thread
+ * that has exited if there is one.
+ * @return The ring of the current thread.
+ */
+TraceRecorder::Ring *TraceRecorder::attachThread() {
+    /**
+     * @brief Hands the ring back when the thread exits.
+     */
+    struct Releaser {
+        ~Releaser() {
+            if (threadRing == nullptr)
+                return;
+            auto &registry = getRegistry();
+            const std::lock_guard lock(registry.mutex);
+            registry.freeRings.push_back(threadRing);
+            threadRing = nullptr;
+        }
+    };
+    auto &registry = getRegistry();
+    /// Construct the releaser after the registry, so it runs first on exit
+    static thread_local const Releaser releaser;
+    juce::ignoreUnused(releaser);
+    std::string name;
+    if (const auto *thread = juce::Thread::getCurrentThread())
+        name = thread->getThreadName().toStdString();
+    const std::lock_guard lock(registry.mutex);
+    Ring *ring;
+    if (registry.freeRings.empty()) {
+        registry.rings.push_back(std::make_unique<Ring>());
+        ring = registry.rings.back().get();
+    } else {
+        ring = registry.freeRings.back();
+        registry.freeRings.pop_back();
+    }
+    ring->thread = registry.nextThread++;
+    ring->threadName = nullptr;
+    if (name.empty())
+        name = "Thread " + std::to_string(ring->thread);
+    registry.threadNames[ring->thread] = name;
+    threadRing = ring;
+    return ring;
+}
+
+/**
+ * @brief Names the current thread in the trace. Threads started as a
+ * juce::Thread are named after it, other threads are numbered unless
+ * they call this. Cheap to call again with the same name.
+ * @param name The name of the thread, a string literal.
+ */
+void TraceRecorder::setThreadName(const char *name) {
+    Ring *ring = threadRing;
+    if (ring == nullptr)
+        ring = attachThread();
+    if (ring->threadName == name)
+        return;
+    auto &registry = getRegistry();
+    const std::lock_guard lock(registry.mutex);
+    registry.threadNames[ring->thread] = name;
+    ring->threadName = name;
+}
+
+/**
+ * @brief Appends a string to JSON text as a quoted string.
+ * @param json The JSON text.
+ * @param text The string to append.
+ */
+static void appendJsonString(std::string &json, const std::string &text) {
+    json += '"';
+    for (const char character: text) {
+        if (character == '"' || character == '\\')
+            json += '\\';
+        if (static_cast<unsigned char>(character) >= 0x20)
+            json += character;
+    }
+    json += '"';
+}
+
+/**
+ * @brief Writes the recorded zones of every thread as a Chrome trace
+ * JSON file, which chrome://tracing and ui.perfetto.dev open. Not
+ * real-time safe.
+ * @param file The file to write.
+ * @return True if the file was written.
+ */
+bool TraceRecorder::writeChromeTrace(const juce::File &file) {
+    auto &registry = getRegistry();
+    const uint64_t endTicks = now();
+    const auto endTime = std::chrono::steady_clock::now();
+    const double elapsedMicroseconds =
+            std::chrono::duration<double, std::micro>(endTime -
+                                                      registry.startTime)
+                    .count();
+    const double ticksPerMicrosecond =
+            elapsedMicroseconds > 0.0
+                    ? static_cast<double>(endTicks - registry.startTicks) /
+                              elapsedMicroseconds
+                    : 1.0;
+    const auto toMicroseconds = [&](const uint64_t ticks) {
+        return static_cast<double>(static_cast<int64_t>(
+                       ticks - registry.startTicks)) /
+               ticksPerMicrosecond;
+    };
+
+    std::string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+                       "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+                       "\"args\":{\"name\":\"PDrum\"}}";
+    char line[256];
+    const std::lock_guard lock(registry.mutex);
+    for (const auto &[thread, name]: registry.threadNames) {
+        std::snprintf(line, sizeof(line),
+                      ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                      "\"tid\":%llu,\"args\":{\"name\":",
+                      static_cast<unsigned long long>(thread));
+        json += line;
+        appendJsonString(json, name);
+        json += "}}";
+    }
+    for (const auto &ring: registry.rings) {
+        const uint64_t end = ring->written.load(std::memory_order_acquire);
+        const uint64_t begin = end > ringCapacity ? end - ringCapacity : 0;
+        std::vector<std::array<uint64_t, 3>> times;
+        std::vector<const char *> names;
+        times.reserve(static_cast<size_t>(end - begin));
+        names.reserve(static_cast<size_t>(end - begin));
+        for (uint64_t index = begin; index < end; ++index) {
+            const auto &event = ring->events[index & (ringCapacity - 1)];
+            names.push_back(event.name.load(std::memory_order_relaxed));
+            times.push_back({event.begin.load(std::memory_order_relaxed),
+                             event.end.load(std::memory_order_relaxed),
+                             event.thread.load(std::memory_order_relaxed)});
+        }
+        /// Drop the events the thread may have overwritten while they were
+        /// read, including the one it may be writing now
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64_t endAfter =
+                ring->written.load(std::memory_order_relaxed);
+        const uint64_t firstValid = std::max(
+                begin, endAfter >= ringCapacity ? endAfter - ringCapacity + 1
+                                                : uint64_t{0});
+        for (uint64_t index = firstValid; index < end; ++index) {
+            const auto i = static_cast<size_t>(index - begin);
+            if (names[i] == nullptr)
+                continue;
+            std::snprintf(line, sizeof(line),
+                          ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%llu,"
+                          "\"ts\":%.3f,\"dur\":%.3f,\"name\":",
+                          static_cast<unsigned long long>(times[i][2]),
+                          toMicroseconds(times[i][0]),
+                          static_cast<double>(times[i][1] - times[i][0]) /
+                                  ticksPerMicrosecond);
+            json += line;
+            appendJsonString(json, names[i]);
+            json += '}';
+        }
+    }
+    json += "\n]}\n";
+
+    juce::FileOutputStream stream(file);
+    if (!stream.openedOk())
+        return false;
+    stream.setPosition(0);
+    stream.truncate();
+    return stream.write(json.data(), json.size());
+}
+#endif
@@ -0,0 +1,206 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <array>
+#include <atomic>
+#include <juce_core/juce_core.h>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief Job system shared by every PDrum instance in the process.
+ *
+ * Hold it through a juce::SharedResourcePointer<WorkerPool>: the pool has
+ * one worker per core but one, started by the first holder to call start
+ * and stopped when the last holder goes away, so the number of threads
+ * does not grow with the number of loaded instances and instances that are
+ * never prepared, as in a plugin scan, start none.
+ *
+ * Work is submitted as a Task split into bands. Each worker owns a deque of
+ * tickets, kept in deadline order, and steals the most urgent ticket from
+ * the other workers when its own deque is empty. A ticket lets a worker
+ * claim bands of its task until none are left. The submitting thread
+ * claims bands of its own task as well, so a task completes even when
+ * every worker is busy with other instances.
+ */
+class WorkerPool final {
+public:
+    /**
+     * @brief Function that processes one band of a task.
+     * @param context The context passed to the Task constructor.
+     * @param band The index of the band to process.
+     */
+    using BandFunction = void (*)(void *context, int band);
+
+    /**
+     * @brief A reusable unit of banded work owned by the submitting object.
+     */
+    class Task final {
+    public:
+        /**
+         * @brief Constructs a Task.
+         * @param pool The pool that runs the bands.
+         * @param function The function that processes one band.
+         * @param context The context passed to the function.
+         */
+        Task(WorkerPool &pool, BandFunction function, void *context);
+
+        /**
+         * @brief Destructor for Task. Withdraws any tickets still queued and
+         * waits for workers that are running a band of the task.
+         */
+        ~Task();
+
+        /**
+         * @brief Process every band and return when all of them are done.
+         * The calling thread processes bands too. Called by one thread at a
+         * time.
+         * @param numBands The number of bands.
+         * @param deadline The time by which the bands should be done, as a
+         * juce::Time::getMillisecondCounterHiRes value.
+         */
+        void run(int numBands, double deadline);
+
+    private:
+        friend class WorkerPool;
+
+        /**
+         * @brief Claim and process the next band of a run.
+         * @param generation The run the band must belong to.
+         * @return True if a band was processed.
+         */
+        bool runNextBand(uint32_t generation);
+
+        /** Pool that runs the bands */
+        WorkerPool &pool;
+
+        /** Function that processes one band */
+        const BandFunction function;
+
+        /** Context passed to the function */
+        void *const context;
+
+        /** Run counter in the upper half, next unclaimed band in the lower */
+        std::atomic<uint64_t> claimState{0};
+
+        /** Number of bands of the current run */
+        std::atomic<int> numBands{0};
+
+        /** Bands of the current run that are not finished yet */
+        std::atomic<int> remainingBands{0};
+
+        /** Counter of the current run, only touched by the submitter */
+        uint32_t generation = 0;
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Task)
+    };
+
+    /**
+     * @brief Constructs a WorkerPool whose workers are not started yet.
+     */
+    WorkerPool();
+
+    /**
+     * @brief Destructor for WorkerPool. Stops the workers.
+     */
+    ~WorkerPool();
+
+    /**
+     * @brief Starts the workers unless they are running. Until then, tasks
+     * run every band on the submitting thread. Not real-time safe.
+     */
+    void start();
+
+    /**
+     * @brief Gets the number of worker threads.
+     * @return The number of worker threads.
+     */
+    [[nodiscard]] int getNumWorkers() const {
+        return static_cast<int>(workers.size());
+    }
+
+private:
+    /**
+     * @brief Permission for a worker to claim bands of one run of a task.
+     */
+    struct Ticket {
+        /** Task to claim bands of */
+        Task *task = nullptr;
+        /** Run the bands must belong to */
+        uint32_t generation = 0;
+        /** Time by which the run should be done */
+        double deadline = 0.0;
+    };
+
+    /**
+     * @brief Bounded deque of tickets, ordered by deadline.
+     */
+    struct TicketDeque {
+        /** Guards the tickets; held for a few instructions only */
+        juce::SpinLock lock;
+        /** Ring buffer of tickets */
+        std::array<Ticket, 64> tickets;
+        /** Position of the most urgent ticket */
+        size_t head = 0;
+        /** Number of queued tickets */
+        size_t size = 0;
+        /** Deadline of the most urgent ticket, read without the lock */
+        std::atomic<double> frontDeadline{0.0};
+    };
+
+    class Worker;
+
+    /**
+     * @brief Queue a ticket on the next worker in round-robin order and
+     * wake it if it is asleep.
+     * @param ticket The ticket to queue.
+     * @return False if the deque was full.
+     */
+    bool push(const Ticket &ticket);
+
+    /**
+     * @brief Take the most urgent ticket from a worker's own deque, or
+     * steal the most urgent ticket of another worker.
+     * @param workerIndex The index of the worker taking a ticket.
+     * @param ticket Receives the ticket.
+     * @return True if a ticket was taken.
+     */
+    bool take(size_t workerIndex, Ticket &ticket);
+
+    /**
+     * @brief Take the most urgent ticket from one deque. Marks the ticket's
+     * task as running on the worker while the deque is locked, so cancel
+     * cannot miss it.
+     * @param deque The deque to take from.
+     * @param workerIndex The index of the worker taking the ticket.
+     * @param ticket Receives the ticket.
+     * @return True if a ticket was taken.
+     */
+    bool takeFrom(TicketDeque &deque, size_t workerIndex, Ticket &ticket);
+
+    /**
+     * @brief Withdraw every queued ticket of a task and wait until no worker
+     * runs one of its bands.
+     * @param task The task to cancel.
+     */
+    void cancel(const Task &task);
+
+    /** Worker threads */
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    /** Deque of each worker */
+    std::unique_ptr<TicketDeque[]> deques;
+
+    /** Worker that receives the next ticket */
+    std::atomic<size_t> nextWorker{0};
+
+    /** Guards starting the workers */
+    juce::CriticalSection startLock;
+
+    /** Set once the workers are running */
+    std::atomic<bool> started{false};
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(WorkerPool)
+};
+
+#endif // WORKER_POOL_H
@@ -0,0 +1,306 @@
+#include "WorkerPool.h"
+#include <limits>
+#include <thread>
+
+/**
+ * @brief Worker thread that runs tickets from its own deque or steals them.
+ */
+class WorkerPool::Worker final : public juce::Thread {
+public:
+    /**
+     * @brief Constructs a Worker.
+     * @param pool The pool the worker belongs to.
+     * @param index The index of the worker and its deque.
+     */
+    Worker(WorkerPool &pool, const size_t index) :
+        Thread("PDrum Worker " + juce::String(static_cast<int>(index))),
+        pool(pool), index(index) {}
+
+    /**
+     * @brief Run tickets until the thread is stopped. Spins for a while
+     * after the last ticket, because tasks arrive in bursts once per
+     * simulation step, then sleeps until a ticket is pushed.
+     */
+    void run() override {
+        int idleRounds = 0;
+        while (!threadShouldExit()) {
+            if (Ticket ticket; pool.take(index, ticket)) {
+                while (ticket.task->runNextBand(ticket.generation)) {
+                }
+                runningTask.store(nullptr, std::memory_order_release);
+                idleRounds = 0;
+                continue;
+            }
+            if (++idleRounds < spinRounds) {
+                std::this_thread::yield();
+                continue;
+            }
+            const uint32_t seenWakeUps = wakeUps.load();
+            asleep.store(true);
+            /// Check again, a push or stop may have missed the flag
+            if (pool.deques[index].frontDeadline.load() ==
+                        std::numeric_limits<double>::max() &&
+                !threadShouldExit())
+                wakeUps.wait(seenWakeUps);
+            asleep.store(false);
+            idleRounds = 0;
+        }
+    }
+
+    /**
+     * @brief Wake the worker if it is asleep. Takes no lock, so the audio
+     * thread may call it.
+     */
+    void wake() {
+        if (asleep.load())
+            wakeUp();
+    }
+
+    /**
+     * @brief Wake the worker whether or not it is asleep yet.
+     */
+    void wakeUp() {
+        wakeUps.fetch_add(1);
+        wakeUps.notify_one();
+    }
+
+    /** Task whose bands the worker is running, or nullptr */
+    std::atomic<const Task *> runningTask{nullptr};
+
+private:
+    /** Empty polls before the worker goes to sleep */
+    static constexpr int spinRounds = 2000;
+
+    /** Pool the worker belongs to */
+    WorkerPool &pool;
+
+    /** Index of the worker and its deque */
+    const size_t index;
+
+    /** Set while the worker is asleep */
+    std::atomic<bool> asleep{false};
+
+    /** Bumped when a ticket is pushed while the worker is asleep. Waiting
+     * on an atomic is a futex on Linux, where a juce::WaitableEvent would
+     * take a mutex on the thread that pushes */
+    std::atomic<uint32_t> wakeUps{0};
+};
+
+/**
+ * @brief Constructs a Task.
+ * @param pool The pool that runs the bands.
+ * @param function The function that processes one band.
+ * @param context The context passed to the function.
+ */
+WorkerPool::Task::Task(WorkerPool &pool, const BandFunction function,
+                       void *context) :
+    pool(pool), function(function), context(context) {}
+
+/**
+ * @brief Destructor for Task. Withdraws any tickets still queued and
+ * waits for workers that are running a band of the task.
+ */
+WorkerPool::Task::~Task() { pool.cancel(*this); }
+
+/**
+ * @brief Process every band and return when all of them are done.
+ * The calling thread processes bands too. Called by one thread at a
+ * time.
+ * @param numBands The number of bands.
+ * @param deadline The time by which the bands should be done, as a
+ * juce::Time::getMillisecondCounterHiRes value.
+ */
+void WorkerPool::Task::run(const int numBands, const double deadline) {
+    if (numBands <= 1 || !pool.started.load(std::memory_order_acquire)) {
+        for (int band = 0; band < numBands; ++band)
+            function(context, band);
+        return;
+    }
+    ++generation;
+    this->numBands.store(numBands, std::memory_order_relaxed);
+    remainingBands.store(numBands, std::memory_order_relaxed);
+    claimState.store(static_cast<uint64_t>(generation) << 32,
+                     std::memory_order_release);
+    /// The caller takes a band itself, so one ticket less is needed
+    const int numTickets = std::min(numBands - 1, pool.getNumWorkers());
+    for (int i = 0; i < numTickets; ++i) {
+        if (!pool.push({this, generation, deadline}))
+            break;
+    }
+    while (runNextBand(generation)) {
+    }
+    /// Only bands already running on workers are left
+    while (remainingBands.load(std::memory_order_acquire) > 0)
+        std::this_thread::yield();
+}
+
+/**
+ * @brief Claim and process the next band of a run.
+ * @param generation The run the band must belong to.
+ * @return True if a band was processed.
+ */
+bool WorkerPool::Task::runNextBand(const uint32_t generation) {
+    uint64_t state = claimState.load(std::memory_order_acquire);
+    int band;
+    do {
+        if (static_cast<uint32_t>(state >> 32) != generation)
+            return false;
+        band = static_cast<int>(state & 0xFFFFFFFFu);
+        if (band >= numBands.load(std::memory_order_relaxed))
+            return false;
+    } while (!claimState.compare_exchange_weak(state, state + 1,
+                                               std::memory_order_acq_rel));
+    function(context, band);
+    remainingBands.fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+/**
+ * @brief Constructs a WorkerPool whose workers are not started yet.
+ */
+WorkerPool::WorkerPool() {
+    /// The audio threads that submit tasks take the remaining core
+    const auto numWorkers = static_cast<size_t>(
+            std::max(0, juce::SystemStats::getNumCpus() - 1));
+    deques = std::make_unique<TicketDeque[]>(numWorkers);
+    for (size_t i = 0; i < numWorkers; ++i) {
+        deques[i].frontDeadline.store(std::numeric_limits<double>::max());
+        workers.push_back(std::make_unique<Worker>(*this, i));
+    }
+}
+
+/**
+ * @brief Starts the workers unless they are running. Until then, tasks
+ * run every band on the submitting thread. Not real-time safe.
+ */
+void WorkerPool::start() {
+    if (started.load(std::memory_order_acquire))
+        return;
+    const juce::ScopedLock lock(startLock);
+    if (started.load(std::memory_order_relaxed) || workers.empty())
+        return;
+    for (const auto &worker: workers)
+        worker->startThread(juce::Thread::Priority::highest);
+    started.store(true, std::memory_order_release);
+}
+
+/**
+ * @brief Destructor for WorkerPool. Stops the workers.
+ */
+WorkerPool::~WorkerPool() {
+    for (const auto &worker: workers)
+        worker->signalThreadShouldExit();
+    for (const auto &worker: workers) {
+        worker->wakeUp();
+        worker->stopThread(1000);
+    }
+}
+
+/**
+ * @brief Queue a ticket on the next worker in round-robin order and
+ * wake it if it is asleep.
+ * @param ticket The ticket to queue.
+ * @return False if the deque was full.
+ */
+bool WorkerPool::push(const Ticket &ticket) {
+    const size_t index = nextWorker.fetch_add(1) % workers.size();
+    auto &deque = deques[index];
+    {
+        const juce::SpinLock::ScopedLockType lock(deque.lock);
+        const size_t capacity = deque.tickets.size();
+        if (deque.size == capacity)
+            return false;
+        /// Insert behind every ticket that is at least as urgent
+        size_t position = deque.size;
+        while (position > 0 &&
+               deque.tickets[(deque.head + position - 1) % capacity].deadline >
+                       ticket.deadline) {
+            deque.tickets[(deque.head + position) % capacity] =
+                    deque.tickets[(deque.head + position - 1) % capacity];
+            --position;
+        }
+        deque.tickets[(deque.head + position) % capacity] = ticket;
+        ++deque.size;
+        deque.frontDeadline.store(deque.tickets[deque.head].deadline);
+    }
+    workers[index]->wake();
+    return true;
+}
+
+/**
+ * @brief Take the most urgent ticket from a worker's own deque, or
+ * steal the most urgent ticket of another worker.
+ * @param workerIndex The index of the worker taking a ticket.
+ * @param ticket Receives the ticket.
+ * @return True if a ticket was taken.
+ */
+bool WorkerPool::take(const size_t workerIndex, Ticket &ticket) {
+    if (takeFrom(deques[workerIndex], workerIndex, ticket))
+        return true;
+    /// Steal from the deque whose front is the most urgent
+    size_t victim = workerIndex;
+    double earliest = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < workers.size(); ++i) {
+        if (const double deadline = deques[i].frontDeadline.load();
+            deadline < earliest) {
+            earliest = deadline;
+            victim = i;
+        }
+    }
+    return victim != workerIndex &&
+           takeFrom(deques[victim], workerIndex, ticket);
+}
+
+/**
+ * @brief Take the most urgent ticket from one deque. Marks the ticket's
+ * task as running on the worker while the deque is locked, so cancel
+ * cannot miss it.
+ * @param deque The deque to take from.
+ * @param workerIndex The index of the worker taking the ticket.
+ * @param ticket Receives the ticket.
+ * @return True if a ticket was taken.
+ */
+bool WorkerPool::takeFrom(TicketDeque &deque, const size_t workerIndex,
+                          Ticket &ticket) {
+    if (deque.frontDeadline.load() == std::numeric_limits<double>::max())
+        return false;
+    const juce::SpinLock::ScopedTryLockType lock(deque.lock);
+    if (!lock.isLocked() || deque.size == 0)
+        return false;
+    ticket = deque.tickets[deque.head];
+    deque.head = (deque.head + 1) % deque.tickets.size();
+    --deque.size;
+    deque.frontDeadline.store(deque.size > 0
+                                      ? deque.tickets[deque.head].deadline
+                                      : std::numeric_limits<double>::max());
+    workers[workerIndex]->runningTask.store(ticket.task,
+                                            std::memory_order_release);
+    return true;
+}
+
+/**
+ * @brief Withdraw every queued ticket of a task and wait until no worker
+ * runs one of its bands.
+ * @param task The task to cancel.
+ */
+void WorkerPool::cancel(const Task &task) {
+    for (size_t i = 0; i < workers.size(); ++i) {
+        auto &deque = deques[i];
+        const juce::SpinLock::ScopedLockType lock(deque.lock);
+        const size_t capacity = deque.tickets.size();
+        size_t kept = 0;
+        for (size_t j = 0; j < deque.size; ++j) {
+            const auto &queued = deque.tickets[(deque.head + j) % capacity];
+            if (queued.task != &task)
+                deque.tickets[(deque.head + kept++) % capacity] = queued;
+        }
+        deque.size = kept;
+        deque.frontDeadline.store(kept > 0
+                                          ? deque.tickets[deque.head].deadline
+                                          : std::numeric_limits<double>::max());
+    }
+    for (const auto &worker: workers) {
+        while (worker->runningTask.load(std::memory_order_acquire) == &task)
+            std::this_thread::yield();
+    }
+}
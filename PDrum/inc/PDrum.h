@@ -1,17 +1,102 @@
 #ifndef P_DRUM_H
 #define P_DRUM_H
 
+#include <array>
+#include <atomic>
 #include <juce_audio_devices/juce_audio_devices.h>
 #include <juce_audio_processors/juce_audio_processors.h>
+#include <memory>
+#include <vector>
+#include "ConvolutionResonatorModel.h"
+#include "FieldRecorder.h"
+#include "HitCacheEngine.h"
+#include "LookaheadRenderer.h"
+#include "MemoryArena.h"
 #include "ModalResonatorModel.h"
+#include "QualityGovernor.h"
+#include "UiEventQueue.h"
 #include "VibratingMembrane.h"
 #include "VibratingMembraneModel.h"
 
 /**
  * @brief Audio processor for the PDrum plugin.
  */
-class PDrum final : public juce::AudioProcessor {
+class PDrum final : public juce::AudioProcessor,
+                    juce::AudioProcessorValueTreeState::Listener,
+                    juce::AsyncUpdater,
+                    juce::Timer,
+                    LookaheadRenderer::Source {
 public:
+    /**
+     * @brief Engines available for the drum body.
+     */
+    enum class ResonatorEngine {
+        /** Recursive filter per mode */
+        modal,
+        /** Zero latency partitioned convolution */
+        convolution,
+        /** Uniformly partitioned convolution with latency and lower cost */
+        convolutionLowCpu
+    };
+
+    /**
+     * @brief Settings of the simulation that trade CPU for fidelity.
+     */
+    struct QualityProfile {
+        /** Resolution of the membrane grid */
+        int gridResolution = 256;
+        /** Host samples between two membrane steps */
+        int stepInterval = VibratingMembraneModel::defaultStepInterval;
+        /** Bessel zeros of the modal resonator */
+        int numRadialModes = 5;
+        /** Axial orders per Bessel zero of the modal resonator */
+        int numAxialModes = 3;
+    };
+
+    /** Profiles used while the host renders offline, in the order of the
+     * offlineQuality choices after "Same as Live" */
+    static constexpr std::array<QualityProfile, 2> offlineProfiles{{
+            {384, 2, 16, 4},
+            {512, 1, 32, 6},
+    }};
+
+    /**
+     * @brief A rung of the ladder the quality governor walks down while
+     * live rendering runs short of time.
+     */
+    struct QualityRung {
+        /** Name shown in the editor */
+        const char *name;
+        /** Longest step interval of the live membrane */
+        int stepIntervalLimit;
+        /** Divisor of the live grid resolution */
+        int gridDivisor;
+        /** Bessel zeros and axial orders of the modal resonator, 0 for the
+         * live mode count */
+        int numRadialModes, numAxialModes;
+        /** Hits of the hit cache ringing at once */
+        int voiceLimit;
+    };
+
+    /** Rungs from full quality down, each giving up more than the last.
+     * The hit cache skips to the last rung, the only one that saves it
+     * work, and the convolution engines stop before the mode count. */
+    static constexpr std::array<QualityRung, 5> qualityLadder{{
+            {"Full", VibratingMembraneModel::maxAdaptiveStepInterval, 1, 0, 0,
+             HitCacheEngine::maxVoices},
+            {"Longer Steps",
+             2 * VibratingMembraneModel::maxAdaptiveStepInterval, 1, 0, 0,
+             HitCacheEngine::maxVoices},
+            {"Coarser Grid",
+             2 * VibratingMembraneModel::maxAdaptiveStepInterval, 2, 0, 0,
+             HitCacheEngine::maxVoices},
+            {"Fewer Modes",
+             2 * VibratingMembraneModel::maxAdaptiveStepInterval, 2, 3, 2,
+             HitCacheEngine::maxVoices},
+            {"Fewer Voices",
+             2 * VibratingMembraneModel::maxAdaptiveStepInterval, 2, 3, 2, 8},
+    }};
+
     /**
      * @brief Constructor for the PDrum processor.
      */
@@ -20,7 +105,7 @@ public:
     /**
      * @brief Destructor for the PDrum processor.
      */
-    ~PDrum() override = default;
+    ~PDrum() override;
 
     /**
      * @brief Prepare the processor for playback.
@@ -32,7 +117,7 @@ public:
     /**
      * @brief Release any resources used by the processor.
      */
-    void releaseResources() override {}
+    void releaseResources() override;
 
     /**
      * @brief Check if the processor supports the given bus layout.
@@ -111,23 +196,54 @@ public:
     void changeProgramName(int, const juce::String &) override {}
 
     /**
-     * @brief Get the state information of the processor.
+     * @brief Saves the parameters and, unless disabled, the resonator
+     * coefficient tables in the versioned binary state format.
+     * @param destData Receives the state.
      */
-    void getStateInformation(juce::MemoryBlock &) override {}
+    void getStateInformation(juce::MemoryBlock &destData) override;
 
     /**
-     * @brief Set the state information of the processor.
+     * @brief Restores a state saved by getStateInformation. Parameters equal
+     * to the current ones are left alone, so nothing listening to them does
+     * any work, and stored tables the shared cache lacks are added to it, so
+     * the next prepareToPlay does not build them.
+     * @param data The state.
+     * @param sizeInBytes The size of the state in bytes.
      */
-    void setStateInformation(const void *, int) override {}
+    void setStateInformation(const void *data, int sizeInBytes) override;
 
     /**
-     * @brief Get the MIDI message collector.
-     * @return A reference to the MIDI message collector.
+     * @brief Chooses whether the saved state includes the resonator
+     * coefficient tables, which make it faster to restore but about 1.4 MB
+     * larger at default settings. Off by default: the tables can always be
+     * built again from the parameters.
+     * @param shouldStore True to include the tables.
      */
-    juce::MidiMessageCollector &getMidiMessageCollector() noexcept {
-        return midiMessageCollector;
+    void setStoresDerivedTables(const bool shouldStore) {
+        storeDerivedTables = shouldStore;
     }
 
+    /**
+     * @brief Gets the queue of strikes and notes posted by the editor.
+     * @return A reference to the UiEventQueue.
+     */
+    UiEventQueue &getUiEventQueue() noexcept { return uiEvents; }
+
+    /**
+     * @brief Seeds the strike position randomness of every membrane, so
+     * offline renders are reproducible.
+     * @param seed The seed for the random number generators.
+     */
+    void setRandomSeed(uint32_t seed);
+
+    /**
+     * @brief Overrides the resonator mode count of every quality profile.
+     * Takes effect on the next call to prepareToPlay.
+     * @param numRadialModes The number of Bessel zeros to use.
+     * @param numAxialModes The number of axial orders per Bessel zero.
+     */
+    void setResonatorModeCount(int numRadialModes, int numAxialModes);
+
     /**
      * @brief Gets the value tree state for the parameters.
      * @return A reference to the AudioProcessorValueTreeState object.
@@ -140,19 +256,352 @@ public:
      */
     VibratingMembraneModel &getModel() noexcept { return membraneModel; }
 
+    /**
+     * @brief Gets the ModalResonatorModel.
+     * @return A reference to the ModalResonatorModel object.
+     */
+    ModalResonatorModel &getResonatorModel() noexcept { return resonatorModel; }
+
+    /**
+     * @brief Starts recording the displacement field of the membrane to a
+     * .npy file, finishing any recording in progress. Not real-time safe.
+     * @param file The .npy file to write.
+     * @param settings The frame rate, region and precision.
+     * @return False if the processor is not prepared or the file could not
+     * be created.
+     */
+    bool startFieldRecording(const juce::File &file,
+                             const FieldRecorder::Settings &settings);
+
+    /**
+     * @brief Finishes the field recording in progress. Not real-time safe.
+     */
+    void stopFieldRecording() { fieldRecorder.stop(); }
+
+    /**
+     * @brief Checks whether the field of the membrane is being recorded.
+     * @return True while recording.
+     */
+    [[nodiscard]] bool isRecordingField() const {
+        return fieldRecorder.isRecording();
+    }
+
+    /**
+     * @brief Gets the governor that lowers the quality under CPU pressure.
+     * @return A reference to the QualityGovernor.
+     */
+    [[nodiscard]] const QualityGovernor &getQualityGovernor() const {
+        return governor;
+    }
+
+    /**
+     * @brief Gets the rung of the quality ladder the governor is on.
+     * @return The rung.
+     */
+    [[nodiscard]] const QualityRung &getQualityRung() const;
+
 private:
-    /** MIDI message collector to handle incoming MIDI messages. */
-    juce::MidiMessageCollector midiMessageCollector{};
+    /**
+     * @brief Handles parameter changes from the AudioProcessorValueTreeState.
+     * @param parameterID The ID of the parameter that changed.
+     * @param newValue The new value of the parameter.
+     */
+    void parameterChanged(const juce::String &parameterID,
+                          float newValue) override;
+
+    /**
+     * @brief Switches the resonator engine, lookahead mode, hit cache or
+     * offline profile on the message thread.
+     */
+    void handleAsyncUpdate() override;
+
+    /**
+     * @brief Builds the engines of a new quality rung on the message thread
+     * once the governor has picked one.
+     */
+    void timerCallback() override;
+
+    /**
+     * @brief Configures the resonator engine, lookahead mode, hit cache and
+     * offline profile selected by the parameters and reports their combined
+     * latency. Not real-time safe.
+     * @param sampleRate The sample rate of the audio stream.
+     * @param samplesPerBlock The number of samples per block to process.
+     */
+    void configureEngines(double sampleRate, int samplesPerBlock);
+
+    /**
+     * @brief Builds the engines of the offline profile selected by the
+     * offlineQuality parameter. Not real-time safe.
+     * @param sampleRate The sample rate of the audio stream.
+     */
+    void configureOfflineProfile(double sampleRate);
+
+    /**
+     * @brief Builds the membrane and resonator of the quality rung the
+     * governor is on while the current ones keep rendering, and hands them
+     * to the thread that renders. Not real-time safe.
+     * @param sampleRate The sample rate of the audio stream.
+     */
+    void prepareGovernedEngines(double sampleRate);
+
+    /**
+     * @brief Moves the sound onto the live or offline engines, carrying
+     * over the vibration of the membrane and the resonator. Called on the
+     * thread that renders.
+     * @param offline True to use the offline engines.
+     */
+    void switchProfile(bool offline);
+
+    /**
+     * @brief Takes the engines of a new quality rung for live rendering,
+     * if prepareGovernedEngines has handed over any. Called on the thread
+     * that renders; never waits.
+     */
+    void takeGovernedEngines();
+
+    /**
+     * @brief Chooses the engines live rendering uses.
+     * @param slot The slot of the governed engines, or liveSlot for the
+     * live engines.
+     */
+    void useGovernedEngines(int slot);
+
+    /**
+     * @brief Feeds the governor the time a block took and applies the
+     * quality rung it picks. Called on the thread that renders.
+     * @param startTicks The juce::Time::getHighResolutionTicks value at the
+     * start of the block.
+     * @param numSamples The number of samples of the block.
+     */
+    void governBlock(juce::int64 startTicks, int numSamples);
+
+    /**
+     * @brief Applies a new quality rung: limits the hit cache voices at
+     * once and flags the rung for the message thread to build its engines.
+     * Called on the thread that renders; never blocks.
+     */
+    void applyQualityRung();
+
+    /**
+     * @brief Strikes the membrane. Called on the thread that renders.
+     * @param amplitude The amplitude of the strike.
+     * @param x The grid column, or -1 to strike near the centre.
+     * @param y The grid row, or -1 to strike near the centre.
+     */
+    void strike(float amplitude, int x, int y) override;
+
+    /**
+     * @brief Gathers the strikes of the block from the host MIDI and the
+     * editor, sorted by sample offset.
+     * @param midiMessages The MIDI of the block.
+     * @param numSamples The number of samples of the block.
+     */
+    void collectStrikes(const juce::MidiBuffer &midiMessages, int numSamples);
+
+    /**
+     * @brief Renders samples on the lookahead render thread.
+     * @param output Receives the samples.
+     * @param numSamples The number of samples to render.
+     */
+    void render(float *output, int numSamples) override;
+
+    /**
+     * @brief Runs the membrane and the drum body.
+     * @param output Receives the samples.
+     * @param numSamples The number of samples to render.
+     */
+    void renderSamples(float *output, int numSamples);
+
+    /**
+     * @brief Simulates the strikes of the block the hit cache does not
+     * cover, and the ringing of earlier ones, under the cached hits. Marks
+     * the strikes the hit cache covers.
+     * @param output Receives the samples.
+     * @param numSamples The number of samples of the block.
+     */
+    void renderUncachedStrikes(float *output, int numSamples);
+
+    /**
+     * @brief Restores the parameters section of a saved state.
+     * @param stream The section.
+     */
+    void restoreParameters(juce::InputStream &stream);
+
+    /**
+     * @brief Restores the tables section of a saved state.
+     * @param stream The section.
+     */
+    void restoreTables(juce::InputStream &stream);
+
+    /** First bytes of a saved state, "PDRM" in little-endian order */
+    static constexpr int stateMagic = 0x4d524450;
+
+    /** Version of the state format. Readers skip the sections they do not
+     * know, so adding one needs no new version. */
+    static constexpr int stateVersion = 1;
+
+    /** Tags of the sections of a saved state, "PRMS" and "TABL" */
+    static constexpr int parametersSection = 0x534d5250;
+    static constexpr int tablesSection = 0x4c424154;
+
+    /** Partition size of the low CPU convolution engine */
+    static constexpr int lowCpuConvolutionLatency = 1024;
+
+    /** Shortest latency of the lookahead mode, in samples */
+    static constexpr int minLookaheadLatency = 2048;
+
+    /** Number format of the membrane state, set by the
+     * PDRUM_HALF_PRECISION_STATE build option */
+    static constexpr auto membraneStateStorage =
+#if PDRUM_HALF_PRECISION_STATE
+            VibratingMembraneModel::StateStorage::float16;
+#else
+            VibratingMembraneModel::StateStorage::float32;
+#endif
+
+    /** Amplitude of a strike triggered by a note */
+    static constexpr float noteStrikeAmplitude = 0.25f;
+
+    /**
+     * @brief A strike within the current block.
+     */
+    struct BlockStrike {
+        /** Position of the strike in the block */
+        int sampleOffset = 0;
+        /** Amplitude of the strike */
+        float amplitude = 0.0f;
+        /** Grid column of the strike, -1 near the centre */
+        int x = -1;
+        /** Grid row of the strike, -1 near the centre */
+        int y = -1;
+        /** Whether the hit cache plays the strike, hit cache mode only */
+        bool cached = false;
+    };
+
+    /** Strikes and notes posted by the editor */
+    UiEventQueue uiEvents;
+
+    /** Strikes of the current block, audio thread only */
+    std::array<BlockStrike, 256> blockStrikes;
+
+    /** Number of strikes of the current block */
+    int numBlockStrikes = 0;
 
     /** Audio processor value tree state for managing parameters. */
     juce::AudioProcessorValueTreeState parameters;
 
+    /** Locked memory holding the state of the live and the offline
+     * membrane and resonator, laid out when they are prepared */
+    MemoryArena liveArena, offlineArena;
+
     /** Vibrating membrane model for simulating the drum head. */
     VibratingMembraneModel membraneModel;
 
     /** Modal resonator for simulating the drum body. */
     ModalResonatorModel resonatorModel;
 
+    /** Convolution engine for simulating the drum body. */
+    ConvolutionResonatorModel convolutionModel;
+
+    /** Membrane and resonator of the offline profile, null when offline
+     * renders use the live engines */
+    std::unique_ptr<VibratingMembraneModel> offlineMembraneModel;
+    std::unique_ptr<ModalResonatorModel> offlineResonatorModel;
+
+    /** Membrane and resonator currently rendering */
+    VibratingMembraneModel *activeMembrane = &membraneModel;
+    ModalResonatorModel *activeResonator = &resonatorModel;
+
+    /** Whether the offline engines are rendering */
+    bool offlineProfileActive = false;
+
+    /** Slot of the live engines, and of no engines handed over */
+    static constexpr int liveSlot = -1, noSlot = -2;
+
+    /**
+     * @brief Membrane and resonator of a reduced quality rung, with the
+     * memory holding their state.
+     */
+    struct GovernedEngines {
+        /** Locked memory holding the state of the engines */
+        MemoryArena arena;
+        /** Membrane on a coarser grid */
+        std::unique_ptr<VibratingMembraneModel> membrane;
+        /** Resonator with the mode count of the rung */
+        std::unique_ptr<ModalResonatorModel> resonator;
+    };
+
+    /** Two sets of governed engines, so one is built while the other
+     * renders */
+    std::array<GovernedEngines, 2> governedEngines;
+
+    /** Guards the hand-over of governed engines; the thread that renders
+     * only tries it */
+    juce::SpinLock governedLock;
+
+    /** Slot handed over and not taken yet, and slot rendering live */
+    int pendingGovernedSlot = noSlot, activeGovernedSlot = liveSlot;
+
+    /** Membrane and resonator live rendering uses, renderer only */
+    VibratingMembraneModel *realtimeMembrane = &membraneModel;
+    ModalResonatorModel *realtimeResonator = &resonatorModel;
+
+    /** Lowers the quality of live rendering under CPU pressure */
+    QualityGovernor governor;
+
+    /** Number of levels of the governor for the current engine, and
+     * whether they are the hit cache voice limits */
+    int governorLevels = 1;
+    bool governsVoices = false;
+
+    /** Set when a parameter asks for the engines to be configured again */
+    std::atomic<bool> enginesStale{false};
+
+    /** Set by the thread that renders when the governor picks a rung whose
+     * engines the message thread has not built yet */
+    std::atomic<bool> rungPending{false};
+
+    /** Times per second the message thread checks for a pending rung */
+    static constexpr int rungCheckRate = 20;
+
+    /** Value of the autoQuality parameter, read by the thread that renders */
+    std::atomic<float> *autoQualityParameter = nullptr;
+
+    /** Whether the host renders offline, set by every block */
+    std::atomic<bool> offlineRendering{false};
+
+    /** Resonator mode count overriding every profile, 0 for none */
+    int radialModeOverride = 0, axialModeOverride = 0;
+
+    /** Engine currently used for the drum body */
+    ResonatorEngine resonatorEngine = ResonatorEngine::modal;
+
+    /** Records the field of the membrane that renders */
+    FieldRecorder fieldRecorder;
+
+    /** Whether the saved state includes the resonator coefficient tables */
+    bool storeDerivedTables = false;
+
+    /** Tables of a restored state, held until the resonators take them */
+    std::vector<std::shared_ptr<const void>> restoredTables;
+
+    /** Render thread for the lookahead mode */
+    LookaheadRenderer lookahead{*this};
+
+    /** Whether the synthesis runs on the lookahead render thread */
+    bool lookaheadEnabled = false;
+
+    /** Cached hits played instead of the simulation, null when disabled */
+    std::unique_ptr<HitCacheEngine> hitCache;
+
+    /** How long the simulation runs after a strike the hit cache does not
+     * cover, as long as the longest cached response */
+    static constexpr double uncachedTailSeconds = 2.0;
+
+    /** Samples the simulation still runs for in hit cache mode */
+    int uncachedSamplesLeft = 0;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PDrum)
 };
 
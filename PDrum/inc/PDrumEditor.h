@@ -5,6 +5,7 @@
 #include <juce_audio_utils/juce_audio_utils.h>
 #include "KnobComponent.h"
 #include "ModalResonator.h"
+#include "TraceRecorder.h"
 #include "VibratingMembrane.h"
 
 #include "PDrum.h"
@@ -23,7 +24,7 @@ public:
      * @brief Destructor for the PDrumEditor.
      */
     ~PDrumEditor() override {
-        midiKeyboardState.removeListener(&processor.getMidiMessageCollector());
+        midiKeyboardState.removeListener(&processor.getUiEventQueue());
     }
 
     /**
@@ -58,6 +59,58 @@ private:
     /** Randomness knob */
     KnobComponent randomnessKnob;
 
+    /** Selector for the resonator engine */
+    juce::ComboBox resonatorEngineBox;
+
+    /** Attachment for the resonator engine selector */
+    std::unique_ptr<juce::AudioProcessorValueTreeState::ComboBoxAttachment>
+            resonatorEngineAttachment;
+
+    /** Toggle for the lookahead mode */
+    juce::ToggleButton lookaheadButton{"Lookahead"};
+
+    /** Attachment for the lookahead toggle */
+    juce::AudioProcessorValueTreeState::ButtonAttachment lookaheadAttachment;
+
+    /** Toggle for the hit cache */
+    juce::ToggleButton hitCacheButton{"Hit Cache"};
+
+    /** Attachment for the hit cache toggle */
+    juce::AudioProcessorValueTreeState::ButtonAttachment hitCacheAttachment;
+
+    /** Selector for the quality of offline renders */
+    juce::ComboBox offlineQualityBox;
+
+    /** Attachment for the offline quality selector */
+    std::unique_ptr<juce::AudioProcessorValueTreeState::ComboBoxAttachment>
+            offlineQualityAttachment;
+
+    /** Toggle for the quality governor */
+    juce::ToggleButton autoQualityButton{"Auto Quality"};
+
+    /** Attachment for the quality governor toggle */
+    juce::AudioProcessorValueTreeState::ButtonAttachment autoQualityAttachment;
+
+    /** Reports the changes of quality made by the governor */
+    juce::Label qualityLabel;
+
+    /** Number of quality changes and governor level shown by the label */
+    int shownTransitions = 0, shownLevel = 0;
+
+    /** Button that starts and stops recording the membrane field */
+    juce::TextButton recordFieldButton{"Record Field"};
+
+    /** Chooser for the field recording file, alive while it is open */
+    std::unique_ptr<juce::FileChooser> fieldChooser;
+
+#if PDRUM_ENABLE_TRACING
+    /** Button that saves the recorded trace zones */
+    juce::TextButton saveTraceButton{"Save Trace"};
+
+    /** Chooser for the trace file, alive while it is open */
+    std::unique_ptr<juce::FileChooser> traceChooser;
+#endif
+
     /// TODO - create grid of 12 buttons for each note to correspond to a preset
     /// TODO - for each button, have a unique membrane and resonator.
     /// TODO - MIDI key activates each membrane and resonator for 1 second?
@@ -78,6 +131,25 @@ private:
      * @brief Timer callback function to update the editor.
      */
     void timerCallback() override;
+
+    /**
+     * @brief Show the latest quality change of the governor, if the label
+     * does not show it yet.
+     */
+    void updateQualityLabel();
+
+    /**
+     * @brief Stop the field recording in progress, or ask for a file and
+     * start recording the membrane field to it.
+     */
+    void toggleFieldRecording();
+
+#if PDRUM_ENABLE_TRACING
+    /**
+     * @brief Ask for a file and save the recorded trace zones to it.
+     */
+    void saveTrace();
+#endif
 };
 
 #endif // P_DRUM_EDITOR_H
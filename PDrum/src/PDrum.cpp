@@ -1,5 +1,7 @@
 #include "PDrum.h"
+#include <algorithm>
 #include "PDrumEditor.h"
+#include "TraceRecorder.h"
 
 /**
  * @brief Constructor for the PDrum processor.
@@ -17,13 +19,62 @@ PDrum::PDrum() :
                                "depth", "Depth", 0.75f, 10.0f, 5.0f),
                        std::make_unique<juce::AudioParameterFloat>(
                                "randomness", "Randomness", 0.0f, 50.0f, 5.0f),
+                       std::make_unique<juce::AudioParameterChoice>(
+                               "resonatorEngine", "Resonator Engine",
+                               juce::StringArray{"Modal", "Convolution",
+                                                 "Convolution (Low CPU)"},
+                               0,
+                               juce::AudioParameterChoiceAttributes()
+                                       .withAutomatable(false)),
+                       std::make_unique<juce::AudioParameterBool>(
+                               "lookahead", "Lookahead", false,
+                               juce::AudioParameterBoolAttributes()
+                                       .withAutomatable(false)),
+                       std::make_unique<juce::AudioParameterBool>(
+                               "hitCache", "Hit Cache", false,
+                               juce::AudioParameterBoolAttributes()
+                                       .withAutomatable(false)),
+                       std::make_unique<juce::AudioParameterChoice>(
+                               "offlineQuality", "Offline Quality",
+                               juce::StringArray{"Same as Live", "High",
+                                                 "Maximum"},
+                               1,
+                               juce::AudioParameterChoiceAttributes()
+                                       .withAutomatable(false)),
+                       std::make_unique<juce::AudioParameterBool>(
+                               "autoQuality", "Auto Quality", true,
+                               juce::AudioParameterBoolAttributes()
+                                       .withAutomatable(false)),
                }),
 #ifdef DEBUG
-    membraneModel(parameters),
+    membraneModel(parameters, 128, membraneStateStorage),
 #else
-    membraneModel(parameters, 256),
+    membraneModel(parameters, 256, membraneStateStorage),
 #endif
-    resonatorModel(parameters) {
+    resonatorModel(parameters), convolutionModel(parameters, resonatorModel) {
+    /// Spend live steps in proportion to the wave speed and cell size
+    membraneModel.setTargetCourantNumber(
+            VibratingMembraneModel::defaultCourantNumber);
+    parameters.addParameterListener("resonatorEngine", this);
+    parameters.addParameterListener("lookahead", this);
+    parameters.addParameterListener("hitCache", this);
+    parameters.addParameterListener("offlineQuality", this);
+    autoQualityParameter = parameters.getRawParameterValue("autoQuality");
+    startTimerHz(rungCheckRate);
+}
+
+/**
+ * @brief Destructor for the PDrum processor.
+ */
+PDrum::~PDrum() {
+    parameters.removeParameterListener("resonatorEngine", this);
+    parameters.removeParameterListener("lookahead", this);
+    parameters.removeParameterListener("hitCache", this);
+    parameters.removeParameterListener("offlineQuality", this);
+    stopTimer();
+    cancelPendingUpdate();
+    lookahead.release();
+    hitCache.reset();
 }
 
 /**
@@ -32,8 +83,35 @@ PDrum::PDrum() :
  * @param samplesPerBlock The number of samples per block to process.
  */
 void PDrum::prepareToPlay(const double sampleRate, int samplesPerBlock) {
-    midiMessageCollector.reset(sampleRate);
-    resonatorModel.setParameters(5.0f, 5.0f, static_cast<float>(sampleRate));
+    /// The render thread must not run while the models are reset, nor the
+    /// impulse response renderer while the mode set changes
+    lookahead.release();
+    convolutionModel.release();
+    useGovernedEngines(liveSlot);
+    switchProfile(false);
+    if (radialModeOverride > 0 && axialModeOverride > 0)
+        resonatorModel.setModeCount(radialModeOverride, axialModeOverride);
+    /// Lay the live state out afresh in locked, pre-faulted memory
+    liveArena.reserve(membraneModel.getStateSize() +
+                      resonatorModel.getStateSize());
+    membraneModel.placeState(liveArena);
+    resonatorModel.placeState(liveArena);
+    resonatorModel.setParameters(
+            parameters.getRawParameterValue("membraneSize")->load(),
+            parameters.getRawParameterValue("depth")->load(),
+            static_cast<float>(sampleRate));
+    configureEngines(sampleRate, samplesPerBlock);
+    /// Every resonator holds the tables it needs now
+    restoredTables.clear();
+}
+
+/**
+ * @brief Release any resources used by the processor.
+ */
+void PDrum::releaseResources() {
+    lookahead.release();
+    if (hitCache != nullptr)
+        hitCache->release();
 }
 
 /**
@@ -56,27 +134,58 @@ bool PDrum::isBusesLayoutSupported(const BusesLayout &layouts) const {
  */
 void PDrum::processBlock(juce::AudioBuffer<float> &buffer,
                          juce::MidiBuffer &midiMessages) {
+    PDRUM_TRACE_THREAD("Audio");
+    PDRUM_TRACE_ZONE("processBlock");
+    const auto startTicks = juce::Time::getHighResolutionTicks();
     const int numSamples = buffer.getNumSamples();
     const int numChannels = buffer.getNumChannels();
-    const float inverseSampleRate = 1.0f / static_cast<float>(getSampleRate());
+    /// Picked up by the thread that renders before its next samples
+    offlineRendering.store(isNonRealtime(), std::memory_order_relaxed);
     /// Clear output buffer
     buffer.clear();
-    /// Process MIDI input
-    midiMessageCollector.removeNextBlockOfMessages(midiMessages, numSamples);
-    for (const auto &metadata: midiMessages) {
-        if (const auto &message = metadata.getMessage(); message.isNoteOn())
-                [[likely]] {
-            membraneModel.exciteCenter(0.25f);
-        }
-    }
+    /// Gather the strikes of the host and the editor
+    collectStrikes(midiMessages, numSamples);
     /// Get write pointer for channel 0 (mono processing)
     float *out = buffer.getWritePointer(0);
-    for (int i = 0; i < numSamples; ++i) {
-        const float membraneOut =
-                membraneModel.processSample(inverseSampleRate);
-        const float resonatorOut = resonatorModel.process(membraneOut);
-        out[i] = resonatorOut;
+    if (hitCache != nullptr) {
+        /// Cached hits are cheap enough to mix in the callback
+        renderUncachedStrikes(out, numSamples);
+        int position = 0;
+        for (int i = 0; i < numBlockStrikes; ++i) {
+            const auto &pending = blockStrikes[static_cast<size_t>(i)];
+            if (!pending.cached)
+                continue;
+            hitCache->render(out + position, pending.sampleOffset - position);
+            position = pending.sampleOffset;
+            hitCache->strike(pending.amplitude, pending.x, pending.y,
+                             isNonRealtime());
+        }
+        hitCache->render(out + position, numSamples - position);
+    } else if (lookaheadEnabled) {
+        /// The render thread strikes and renders, the callback only copies
+        for (int i = 0; i < numBlockStrikes; ++i) {
+            const auto &pending = blockStrikes[static_cast<size_t>(i)];
+            lookahead.queueStrike(pending.sampleOffset, pending.amplitude,
+                                  pending.x, pending.y);
+        }
+        lookahead.process(out, numSamples, isNonRealtime());
+    } else {
+        activeMembrane->setBlockDeadline(
+                juce::Time::getMillisecondCounterHiRes() +
+                1000.0 * numSamples / getSampleRate());
+        /// Render up to each strike so it lands on its sample
+        int position = 0;
+        for (int i = 0; i < numBlockStrikes; ++i) {
+            const auto &pending = blockStrikes[static_cast<size_t>(i)];
+            renderSamples(out + position, pending.sampleOffset - position);
+            position = pending.sampleOffset;
+            strike(pending.amplitude, pending.x, pending.y);
+        }
+        renderSamples(out + position, numSamples - position);
     }
+    /// The render thread accounts for its own blocks in lookahead mode
+    if (hitCache != nullptr || !lookaheadEnabled)
+        governBlock(startTicks, numSamples);
     /// Duplicate mono output to remaining channels
     if (numChannels > 1) {
         for (int ch = 1; ch < numChannels; ++ch) {
@@ -85,6 +194,594 @@ void PDrum::processBlock(juce::AudioBuffer<float> &buffer,
     }
 }
 
+/**
+ * @brief Gathers the strikes of the block from the host MIDI and the
+ * editor, sorted by sample offset.
+ * @param midiMessages The MIDI of the block.
+ * @param numSamples The number of samples of the block.
+ */
+void PDrum::collectStrikes(const juce::MidiBuffer &midiMessages,
+                           const int numSamples) {
+    numBlockStrikes = 0;
+    const auto add = [this](const BlockStrike &s) {
+        if (numBlockStrikes < static_cast<int>(blockStrikes.size()))
+            blockStrikes[static_cast<size_t>(numBlockStrikes++)] = s;
+    };
+    for (const auto &metadata: midiMessages) {
+        if (metadata.getMessage().isNoteOn())
+            add({metadata.samplePosition, noteStrikeAmplitude});
+    }
+    /// The editor's note-offs are drained with the rest and ignored, like
+    /// the host's
+    uiEvents.drain(numSamples, getSampleRate(),
+                   [&](const UiEventQueue::Event &event, const int offset) {
+                       if (event.type == UiEventQueue::Event::Type::strike)
+                           add({offset, event.amplitude, event.x, event.y});
+                       else if (event.type ==
+                                UiEventQueue::Event::Type::noteOn)
+                           add({offset, noteStrikeAmplitude});
+                   });
+    std::sort(blockStrikes.begin(), blockStrikes.begin() + numBlockStrikes,
+              [](const BlockStrike &a, const BlockStrike &b) {
+                  return a.sampleOffset < b.sampleOffset;
+              });
+}
+
+/**
+ * @brief Handles parameter changes from the AudioProcessorValueTreeState.
+ * @param parameterID The ID of the parameter that changed.
+ * @param newValue The new value of the parameter.
+ */
+void PDrum::parameterChanged(const juce::String &parameterID, float) {
+    PDRUM_TRACE_ZONE("PDrum::parameterChanged");
+    if (parameterID == "resonatorEngine" || parameterID == "lookahead" ||
+        parameterID == "hitCache" || parameterID == "offlineQuality") {
+        enginesStale.store(true);
+        triggerAsyncUpdate();
+    }
+}
+
+/**
+ * @brief Switches the resonator engine, lookahead mode, hit cache or
+ * offline profile on the message thread.
+ */
+void PDrum::handleAsyncUpdate() {
+    if (getSampleRate() <= 0.0 || !enginesStale.exchange(false))
+        return;
+    suspendProcessing(true);
+    configureEngines(getSampleRate(), getBlockSize());
+    suspendProcessing(false);
+}
+
+/**
+ * @brief Builds the engines of a new quality rung on the message thread
+ * once the governor has picked one.
+ */
+void PDrum::timerCallback() {
+    /// A new quality rung is built without interrupting the sound
+    if (getSampleRate() > 0.0 && rungPending.exchange(false))
+        prepareGovernedEngines(getSampleRate());
+}
+
+/**
+ * @brief Configures the resonator engine, lookahead mode, hit cache and
+ * offline profile selected by the parameters and reports their combined
+ * latency. Not real-time safe.
+ * @param sampleRate The sample rate of the audio stream.
+ * @param samplesPerBlock The number of samples per block to process.
+ */
+void PDrum::configureEngines(const double sampleRate,
+                             const int samplesPerBlock) {
+    /// The render thread must not run while the engines are reconfigured
+    lookahead.release();
+    /// Hand the sound back to the live engines at full quality before the
+    /// others are rebuilt
+    useGovernedEngines(liveSlot);
+    switchProfile(false);
+    configureOfflineProfile(sampleRate);
+    /// The cached hits replace the simulation and need no latency
+    if (parameters.getRawParameterValue("hitCache")->load() >= 0.5f) {
+        if (hitCache == nullptr)
+            hitCache = std::make_unique<HitCacheEngine>(
+                    parameters, membraneModel.getGridResolution());
+        if (radialModeOverride > 0 && axialModeOverride > 0)
+            hitCache->setModeCount(radialModeOverride, axialModeOverride);
+        hitCache->prepare(sampleRate);
+        hitCache->setVoiceLimit(HitCacheEngine::maxVoices);
+        lookaheadEnabled = false;
+        /// Strikes off the lattice are simulated with the body the cached
+        /// hits were rendered with
+        resonatorEngine = ResonatorEngine::modal;
+        uncachedSamplesLeft = 0;
+        /// The voice limit is the only rung that saves the hit cache work
+        governsVoices = true;
+        governorLevels = 2;
+        governor.reset(governorLevels);
+        setLatencySamples(0);
+        return;
+    }
+    hitCache.reset();
+    int latency = 0;
+    resonatorEngine = static_cast<ResonatorEngine>(static_cast<int>(
+            parameters.getRawParameterValue("resonatorEngine")->load()));
+    /// Only the modal resonator gives up modes
+    governsVoices = false;
+    governorLevels = resonatorEngine == ResonatorEngine::modal ? 4 : 3;
+    governor.reset(governorLevels);
+    if (resonatorEngine != ResonatorEngine::modal) {
+        convolutionModel.prepare(
+                sampleRate, samplesPerBlock,
+                resonatorEngine == ResonatorEngine::convolutionLowCpu
+                        ? lowCpuConvolutionLatency
+                        : 0);
+        latency += convolutionModel.getLatency();
+    }
+    lookaheadEnabled =
+            parameters.getRawParameterValue("lookahead")->load() >= 0.5f;
+    if (lookaheadEnabled) {
+        /// Leave the render thread at least one block of slack
+        lookahead.prepare(std::max(minLookaheadLatency, 2 * samplesPerBlock),
+                          samplesPerBlock);
+        latency += lookahead.getLatency();
+    }
+    setLatencySamples(latency);
+}
+
+/**
+ * @brief Builds the engines of the offline profile selected by the
+ * offlineQuality parameter. Not real-time safe.
+ * @param sampleRate The sample rate of the audio stream.
+ */
+void PDrum::configureOfflineProfile(const double sampleRate) {
+    const int quality = static_cast<int>(
+            parameters.getRawParameterValue("offlineQuality")->load());
+    if (quality <= 0) {
+        offlineMembraneModel.reset();
+        offlineResonatorModel.reset();
+        offlineArena.release();
+        return;
+    }
+    const auto &profile = offlineProfiles[static_cast<size_t>(
+            std::min(quality, static_cast<int>(offlineProfiles.size())) - 1)];
+    if (offlineMembraneModel == nullptr ||
+        offlineMembraneModel->getGridResolution() != profile.gridResolution)
+        offlineMembraneModel = std::make_unique<VibratingMembraneModel>(
+                parameters, profile.gridResolution, membraneStateStorage);
+    offlineMembraneModel->setStepInterval(profile.stepInterval);
+    if (offlineResonatorModel == nullptr)
+        offlineResonatorModel =
+                std::make_unique<ModalResonatorModel>(parameters);
+    if (radialModeOverride > 0 && axialModeOverride > 0)
+        offlineResonatorModel->setModeCount(radialModeOverride,
+                                            axialModeOverride);
+    else
+        offlineResonatorModel->setModeCount(profile.numRadialModes,
+                                            profile.numAxialModes);
+    offlineArena.reserve(offlineMembraneModel->getStateSize() +
+                         offlineResonatorModel->getStateSize());
+    offlineMembraneModel->placeState(offlineArena);
+    offlineResonatorModel->placeState(offlineArena);
+    offlineResonatorModel->setParameters(
+            parameters.getRawParameterValue("membraneSize")->load(),
+            parameters.getRawParameterValue("depth")->load(),
+            static_cast<float>(sampleRate));
+}
+
+/**
+ * @brief Moves the sound onto the live or offline engines, carrying
+ * over the vibration of the membrane and the resonator. Called on the
+ * thread that renders.
+ * @param offline True to use the offline engines.
+ */
+void PDrum::switchProfile(const bool offline) {
+    auto *membrane = offline ? offlineMembraneModel.get() : realtimeMembrane;
+    auto *resonator = offline ? offlineResonatorModel.get() : realtimeResonator;
+    if (membrane == activeMembrane)
+        return;
+    membrane->transferStateFrom(*activeMembrane);
+    resonator->transferStateFrom(*activeResonator);
+    activeMembrane = membrane;
+    activeResonator = resonator;
+    offlineProfileActive = offline;
+}
+
+/**
+ * @brief Builds the membrane and resonator of the quality rung the
+ * governor is on while the current ones keep rendering, and hands them
+ * to the thread that renders. Not real-time safe.
+ * @param sampleRate The sample rate of the audio stream.
+ */
+void PDrum::prepareGovernedEngines(const double sampleRate) {
+    /// The hit cache sheds voices on the audio thread instead
+    if (governsVoices)
+        return;
+    const auto &rung = getQualityRung();
+    const bool live = rung.gridDivisor == 1 && rung.numRadialModes == 0;
+    int slot = liveSlot;
+    {
+        const juce::SpinLock::ScopedLockType lock(governedLock);
+        /// Engines handed over but not taken yet are free again
+        pendingGovernedSlot = noSlot;
+        if (!live)
+            slot = activeGovernedSlot == 0 ? 1 : 0;
+    }
+    if (!live) {
+        auto &[arena, membrane, resonator] =
+                governedEngines[static_cast<size_t>(slot)];
+        const int gridResolution =
+                membraneModel.getGridResolution() / rung.gridDivisor;
+        if (membrane == nullptr ||
+            membrane->getGridResolution() != gridResolution) {
+            membrane = std::make_unique<VibratingMembraneModel>(
+                    parameters, gridResolution, membraneStateStorage);
+            membrane->setTargetCourantNumber(
+                    VibratingMembraneModel::defaultCourantNumber);
+        }
+        if (resonator == nullptr)
+            resonator = std::make_unique<ModalResonatorModel>(parameters);
+        /// Never more modes than the live resonator
+        const QualityProfile liveProfile;
+        const int radialModes = radialModeOverride > 0
+                                        ? radialModeOverride
+                                        : liveProfile.numRadialModes;
+        const int axialModes = axialModeOverride > 0
+                                       ? axialModeOverride
+                                       : liveProfile.numAxialModes;
+        if (rung.numRadialModes > 0)
+            resonator->setModeCount(std::min(radialModes, rung.numRadialModes),
+                                    std::min(axialModes, rung.numAxialModes));
+        else
+            resonator->setModeCount(radialModes, axialModes);
+        arena.reserve(membrane->getStateSize() + resonator->getStateSize());
+        membrane->placeState(arena);
+        resonator->placeState(arena);
+        resonator->setParameters(
+                parameters.getRawParameterValue("membraneSize")->load(),
+                parameters.getRawParameterValue("depth")->load(),
+                static_cast<float>(sampleRate));
+    }
+    const juce::SpinLock::ScopedLockType lock(governedLock);
+    pendingGovernedSlot = slot;
+}
+
+/**
+ * @brief Takes the engines of a new quality rung for live rendering,
+ * if prepareGovernedEngines has handed over any. Called on the thread
+ * that renders; never waits.
+ */
+void PDrum::takeGovernedEngines() {
+    const juce::SpinLock::ScopedTryLockType lock(governedLock);
+    if (!lock.isLocked() || pendingGovernedSlot == noSlot)
+        return;
+    useGovernedEngines(pendingGovernedSlot);
+}
+
+/**
+ * @brief Chooses the engines live rendering uses.
+ * @param slot The slot of the governed engines, or liveSlot for the
+ * live engines.
+ */
+void PDrum::useGovernedEngines(const int slot) {
+    pendingGovernedSlot = noSlot;
+    activeGovernedSlot = slot;
+    if (slot == liveSlot) {
+        realtimeMembrane = &membraneModel;
+        realtimeResonator = &resonatorModel;
+    } else {
+        auto &engines = governedEngines[static_cast<size_t>(slot)];
+        realtimeMembrane = engines.membrane.get();
+        realtimeResonator = engines.resonator.get();
+    }
+}
+
+/**
+ * @brief Feeds the governor the time a block took and applies the
+ * quality rung it picks. Called on the thread that renders.
+ * @param startTicks The juce::Time::getHighResolutionTicks value at the
+ * start of the block.
+ * @param numSamples The number of samples of the block.
+ */
+void PDrum::governBlock(const juce::int64 startTicks, const int numSamples) {
+    /// Offline renders have no deadline and get the quality asked for
+    if (offlineRendering.load(std::memory_order_relaxed) ||
+        autoQualityParameter->load(std::memory_order_relaxed) < 0.5f) {
+        if (governor.getLevel() > 0) {
+            governor.reset(governorLevels);
+            applyQualityRung();
+        }
+        return;
+    }
+    const double seconds = juce::Time::highResolutionTicksToSeconds(
+            juce::Time::getHighResolutionTicks() - startTicks);
+    if (governor.addBlock(seconds, numSamples, getSampleRate()))
+        applyQualityRung();
+}
+
+/**
+ * @brief Applies a new quality rung: limits the hit cache voices at
+ * once and flags the rung for the message thread to build its engines.
+ * Called on the thread that renders; never blocks.
+ */
+void PDrum::applyQualityRung() {
+    if (hitCache != nullptr)
+        hitCache->setVoiceLimit(getQualityRung().voiceLimit);
+    else
+        rungPending.store(true);
+}
+
+/**
+ * @brief Gets the rung of the quality ladder the governor is on.
+ * @return The rung.
+ */
+const PDrum::QualityRung &PDrum::getQualityRung() const {
+    const int level = governor.getLevel();
+    if (governsVoices)
+        return qualityLadder[level > 0 ? qualityLadder.size() - 1 : 0];
+    return qualityLadder[static_cast<size_t>(level)];
+}
+
+/**
+ * @brief Seeds the strike position randomness of every membrane, so
+ * offline renders are reproducible.
+ * @param seed The seed for the random number generators.
+ */
+void PDrum::setRandomSeed(const uint32_t seed) {
+    membraneModel.setRandomSeed(seed);
+    if (offlineMembraneModel != nullptr)
+        offlineMembraneModel->setRandomSeed(seed);
+    for (const auto &engines: governedEngines)
+        if (engines.membrane != nullptr)
+            engines.membrane->setRandomSeed(seed);
+    if (hitCache != nullptr)
+        hitCache->setRandomSeed(seed);
+}
+
+/**
+ * @brief Overrides the resonator mode count of every quality profile.
+ * Takes effect on the next call to prepareToPlay.
+ * @param numRadialModes The number of Bessel zeros to use.
+ * @param numAxialModes The number of axial orders per Bessel zero.
+ */
+void PDrum::setResonatorModeCount(const int numRadialModes,
+                                  const int numAxialModes) {
+    radialModeOverride = numRadialModes;
+    axialModeOverride = numAxialModes;
+}
+
+/**
+ * @brief Strikes the membrane. Called on the thread that renders.
+ * @param amplitude The amplitude of the strike.
+ * @param x The grid column, or -1 to strike near the centre.
+ * @param y The grid row, or -1 to strike near the centre.
+ */
+void PDrum::strike(const float amplitude, const int x, const int y) {
+    /// Positions are given on the live grid. A single cell is a smaller
+    /// mallet on a finer grid, so the strike grows with the resolution to
+    /// keep the level. The random offset is given in live cells too
+    const float scale =
+            static_cast<float>(activeMembrane->getGridResolution()) /
+            static_cast<float>(membraneModel.getGridResolution());
+    if (x < 0 || y < 0)
+        activeMembrane->exciteCenter(amplitude * scale, scale);
+    else
+        activeMembrane->excite(amplitude * scale,
+                               juce::roundToInt(static_cast<float>(x) * scale),
+                               juce::roundToInt(static_cast<float>(y) * scale));
+}
+
+/**
+ * @brief Renders samples on the lookahead render thread.
+ * @param output Receives the samples.
+ * @param numSamples The number of samples to render.
+ */
+void PDrum::render(float *output, const int numSamples) {
+    const auto startTicks = juce::Time::getHighResolutionTicks();
+    /// The samples are due once the latency has passed
+    activeMembrane->setBlockDeadline(
+            juce::Time::getMillisecondCounterHiRes() +
+            1000.0 * lookahead.getLatency() / getSampleRate());
+    renderSamples(output, numSamples);
+    governBlock(startTicks, numSamples);
+}
+
+/**
+ * @brief Runs the membrane and the drum body.
+ * @param output Receives the samples.
+ * @param numSamples The number of samples to render.
+ */
+void PDrum::renderSamples(float *output, const int numSamples) {
+    /// Follow the host between live playback and offline bounces, and the
+    /// governor between quality rungs
+    takeGovernedEngines();
+    switchProfile(offlineRendering.load(std::memory_order_relaxed) &&
+                  offlineMembraneModel != nullptr);
+    if (!offlineProfileActive)
+        activeMembrane->setStepIntervalLimit(
+                getQualityRung().stepIntervalLimit);
+    /// Parameters are read once per block, or part of a block between
+    /// strikes
+    activeMembrane->beginBlock(numSamples);
+    const float inverseSampleRate = 1.0f / static_cast<float>(getSampleRate());
+    {
+        PDRUM_TRACE_ZONE("membrane");
+        /// Stop at every frame due for the field recorder
+        for (int i = 0; i < numSamples;) {
+            const int segment =
+                    fieldRecorder.getSamplesToNextFrame(numSamples - i);
+            for (const int end = i + segment; i < end; ++i)
+                output[i] = activeMembrane->processSample(inverseSampleRate);
+            fieldRecorder.advance(segment, *activeMembrane);
+        }
+    }
+    PDRUM_TRACE_ZONE("resonator");
+    if (resonatorEngine == ResonatorEngine::modal) {
+        for (int i = 0; i < numSamples; ++i)
+            output[i] = activeResonator->process(output[i]);
+    } else {
+        convolutionModel.process(output, numSamples);
+    }
+}
+
+/**
+ * @brief Simulates the strikes of the block the hit cache does not
+ * cover, and the ringing of earlier ones, under the cached hits. Marks
+ * the strikes the hit cache covers.
+ * @param output Receives the samples.
+ * @param numSamples The number of samples of the block.
+ */
+void PDrum::renderUncachedStrikes(float *output, const int numSamples) {
+    activeMembrane->setBlockDeadline(
+            juce::Time::getMillisecondCounterHiRes() +
+            1000.0 * numSamples / getSampleRate());
+    const auto renderUntil = [&](int &position, const int end) {
+        if (uncachedSamplesLeft > 0 && end > position) {
+            renderSamples(output + position, end - position);
+            uncachedSamplesLeft = std::max(0, uncachedSamplesLeft -
+                                                      (end - position));
+        }
+        position = end;
+    };
+    int position = 0;
+    for (int i = 0; i < numBlockStrikes; ++i) {
+        auto &pending = blockStrikes[static_cast<size_t>(i)];
+        /// Decided once, the lattice may change on the render thread
+        pending.cached = hitCache->covers(pending.x, pending.y);
+        if (pending.cached)
+            continue;
+        renderUntil(position, pending.sampleOffset);
+        strike(pending.amplitude, pending.x, pending.y);
+        uncachedSamplesLeft =
+                static_cast<int>(uncachedTailSeconds * getSampleRate());
+    }
+    renderUntil(position, numSamples);
+}
+
+/**
+ * @brief Saves the parameters and, unless disabled, the resonator
+ * coefficient tables in the versioned binary state format.
+ * @param destData Receives the state.
+ */
+void PDrum::getStateInformation(juce::MemoryBlock &destData) {
+    juce::MemoryOutputStream stream(destData, false);
+    stream.writeInt(stateMagic);
+    stream.writeInt(stateVersion);
+    /// Every section is a tag, a size in bytes and the content
+    const auto writeSection = [&stream](const int tag,
+                                        const juce::MemoryOutputStream &body) {
+        stream.writeInt(tag);
+        stream.writeInt(static_cast<int>(body.getDataSize()));
+        stream.write(body.getData(), body.getDataSize());
+    };
+    juce::MemoryOutputStream parameterSection;
+    const auto &processorParameters = AudioProcessor::getParameters();
+    parameterSection.writeInt(processorParameters.size());
+    for (const auto *parameter: processorParameters) {
+        const auto *ranged =
+                dynamic_cast<const juce::RangedAudioParameter *>(parameter);
+        jassert(ranged != nullptr);
+        parameterSection.writeString(ranged->getParameterID());
+        parameterSection.writeFloat(
+                ranged->convertFrom0to1(ranged->getValue()));
+    }
+    writeSection(parametersSection, parameterSection);
+    if (!storeDerivedTables)
+        return;
+    juce::MemoryOutputStream tableSection;
+    tableSection.writeInt(offlineResonatorModel != nullptr ? 2 : 1);
+    resonatorModel.writeCoefficientTable(tableSection);
+    if (offlineResonatorModel != nullptr)
+        offlineResonatorModel->writeCoefficientTable(tableSection);
+    writeSection(tablesSection, tableSection);
+}
+
+/**
+ * @brief Restores a state saved by getStateInformation. Parameters equal
+ * to the current ones are left alone, so nothing listening to them does
+ * any work, and stored tables the shared cache lacks are added to it, so
+ * the next prepareToPlay does not build them.
+ * @param data The state.
+ * @param sizeInBytes The size of the state in bytes.
+ */
+void PDrum::setStateInformation(const void *data, const int sizeInBytes) {
+    if (data == nullptr || sizeInBytes < 8)
+        return;
+    juce::MemoryInputStream stream(data, static_cast<size_t>(sizeInBytes),
+                                   false);
+    if (stream.readInt() != stateMagic)
+        return;
+    /// A newer format may have changed the meaning of known sections
+    if (const int version = stream.readInt();
+        version < 1 || version > stateVersion)
+        return;
+    while (stream.getNumBytesRemaining() >= 8) {
+        const int tag = stream.readInt();
+        const int size = stream.readInt();
+        if (size < 0 || size > stream.getNumBytesRemaining())
+            return;
+        const auto start = stream.getPosition();
+        juce::MemoryInputStream section(
+                static_cast<const char *>(data) + start,
+                static_cast<size_t>(size), false);
+        if (tag == parametersSection)
+            restoreParameters(section);
+        else if (tag == tablesSection)
+            restoreTables(section);
+        stream.setPosition(start + size);
+    }
+}
+
+/**
+ * @brief Restores the parameters section of a saved state.
+ * @param stream The section.
+ */
+void PDrum::restoreParameters(juce::InputStream &stream) {
+    const int numParameters = stream.readInt();
+    for (int i = 0; i < numParameters && !stream.isExhausted(); ++i) {
+        const auto parameterID = stream.readString();
+        const float value = stream.readFloat();
+        /// Parameters the state lacks keep their value, unknown ones are
+        /// skipped
+        auto *parameter = parameters.getParameter(parameterID);
+        if (parameter == nullptr ||
+            parameter->convertFrom0to1(parameter->getValue()) == value)
+            continue;
+        parameter->setValueNotifyingHost(parameter->convertTo0to1(value));
+    }
+}
+
+/**
+ * @brief Restores the tables section of a saved state.
+ * @param stream The section.
+ */
+void PDrum::restoreTables(juce::InputStream &stream) {
+    /// Tables of an earlier restore are no longer wanted
+    restoredTables.clear();
+    const int numTables = stream.readInt();
+    for (int i = 0; i < numTables && !stream.isExhausted(); ++i) {
+        auto table = ModalResonatorModel::readCoefficientTable(stream);
+        if (table == nullptr)
+            return;
+        restoredTables.push_back(std::move(table));
+    }
+}
+
+/**
+ * @brief Starts recording the displacement field of the membrane to a
+ * .npy file, finishing any recording in progress. Not real-time safe.
+ * @param file The .npy file to write.
+ * @param settings The frame rate, region and precision.
+ * @return False if the processor is not prepared or the file could not be
+ * created.
+ */
+bool PDrum::startFieldRecording(const juce::File &file,
+                                const FieldRecorder::Settings &settings) {
+    if (getSampleRate() <= 0.0)
+        return false;
+    return fieldRecorder.start(file, settings,
+                               membraneModel.getGridResolution(),
+                               getSampleRate());
+}
+
 /**
  * @brief Create an editor for the processor.
  * @return A pointer to the created editor.
@@ -1,4 +1,5 @@
 #include "PDrumEditor.h"
+#include "TraceRecorder.h"
 
 /**
  * @brief Constructor for the NBandParametricEQEditor class.
@@ -6,12 +7,17 @@
  * is associated with.
  */
 PDrumEditor::PDrumEditor(PDrum &p) :
-    AudioProcessorEditor(p), processor(p), /*membrane(p.getModel()),*/
+    AudioProcessorEditor(p), processor(p),
+    /*membrane(p.getModel(), p.getUiEventQueue()),*/
     resonator(p.getParameters(), p.getModel()),
     membraneSizeKnob(p.getParameters(), "membraneSize", "Size"),
     membraneTensionKnob(p.getParameters(), "membraneTension", "Tension"),
     depthKnob(p.getParameters(), "depth", "Depth"),
-    randomnessKnob(p.getParameters(), "randomness", "Randomness") {
+    randomnessKnob(p.getParameters(), "randomness", "Randomness"),
+    lookaheadAttachment(p.getParameters(), "lookahead", lookaheadButton),
+    hitCacheAttachment(p.getParameters(), "hitCache", hitCacheButton),
+    autoQualityAttachment(p.getParameters(), "autoQuality",
+                          autoQualityButton) {
     addAndMakeVisible(midiKeyboardComponent);
     //addAndMakeVisible(membrane);
     addAndMakeVisible(resonator);
@@ -19,11 +25,45 @@ PDrumEditor::PDrumEditor(PDrum &p) :
     addAndMakeVisible(membraneTensionKnob);
     addAndMakeVisible(depthKnob);
     addAndMakeVisible(randomnessKnob);
+    resonatorEngineBox.addItemList(
+            {"Modal", "Convolution", "Convolution (Low CPU)"}, 1);
+    resonatorEngineBox.setTooltip("Resonator Engine");
+    resonatorEngineAttachment = std::make_unique<
+            juce::AudioProcessorValueTreeState::ComboBoxAttachment>(
+            p.getParameters(), "resonatorEngine", resonatorEngineBox);
+    addAndMakeVisible(resonatorEngineBox);
+    lookaheadButton.setTooltip("Render ahead of the host with added latency");
+    addAndMakeVisible(lookaheadButton);
+    hitCacheButton.setTooltip("Play strikes from pre-rendered hits; strikes "
+                              "away from the centre are still simulated");
+    addAndMakeVisible(hitCacheButton);
+    offlineQualityBox.addItemList({"Same as Live", "High", "Maximum"}, 1);
+    offlineQualityBox.setTooltip("Offline Render Quality");
+    offlineQualityAttachment = std::make_unique<
+            juce::AudioProcessorValueTreeState::ComboBoxAttachment>(
+            p.getParameters(), "offlineQuality", offlineQualityBox);
+    addAndMakeVisible(offlineQualityBox);
+    autoQualityButton.setTooltip("Lower the quality instead of dropping out");
+    addAndMakeVisible(autoQualityButton);
+    qualityLabel.setText("Quality: Full", juce::dontSendNotification);
+    qualityLabel.setJustificationType(juce::Justification::centredLeft);
+    addAndMakeVisible(qualityLabel);
+    recordFieldButton.setTooltip("Record the membrane field to a .npy file");
+    recordFieldButton.onClick = [this] { toggleFieldRecording(); };
+    addAndMakeVisible(recordFieldButton);
+#if PDRUM_ENABLE_TRACING
+    saveTraceButton.setTooltip("Save the trace zones for chrome://tracing");
+    saveTraceButton.onClick = [this] { saveTrace(); };
+    addAndMakeVisible(saveTraceButton);
+    constexpr int traceRowHeight = 20;
+#else
+    constexpr int traceRowHeight = 0;
+#endif
     midiKeyboardComponent.setMidiChannel(2);
-    midiKeyboardState.addListener(&processor.getMidiMessageCollector());
-    setSize(300, 400);
+    midiKeyboardState.addListener(&processor.getUiEventQueue());
+    setSize(300, 520 + traceRowHeight);
     setResizable(true, true);
-    setResizeLimits(300, 400, 1000, 600);
+    setResizeLimits(300, 520 + traceRowHeight, 1000, 700 + traceRowHeight);
     startTimerHz(60);
 }
 
@@ -32,6 +72,8 @@ PDrumEditor::PDrumEditor(PDrum &p) :
  * @param g The graphics context used for painting.
  */
 void PDrumEditor::paint(juce::Graphics &g) {
+    PDRUM_TRACE_THREAD("Message");
+    PDRUM_TRACE_ZONE("PDrumEditor::paint");
     g.fillAll(getLookAndFeel().findColour(
             juce::ResizableWindow::backgroundColourId));
 }
@@ -47,6 +89,9 @@ void PDrumEditor::resized() {
     const auto keyboardArea = area.removeFromBottom(80).reduced(8);
     midiKeyboardComponent.setBounds(keyboardArea);
 
+    const auto qualityArea = area.removeFromBottom(20);
+    qualityLabel.setBounds(qualityArea.reduced(8, 0));
+
     constexpr int knobWidth = 75;
 
     const auto drumArea = area.removeFromLeft(area.getWidth() - knobWidth);
@@ -65,10 +110,108 @@ void PDrumEditor::resized() {
     const auto randomnessArea = knobArea.removeFromTop(knobWidth);
     randomnessKnob.setBounds(randomnessArea.reduced(8));
 
+    const auto engineArea = knobArea.removeFromTop(20);
+    resonatorEngineBox.setBounds(engineArea.reduced(4, 0));
+
+    const auto lookaheadArea = knobArea.removeFromTop(20);
+    lookaheadButton.setBounds(lookaheadArea.reduced(4, 0));
+
+    const auto hitCacheArea = knobArea.removeFromTop(20);
+    hitCacheButton.setBounds(hitCacheArea.reduced(4, 0));
+
+    const auto offlineQualityArea = knobArea.removeFromTop(20);
+    offlineQualityBox.setBounds(offlineQualityArea.reduced(4, 0));
+
+    const auto autoQualityArea = knobArea.removeFromTop(20);
+    autoQualityButton.setBounds(autoQualityArea.reduced(4, 0));
+
+    const auto recordFieldArea = knobArea.removeFromTop(20);
+    recordFieldButton.setBounds(recordFieldArea.reduced(4, 0));
+
+#if PDRUM_ENABLE_TRACING
+    const auto saveTraceArea = knobArea.removeFromTop(20);
+    saveTraceButton.setBounds(saveTraceArea.reduced(4, 0));
+#endif
+
     /// TODO - create a Component to draw a 3D cylinder to represent the drum
 }
 
+/**
+ * @brief Stop the field recording in progress, or ask for a file and
+ * start recording the membrane field to it.
+ */
+void PDrumEditor::toggleFieldRecording() {
+    if (processor.isRecordingField()) {
+        processor.stopFieldRecording();
+        recordFieldButton.setButtonText("Record Field");
+        return;
+    }
+    fieldChooser = std::make_unique<juce::FileChooser>(
+            "Record Field",
+            juce::File::getSpecialLocation(juce::File::userDesktopDirectory)
+                    .getChildFile("pdrum-field.npy"),
+            "*.npy");
+    constexpr int flags = juce::FileBrowserComponent::saveMode |
+                          juce::FileBrowserComponent::warnAboutOverwriting;
+    fieldChooser->launchAsync(flags, [this](const juce::FileChooser &chooser) {
+        if (const auto file = chooser.getResult();
+            file != juce::File() &&
+            processor.startFieldRecording(file, FieldRecorder::Settings{}))
+            recordFieldButton.setButtonText("Stop Recording");
+    });
+}
+
+#if PDRUM_ENABLE_TRACING
+/**
+ * @brief Ask for a file and save the recorded trace zones to it.
+ */
+void PDrumEditor::saveTrace() {
+    traceChooser = std::make_unique<juce::FileChooser>(
+            "Save Trace",
+            juce::File::getSpecialLocation(juce::File::userDesktopDirectory)
+                    .getChildFile("pdrum-trace.json"),
+            "*.json");
+    constexpr int flags = juce::FileBrowserComponent::saveMode |
+                          juce::FileBrowserComponent::warnAboutOverwriting;
+    traceChooser->launchAsync(flags, [](const juce::FileChooser &chooser) {
+        if (const auto file = chooser.getResult(); file != juce::File())
+            TraceRecorder::writeChromeTrace(file);
+    });
+}
+#endif
+
 /**
  * @brief Timer callback function to update the editor.
  */
-void PDrumEditor::timerCallback() { repaint(); }
+void PDrumEditor::timerCallback() {
+    updateQualityLabel();
+    repaint();
+}
+
+/**
+ * @brief Show the latest quality change of the governor, if the label
+ * does not show it yet.
+ */
+void PDrumEditor::updateQualityLabel() {
+    const auto &governor = processor.getQualityGovernor();
+    const int transitions = governor.getNumTransitions();
+    if (transitions == shownTransitions)
+        return;
+    const int level = governor.getLevel();
+    const juce::String rung = processor.getQualityRung().name;
+    /// A reset of the governor returns to full quality at once
+    if (transitions == 0 || level == shownLevel) {
+        qualityLabel.setText("Quality: " + rung, juce::dontSendNotification);
+    } else {
+        const int load =
+                juce::roundToInt(governor.getTransitionLoad() * 100.0f);
+        qualityLabel.setText(juce::String("Quality ") +
+                                     (level > shownLevel ? "lowered"
+                                                         : "raised") +
+                                     " to " + rung + " at " +
+                                     juce::String(load) + "% CPU",
+                             juce::dontSendNotification);
+    }
+    shownTransitions = transitions;
+    shownLevel = level;
+}
@@ -0,0 +1,117 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <array>
+#include <juce_core/juce_core.h>
+
+/**
+ * @brief Hardware performance counters of the process, read through Linux
+ * perf_event_open.
+ *
+ * Every counter is opened on its own, counting user space only, and
+ * inherited by the threads started afterwards, so a reading covers the
+ * shared worker threads as long as the counters are opened before the
+ * first instance is prepared. Counters run from construction on; a
+ * scenario is measured as the difference of two snapshots. When the
+ * processor has fewer counters than events, the kernel multiplexes them
+ * and the counts are scaled by the share of time each one ran. Events the
+ * system does not offer, and every event on other systems or when
+ * perf_event_paranoid forbids them, read as unavailable.
+ */
+class PerfCounters final {
+public:
+    /**
+     * @brief Events counted.
+     */
+    enum Event {
+        /** Core cycles */
+        cycles,
+        /** Instructions retired */
+        instructions,
+        /** L1 data cache read misses */
+        l1Misses,
+        /** Accesses that reach the last level cache, which are the L2
+         * misses where the last level is L3 */
+        l2Misses,
+        /** Last level cache misses */
+        llcMisses,
+        /** Data TLB read misses */
+        dtlbMisses,
+        /** Mispredicted branches */
+        branchMisses,
+        /** Number of events */
+        numEvents
+    };
+
+    /**
+     * @brief Raw count of one event.
+     */
+    struct Count {
+        /** Events counted while the counter ran */
+        juce::uint64 value = 0;
+        /** Nanoseconds the counter was enabled and running */
+        juce::uint64 timeEnabled = 0, timeRunning = 0;
+    };
+
+    /** Counts of every event at one moment */
+    using Snapshot = std::array<Count, numEvents>;
+
+    /**
+     * @brief Opens and starts every counter. Construct before anything
+     * starts threads that should be counted.
+     */
+    PerfCounters();
+
+    /**
+     * @brief Destructor for PerfCounters. Closes the counters.
+     */
+    ~PerfCounters();
+
+    /**
+     * @brief Checks whether any counter could be opened.
+     * @return True if at least one event is counted.
+     */
+    [[nodiscard]] bool isAvailable() const;
+
+    /**
+     * @brief Gets why the counters that failed to open did.
+     * @return The reason, empty if every counter opened.
+     */
+    [[nodiscard]] const juce::String &getError() const { return error; }
+
+    /**
+     * @brief Reads every counter.
+     * @return The counts.
+     */
+    [[nodiscard]] Snapshot read() const;
+
+    /**
+     * @brief Gets the number of events between two snapshots, scaled up for
+     * the time the counter was multiplexed out.
+     * @param before The earlier snapshot.
+     * @param after The later snapshot.
+     * @param event The event.
+     * @return The count, or -1 if the event is unavailable or never ran.
+     */
+    [[nodiscard]] double countBetween(const Snapshot &before,
+                                      const Snapshot &after,
+                                      Event event) const;
+
+    /**
+     * @brief Gets the name of an event as printed in reports.
+     * @param event The event.
+     * @return The name.
+     */
+    static const char *getName(Event event);
+
+private:
+    /** File descriptor of each counter, -1 if unavailable */
+    std::array<int, numEvents> counters;
+
+    /** Why the counters that failed to open did */
+    juce::String error;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PerfCounters)
+};
+
+#endif // PERF_COUNTERS_H
@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <juce_audio_processors/juce_audio_processors.h>
+#include <memory>
+#include <vector>
+#include "PDrum.h"
+#include "PerfCounters.h"
+
+/**
+ * @brief Prints the command line usage.
+ */
+static void printUsage() {
+    std::cerr << "Usage: pdrum_benchmark [--instances 40] [--rounds 10]\n"
+                 "                       [--rate 48000] [--block 512]\n"
+                 "                       [--editor] [--grids 128,256,512]\n"
+                 "                       [--seconds 2]\n";
+}
+
+/**
+ * @brief Times of one phase, one per instance.
+ */
+struct PhaseTimes {
+    /** Name printed in the report */
+    const char *name;
+    /** Milliseconds per instance */
+    std::vector<double> times;
+};
+
+/**
+ * @brief Runs a callable and measures how long it takes.
+ * @tparam Callable A callable without arguments.
+ * @param callable The callable to run.
+ * @return The time taken in milliseconds.
+ */
+template<typename Callable>
+static double timeMs(Callable &&callable) {
+    const double start = juce::Time::getMillisecondCounterHiRes();
+    callable();
+    return juce::Time::getMillisecondCounterHiRes() - start;
+}
+
+/**
+ * @brief Prints the median, 95th percentile and largest time of every
+ * phase.
+ * @param title The title of the report.
+ * @param phases The phases to report.
+ */
+static void printReport(const char *title, std::vector<PhaseTimes> &phases) {
+    std::cout << title << " (ms per instance)\n"
+              << "  " << std::left << std::setw(12) << "phase" << std::right
+              << std::setw(10) << "median" << std::setw(10) << "p95"
+              << std::setw(10) << "max" << "\n";
+    for (auto &[name, times]: phases) {
+        if (times.empty())
+            continue;
+        std::sort(times.begin(), times.end());
+        const auto percentile = [&times](const double fraction) {
+            return times[static_cast<size_t>(
+                    fraction * static_cast<double>(times.size() - 1))];
+        };
+        std::cout << "  " << std::left << std::setw(12) << name << std::right
+                  << std::fixed << std::setprecision(3) << std::setw(10)
+                  << percentile(0.5) << std::setw(10) << percentile(0.95)
+                  << std::setw(10) << times.back() << "\n";
+    }
+}
+
+/** Bytes a cache miss brings in, one line */
+static constexpr double cacheLineBytes = 64.0;
+
+/** Amplitude of the strikes of the membrane benchmark, the one a note
+ * triggers in the plugin */
+static constexpr float strikeAmplitude = 0.25f;
+
+/**
+ * @brief Prints every hardware counter between two snapshots per unit of
+ * work, and the instructions per cycle.
+ * @param counters The counters.
+ * @param before The snapshot at the start of the scenario.
+ * @param after The snapshot at the end of the scenario.
+ * @param units Name and number of each unit of work, one column each.
+ * @param cellUpdates Number of cell updates, or 0 to leave out the bytes
+ * the cache misses bring in per cell.
+ */
+static void printCounters(
+        const PerfCounters &counters, const PerfCounters::Snapshot &before,
+        const PerfCounters::Snapshot &after,
+        const std::vector<std::pair<const char *, double>> &units,
+        const double cellUpdates = 0.0) {
+    if (!counters.isAvailable())
+        return;
+    std::cout << "  " << std::left << std::setw(14) << "counter"
+              << std::right;
+    for (const auto &[name, count]: units)
+        std::cout << std::setw(14) << name;
+    if (cellUpdates > 0.0)
+        std::cout << std::setw(14) << "bytes/cell";
+    std::cout << "\n";
+    for (int i = 0; i < PerfCounters::numEvents; ++i) {
+        const auto event = static_cast<PerfCounters::Event>(i);
+        const double count = counters.countBetween(before, after, event);
+        std::cout << "  " << std::left << std::setw(14)
+                  << PerfCounters::getName(event) << std::right << std::fixed
+                  << std::setprecision(1);
+        for (const auto &[name, number]: units) {
+            if (count < 0.0)
+                std::cout << std::setw(14) << "n/a";
+            else
+                std::cout << std::setw(14) << count / number;
+        }
+        /// Every miss of a data cache brings in a whole line
+        const bool isCacheMiss = event == PerfCounters::l1Misses ||
+                                 event == PerfCounters::l2Misses ||
+                                 event == PerfCounters::llcMisses;
+        if (cellUpdates > 0.0 && isCacheMiss && count >= 0.0)
+            std::cout << std::setw(14) << std::setprecision(3)
+                      << count * cacheLineBytes / cellUpdates;
+        std::cout << "\n";
+    }
+    const double cycles =
+            counters.countBetween(before, after, PerfCounters::cycles);
+    const double instructions =
+            counters.countBetween(before, after, PerfCounters::instructions);
+    if (cycles > 0.0 && instructions >= 0.0)
+        std::cout << "  IPC " << std::setprecision(2) << instructions / cycles
+                  << "\n";
+}
+
+/**
+ * @brief Times the membrane stepping on one grid and prints the hardware
+ * counters per step, per sample and per cell. The membrane steps at the
+ * default interval and is struck every quarter second, as a pattern
+ * played on the live instrument keeps it ringing.
+ * @param counters The counters.
+ * @param parameters The parameters the membrane reads.
+ * @param gridResolution The resolution of the grid.
+ * @param sampleRate The sample rate.
+ * @param blockSize The number of samples per block.
+ * @param seconds The length of audio to render.
+ */
+static void benchmarkMembrane(const PerfCounters &counters,
+                              juce::AudioProcessorValueTreeState &parameters,
+                              const int gridResolution,
+                              const double sampleRate, const int blockSize,
+                              const double seconds) {
+    /// The format of the plugin, set by the same build option
+    constexpr auto storage =
+#if PDRUM_HALF_PRECISION_STATE
+            VibratingMembraneModel::StateStorage::float16;
+#else
+            VibratingMembraneModel::StateStorage::float32;
+#endif
+    VibratingMembraneModel membrane(parameters, gridResolution, storage);
+    MemoryArena arena;
+    arena.reserve(membrane.getStateSize());
+    membrane.placeState(arena);
+    membrane.setStepInterval(VibratingMembraneModel::defaultStepInterval);
+    const auto &mask = membrane.getIsInsideMask();
+    const auto numCells = static_cast<double>(
+            std::count(mask.begin(), mask.end(), static_cast<uint8_t>(1)));
+
+    const auto timeStep = static_cast<float>(1.0 / sampleRate);
+    const int strikeInterval = static_cast<int>(sampleRate / 4.0);
+    const auto run = [&](const int numSamples) {
+        const juce::ScopedNoDenormals noDenormals;
+        float sum = 0.0f;
+        for (int start = 0; start < numSamples; start += blockSize) {
+            const int end = std::min(start + blockSize, numSamples);
+            membrane.beginBlock(end - start);
+            for (int i = start; i < end; ++i) {
+                if (i % strikeInterval == 0)
+                    membrane.exciteCenter(strikeAmplitude, 1.0f);
+                sum += membrane.processSample(timeStep);
+            }
+        }
+        return sum;
+    };
+    /// Warm the caches and wake the workers before measuring
+    run(strikeInterval);
+
+    const int numSamples = static_cast<int>(seconds * sampleRate);
+    const double numSteps = static_cast<double>(numSamples) /
+                            VibratingMembraneModel::defaultStepInterval;
+    float sum = 0.0f;
+    const auto before = counters.read();
+    const double elapsedMs = timeMs([&] { sum = run(numSamples); });
+    const auto after = counters.read();
+
+    std::cout << "Membrane " << gridResolution << "x" << gridResolution
+              << ": " << static_cast<int>(numCells) << " cells, "
+              << std::setprecision(2)
+              << static_cast<double>(membrane.getStateSize()) / 1048576.0
+              << " MB state, " << static_cast<int>(numSteps) << " steps"
+              << (std::isfinite(sum) ? "" : ", unstable") << "\n"
+              << "  time " << std::setprecision(3)
+              << elapsedMs * 1000.0 / numSteps << " us per step, "
+              << elapsedMs * 1.0e6 / numSamples << " ns per sample\n";
+    printCounters(counters, before, after,
+                  {{"per step", numSteps},
+                   {"per sample", static_cast<double>(numSamples)}},
+                  numSteps * numCells);
+}
+
+/**
+ * @brief Entry point for the instantiation benchmark. Times what a plugin
+ * scan does, creating and destroying one instance at a time, and what
+ * loading a project does, creating many instances, restoring a saved state
+ * into each and preparing them. Every round starts with no instance alive,
+ * so the shared tables and workers are built again as in a fresh process.
+ * Then times the membrane stepping on each grid of --grids. Hardware
+ * counters are reported around every scenario where the system offers
+ * them.
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments.
+ * @return Zero on success.
+ */
+int main(int argc, char *argv[]) {
+    /// Opened first, so the worker threads inherit the counters
+    const PerfCounters counters;
+    const juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    const juce::ArgumentList args(argc, argv);
+    const auto optionOr = [&](const char *option,
+                              const juce::String &fallback) {
+        return args.containsOption(option) ? args.getValueForOption(option)
+                                           : fallback;
+    };
+    const int numInstances = optionOr("--instances", "40").getIntValue();
+    const int numRounds = optionOr("--rounds", "10").getIntValue();
+    const double sampleRate = optionOr("--rate", "48000").getDoubleValue();
+    const int blockSize = optionOr("--block", "512").getIntValue();
+    const bool withEditor = args.containsOption("--editor");
+    const double seconds = optionOr("--seconds", "2").getDoubleValue();
+    juce::StringArray grids;
+    grids.addTokens(optionOr("--grids", "128,256,512"), ",", "");
+    grids.removeEmptyStrings();
+    const bool gridsValid = std::all_of(
+            grids.begin(), grids.end(),
+            [](const juce::String &grid) { return grid.getIntValue() > 0; });
+    if (numInstances <= 0 || numRounds <= 0 || sampleRate <= 0.0 ||
+        blockSize <= 0 || seconds <= 0.0 || !gridsValid) {
+        printUsage();
+        return 1;
+    }
+    if (!counters.isAvailable())
+        std::cout << "Hardware counters unavailable (" << counters.getError()
+                  << "), reporting times only\n";
+    else if (counters.getError().isNotEmpty())
+        std::cout << "Some hardware counters unavailable ("
+                  << counters.getError() << ")\n";
+
+    /// A state with its tables, as a saved project holds
+    juce::MemoryBlock savedState;
+    {
+        PDrum source;
+        source.prepareToPlay(sampleRate, blockSize);
+        source.getStateInformation(savedState);
+        source.releaseResources();
+    }
+
+    std::vector<PhaseTimes> scan{{"construct", {}}, {"destroy", {}}};
+    const auto scanStart = counters.read();
+    for (int round = 0; round < numRounds; ++round) {
+        for (int i = 0; i < numInstances; ++i) {
+            std::unique_ptr<PDrum> instance;
+            scan[0].times.push_back(
+                    timeMs([&] { instance = std::make_unique<PDrum>(); }));
+            scan[1].times.push_back(timeMs([&] { instance.reset(); }));
+        }
+    }
+    const auto scanEnd = counters.read();
+    printReport("Plugin scan", scan);
+    printCounters(counters, scanStart, scanEnd,
+                  {{"per instance", static_cast<double>(numInstances) *
+                                            numRounds}});
+
+    std::vector<PhaseTimes> load{{"construct", {}}, {"restore", {}},
+                                 {"prepare", {}},   {"editor", {}},
+                                 {"release", {}},   {"destroy", {}}};
+    std::vector<double> projectTimes;
+    const auto loadStart = counters.read();
+    for (int round = 0; round < numRounds; ++round) {
+        std::vector<std::unique_ptr<PDrum>> instances(
+                static_cast<size_t>(numInstances));
+        double projectTime = 0.0;
+        for (auto &instance: instances) {
+            const double construct =
+                    timeMs([&] { instance = std::make_unique<PDrum>(); });
+            const double restore = timeMs([&] {
+                instance->setStateInformation(
+                        savedState.getData(),
+                        static_cast<int>(savedState.getSize()));
+            });
+            const double prepare = timeMs(
+                    [&] { instance->prepareToPlay(sampleRate, blockSize); });
+            load[0].times.push_back(construct);
+            load[1].times.push_back(restore);
+            load[2].times.push_back(prepare);
+            projectTime += construct + restore + prepare;
+        }
+        /// Opening and closing an editor that is never shown must not
+        /// create a graphics context
+        if (withEditor) {
+            for (auto &instance: instances) {
+                load[3].times.push_back(timeMs([&] {
+                    std::unique_ptr<juce::AudioProcessorEditor> editor(
+                            instance->createEditor());
+                }));
+            }
+        }
+        for (auto &instance: instances) {
+            load[4].times.push_back(
+                    timeMs([&] { instance->releaseResources(); }));
+            load[5].times.push_back(timeMs([&] { instance.reset(); }));
+        }
+        projectTimes.push_back(projectTime);
+    }
+    const auto loadEnd = counters.read();
+    printReport("Project load", load);
+    std::sort(projectTimes.begin(), projectTimes.end());
+    std::cout << "Loading " << numInstances << " instances took "
+              << std::fixed << std::setprecision(1)
+              << projectTimes[projectTimes.size() / 2] << " ms (median of "
+              << numRounds << " rounds)\n";
+    printCounters(counters, loadStart, loadEnd,
+                  {{"per instance", static_cast<double>(numInstances) *
+                                            numRounds}});
+
+    /// The parameters at their defaults, read by every membrane
+    PDrum parameterSource;
+    for (const auto &grid: grids)
+        benchmarkMembrane(counters, parameterSource.getParameters(),
+                          grid.getIntValue(), sampleRate, blockSize, seconds);
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include "PerfCounters.h"
+#if defined(__linux__)
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define PDRUM_HAS_PERF_EVENTS 1
+#endif
+
+#if PDRUM_HAS_PERF_EVENTS
+/**
+ * @brief Builds the perf_event_attr config of a hardware cache read miss.
+ * @param cache The PERF_COUNT_HW_CACHE_* cache.
+ * @return The config.
+ */
+static constexpr juce::uint64 cacheReadMiss(const juce::uint64 cache) {
+    return cache | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+           PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+}
+
+/**
+ * @brief Type and config of each event, in the order of PerfCounters::Event.
+ */
+static constexpr std::pair<juce::uint32, juce::uint64>
+        eventConfigs[PerfCounters::numEvents] = {
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+                {PERF_TYPE_HW_CACHE, cacheReadMiss(PERF_COUNT_HW_CACHE_L1D)},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+                {PERF_TYPE_HW_CACHE, cacheReadMiss(PERF_COUNT_HW_CACHE_DTLB)},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+#endif
+
+/**
+ * @brief Opens and starts every counter. Construct before anything
+ * starts threads that should be counted.
+ */
+PerfCounters::PerfCounters() {
+    counters.fill(-1);
+#if PDRUM_HAS_PERF_EVENTS
+    for (int i = 0; i < numEvents; ++i) {
+        perf_event_attr attributes;
+        std::memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = eventConfigs[i].first;
+        attributes.config = eventConfigs[i].second;
+        attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                                 PERF_FORMAT_TOTAL_TIME_RUNNING;
+        /// Follow the worker threads started later
+        attributes.inherit = 1;
+        /// Counting the kernel needs privileges most users lack
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        counters[static_cast<size_t>(i)] = static_cast<int>(
+                syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+        if (counters[static_cast<size_t>(i)] < 0 && error.isEmpty())
+            error = juce::String(getName(static_cast<Event>(i))) + ": " +
+                    std::strerror(errno);
+    }
+#else
+    error = "hardware counters need Linux perf_event_open";
+#endif
+}
+
+/**
+ * @brief Destructor for PerfCounters. Closes the counters.
+ */
+PerfCounters::~PerfCounters() {
+#if PDRUM_HAS_PERF_EVENTS
+    for (const int counter: counters)
+        if (counter >= 0)
+            close(counter);
+#endif
+}
+
+/**
+ * @brief Checks whether any counter could be opened.
+ * @return True if at least one event is counted.
+ */
+bool PerfCounters::isAvailable() const {
+    return std::any_of(counters.begin(), counters.end(),
+                       [](const int counter) { return counter >= 0; });
+}
+
+/**
+ * @brief Reads every counter.
+ * @return The counts.
+ */
+PerfCounters::Snapshot PerfCounters::read() const {
+    Snapshot snapshot{};
+#if PDRUM_HAS_PERF_EVENTS
+    for (size_t i = 0; i < counters.size(); ++i) {
+        /// The value, then the enabled and running times
+        juce::uint64 values[3] = {};
+        if (counters[i] >= 0 &&
+            ::read(counters[i], values, sizeof(values)) ==
+                    static_cast<ssize_t>(sizeof(values)))
+            snapshot[i] = {values[0], values[1], values[2]};
+    }
+#endif
+    return snapshot;
+}
+
+/**
+ * @brief Gets the number of events between two snapshots, scaled up for
+ * the time the counter was multiplexed out.
+ * @param before The earlier snapshot.
+ * @param after The later snapshot.
+ * @param event The event.
+ * @return The count, or -1 if the event is unavailable or never ran.
+ */
+double PerfCounters::countBetween(const Snapshot &before,
+                                  const Snapshot &after,
+                                  const Event event) const {
+    const auto index = static_cast<size_t>(event);
+    if (counters[index] < 0)
+        return -1.0;
+    const auto &[value0, enabled0, running0] = before[index];
+    const auto &[value1, enabled1, running1] = after[index];
+    if (running1 <= running0)
+        return -1.0;
+    return static_cast<double>(value1 - value0) *
+           static_cast<double>(enabled1 - enabled0) /
+           static_cast<double>(running1 - running0);
+}
+
+/**
+ * @brief Gets the name of an event as printed in reports.
+ * @param event The event.
+ * @return The name.
+ */
+const char *PerfCounters::getName(const Event event) {
+    switch (event) {
+        case cycles:
+            return "cycles";
+        case instructions:
+            return "instructions";
+        case l1Misses:
+            return "L1D misses";
+        case l2Misses:
+            return "L2 misses";
+        case llcMisses:
+            return "LLC misses";
+        case dtlbMisses:
+            return "dTLB misses";
+        case branchMisses:
+            return "branch misses";
+        default:
+            return "";
+    }
+}
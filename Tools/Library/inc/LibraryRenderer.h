@@ -0,0 +1,192 @@
+#ifndef LIBRARY_RENDERER_H
+#define LIBRARY_RENDERER_H
+
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <vector>
+
+/**
+ * @brief Renders a multisample library: one drum hit for every combination
+ * of size, depth, tension, velocity, strike position and round-robin of a
+ * sweep.
+ *
+ * Every sample is an independent job on a thread pool. A job prepares a
+ * fresh processor for its size, depth and tension, strikes its membrane
+ * once and runs the membrane and the modal resonator directly, without
+ * the block processing of the plugin. The tail is cut once its level has
+ * stayed below a threshold relative to the peak for a hold time, with a
+ * short fade, and the sample is written to its own WAV or FLAC file as
+ * soon as it is done. Round-robins jitter the strike position with a seed
+ * derived from the sample index, so a library renders the same on any
+ * number of threads.
+ */
+class LibraryRenderer final {
+public:
+    /**
+     * @brief The values swept; every combination is rendered.
+     */
+    struct Sweep {
+        /** Sizes of the membrane, in the membraneSize range */
+        std::vector<float> sizes{5.0f};
+
+        /** Depths of the drum body, in the depth range */
+        std::vector<float> depths{5.0f};
+
+        /** Tensions of the membrane, in the membraneTension range */
+        std::vector<float> tensions{0.5f};
+
+        /** Velocities of the strike, from 0 to 1 */
+        std::vector<float> velocities{1.0f};
+
+        /** Distances of the strike from the centre, as a fraction of the
+         * radius up to maxPosition */
+        std::vector<float> positions{0.0f};
+
+        /** Number of round-robins of every combination */
+        int numRoundRobins = 1;
+    };
+
+    /**
+     * @brief Settings shared by every sample of a library.
+     */
+    struct Settings {
+        /** Sample rate of the samples. */
+        double sampleRate = 48000.0;
+
+        /** Bit depth of the files. */
+        int bitsPerSample = 24;
+
+        /** Number of channels of the files, each a copy of the drum. */
+        int numChannels = 1;
+
+        /** Extension of the files, "wav" or "flac". */
+        juce::String format = "flac";
+
+        /** Start of every file name. */
+        juce::String prefix = "pdrum";
+
+        /** Longest sample, in seconds. */
+        double maxSeconds = 4.0;
+
+        /** Level below the peak that ends the tail, in decibels. */
+        float trimDecibels = -80.0f;
+
+        /** Time the level must stay below the threshold, in seconds. */
+        double holdSeconds = 0.05;
+
+        /** Fade at the end of the trimmed tail, in seconds. */
+        double fadeSeconds = 0.01;
+
+        /** Largest jitter of the strike position per round-robin, in
+         * cells. */
+        int jitterCells = 2;
+
+        /** Base seed for the strike position jitter. */
+        juce::uint32 seed = 1;
+
+        /** Number of worker threads, or 0 to use every core. */
+        int numThreads = 0;
+
+        /** Number of resonator Bessel zeros, or 0 for the plugin default. */
+        int numRadialModes = 0;
+
+        /** Number of resonator axial orders, or 0 for the plugin default. */
+        int numAxialModes = 0;
+    };
+
+    /**
+     * @brief One sample of the library and, once rendered, its outcome.
+     */
+    struct Sample {
+        /** Swept values of the sample. */
+        float size = 0.0f, depth = 0.0f, tension = 0.0f, velocity = 0.0f,
+              position = 0.0f;
+
+        /** Round-robin of the sample, from 0. */
+        int roundRobin = 0;
+
+        /** Name of the file, without the directory. */
+        juce::String fileName;
+
+        /** Length of the trimmed sample, in samples. */
+        int numSamples = 0;
+
+        /** Largest absolute value of the sample. */
+        float peak = 0.0f;
+
+        /** Whether the file was written. */
+        bool written = false;
+    };
+
+    /** Amplitude of a strike at full velocity, the one a note triggers in
+     * the plugin */
+    static constexpr float strikeAmplitude = 0.25f;
+
+    /** Largest strike position, which keeps the jittered strike inside the
+     * membrane */
+    static constexpr float maxPosition = 0.9f;
+
+    /**
+     * @brief Constructs a LibraryRenderer.
+     * @param settings The settings of every sample.
+     * @param sweep The values to sweep.
+     */
+    LibraryRenderer(Settings settings, Sweep sweep);
+
+    /**
+     * @brief Reads a sweep specification from a JSON file. Every swept
+     * value is a number or an array of numbers; settings the file lacks
+     * keep their value.
+     * @param file The JSON file to read.
+     * @param settings Receives the settings of the file.
+     * @param sweep Receives the sweep of the file.
+     * @param error Receives a description of what is wrong with the file.
+     * @return True if the file was read and every value is in range.
+     */
+    static bool readSpec(const juce::File &file, Settings &settings,
+                         Sweep &sweep, juce::String &error);
+
+    /**
+     * @brief Lists every combination of the sweep, round-robins innermost.
+     * @return The samples, not rendered yet.
+     */
+    [[nodiscard]] std::vector<Sample> listSamples() const;
+
+    /**
+     * @brief Renders the samples in parallel and writes each to a file.
+     * @param directory The directory to write the files to.
+     * @param samples The samples to render; receive their outcome.
+     * @return True if every file was written.
+     */
+    bool render(const juce::File &directory,
+                std::vector<Sample> &samples) const;
+
+    /**
+     * @brief Writes a JSON manifest of the rendered samples.
+     * @param file The manifest file to write.
+     * @param samples The rendered samples.
+     * @return True if the file was written.
+     */
+    bool writeManifest(const juce::File &file,
+                       const std::vector<Sample> &samples) const;
+
+private:
+    /**
+     * @brief Renders one sample on a fresh processor and trims its tail.
+     * @param sample The sample to render.
+     * @param sampleIndex Index of the sample, used to derive its seed.
+     * @return The trimmed sample, one channel.
+     */
+    [[nodiscard]] juce::AudioBuffer<float>
+    renderSample(const Sample &sample, size_t sampleIndex) const;
+
+    /** Samples over which the level of the tail is measured */
+    static constexpr int trimBlockSize = 256;
+
+    /** Settings of every sample */
+    Settings settings;
+
+    /** Values swept */
+    Sweep sweep;
+};
+
+#endif // LIBRARY_RENDERER_H
@@ -0,0 +1,346 @@
+#include "LibraryRenderer.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <random>
+#include "OfflineRenderer.h"
+#include "PDrum.h"
+
+/**
+ * @brief Guards construction and destruction of processor instances, which
+ * register timers and listeners that are not safe to create concurrently.
+ */
+static juce::CriticalSection instanceLock;
+
+/**
+ * @brief Reads a swept value of a specification.
+ * @param spec The specification.
+ * @param name The name of the value.
+ * @param minimum The smallest value allowed.
+ * @param maximum The largest value allowed.
+ * @param values Receives the values, unchanged if the specification lacks
+ * them.
+ * @param error Receives a description of a value out of range.
+ * @return False if a value is out of range or the array is empty.
+ */
+static bool readValues(const juce::var &spec, const char *name,
+                       const float minimum, const float maximum,
+                       std::vector<float> &values, juce::String &error) {
+    const auto &value = spec[name];
+    if (value.isVoid())
+        return true;
+    values.clear();
+    if (const auto *array = value.getArray()) {
+        for (const auto &item: *array)
+            values.push_back(static_cast<float>(item));
+    } else {
+        values.push_back(static_cast<float>(value));
+    }
+    for (const float v: values) {
+        if (v < minimum || v > maximum) {
+            error = juce::String("Value out of range for ") + name;
+            return false;
+        }
+    }
+    if (values.empty()) {
+        error = juce::String("No values for ") + name;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Constructs a LibraryRenderer.
+ * @param settings The settings of every sample.
+ * @param sweep The values to sweep.
+ */
+LibraryRenderer::LibraryRenderer(Settings settings, Sweep sweep) :
+    settings(std::move(settings)), sweep(std::move(sweep)) {}
+
+/**
+ * @brief Reads a sweep specification from a JSON file. Every swept
+ * value is a number or an array of numbers; settings the file lacks
+ * keep their value.
+ * @param file The JSON file to read.
+ * @param settings Receives the settings of the file.
+ * @param sweep Receives the sweep of the file.
+ * @param error Receives a description of what is wrong with the file.
+ * @return True if the file was read and every value is in range.
+ */
+bool LibraryRenderer::readSpec(const juce::File &file, Settings &settings,
+                               Sweep &sweep, juce::String &error) {
+    const auto spec = juce::JSON::parse(file);
+    if (!spec.isObject()) {
+        error = "Could not read " + file.getFullPathName();
+        return false;
+    }
+    const auto option = [&spec](const char *name, const juce::var &fallback) {
+        return spec.getProperty(name, fallback);
+    };
+    settings.sampleRate = option("sampleRate", settings.sampleRate);
+    settings.bitsPerSample = option("bits", settings.bitsPerSample);
+    settings.numChannels = option("channels", settings.numChannels);
+    settings.format = option("format", settings.format).toString();
+    settings.prefix = option("prefix", settings.prefix).toString();
+    settings.maxSeconds = option("maxSeconds", settings.maxSeconds);
+    settings.trimDecibels = option("trimDb", settings.trimDecibels);
+    settings.holdSeconds = option("holdSeconds", settings.holdSeconds);
+    settings.fadeSeconds = option("fadeSeconds", settings.fadeSeconds);
+    settings.jitterCells = option("jitterCells", settings.jitterCells);
+    settings.seed = static_cast<juce::uint32>(static_cast<juce::int64>(
+            option("seed", static_cast<juce::int64>(settings.seed))));
+    settings.numRadialModes = option("radialModes", settings.numRadialModes);
+    settings.numAxialModes = option("axialModes", settings.numAxialModes);
+    sweep.numRoundRobins = option("roundRobins", sweep.numRoundRobins);
+    if (settings.sampleRate <= 0.0 || settings.numChannels <= 0 ||
+        settings.maxSeconds <= 0.0 || settings.holdSeconds < 0.0 ||
+        settings.fadeSeconds < 0.0 || settings.jitterCells < 0 ||
+        sweep.numRoundRobins <= 0) {
+        error = "Invalid settings in " + file.getFullPathName();
+        return false;
+    }
+    if (settings.format != "wav" && settings.format != "flac") {
+        error = "The format must be wav or flac";
+        return false;
+    }
+
+    /// Check the swept parameters against the plugin's own ranges
+    PDrum probe;
+    const auto rangeOf = [&probe](const char *parameterID) {
+        return dynamic_cast<juce::AudioParameterFloat *>(
+                       probe.getParameters().getParameter(parameterID))
+                ->range;
+    };
+    const auto sizeRange = rangeOf("membraneSize");
+    const auto depthRange = rangeOf("depth");
+    const auto tensionRange = rangeOf("membraneTension");
+    return readValues(spec, "size", sizeRange.start, sizeRange.end,
+                      sweep.sizes, error) &&
+           readValues(spec, "depth", depthRange.start, depthRange.end,
+                      sweep.depths, error) &&
+           readValues(spec, "tension", tensionRange.start, tensionRange.end,
+                      sweep.tensions, error) &&
+           readValues(spec, "velocity", 0.0f, 1.0f, sweep.velocities,
+                      error) &&
+           readValues(spec, "position", 0.0f, maxPosition, sweep.positions,
+                      error);
+}
+
+/**
+ * @brief Lists every combination of the sweep, round-robins innermost.
+ * @return The samples, not rendered yet.
+ */
+std::vector<LibraryRenderer::Sample> LibraryRenderer::listSamples() const {
+    std::vector<Sample> samples;
+    for (const float size: sweep.sizes)
+        for (const float depth: sweep.depths)
+            for (const float tension: sweep.tensions)
+                for (const float velocity: sweep.velocities)
+                    for (const float position: sweep.positions)
+                        for (int rr = 0; rr < sweep.numRoundRobins; ++rr) {
+                            Sample sample;
+                            sample.size = size;
+                            sample.depth = depth;
+                            sample.tension = tension;
+                            sample.velocity = velocity;
+                            sample.position = position;
+                            sample.roundRobin = rr;
+                            sample.fileName =
+                                    settings.prefix + "_s" +
+                                    juce::String(size, 2) + "_d" +
+                                    juce::String(depth, 2) + "_t" +
+                                    juce::String(tension, 2) + "_v" +
+                                    juce::String(velocity, 2) + "_p" +
+                                    juce::String(position, 2) + "_rr" +
+                                    juce::String(rr + 1) + "." +
+                                    settings.format;
+                            samples.push_back(sample);
+                        }
+    return samples;
+}
+
+/**
+ * @brief Renders the samples in parallel and writes each to a file.
+ * @param directory The directory to write the files to.
+ * @param samples The samples to render; receive their outcome.
+ * @return True if every file was written.
+ */
+bool LibraryRenderer::render(const juce::File &directory,
+                             std::vector<Sample> &samples) const {
+    if (!directory.createDirectory())
+        return false;
+    const int numThreads =
+            settings.numThreads > 0
+                    ? settings.numThreads
+                    : juce::SystemStats::getNumCpus();
+    {
+        juce::ThreadPool pool(numThreads);
+        std::atomic<size_t> nextSample{0};
+        std::atomic<int> finishedWorkers{0};
+        juce::WaitableEvent allFinished;
+        for (int t = 0; t < numThreads; ++t) {
+            pool.addJob([&] {
+                for (size_t i = nextSample++; i < samples.size();
+                     i = nextSample++) {
+                    auto &sample = samples[i];
+                    const auto drum = renderSample(sample, i);
+                    const int length = drum.getNumSamples();
+                    juce::AudioBuffer<float> audio(settings.numChannels,
+                                                   length);
+                    for (int ch = 0; ch < settings.numChannels; ++ch)
+                        audio.copyFrom(ch, 0, drum, 0, 0, length);
+                    sample.numSamples = length;
+                    sample.peak = drum.getMagnitude(0, 0, length);
+                    /// Written as soon as rendered, so memory does not grow
+                    /// with the library
+                    sample.written = OfflineRenderer::writeAudioFile(
+                            directory.getChildFile(sample.fileName), audio,
+                            settings.sampleRate, settings.bitsPerSample);
+                }
+                if (++finishedWorkers == numThreads)
+                    allFinished.signal();
+            });
+        }
+        allFinished.wait();
+    }
+    return std::all_of(samples.begin(), samples.end(),
+                       [](const Sample &sample) { return sample.written; });
+}
+
+/**
+ * @brief Renders one sample on a fresh processor and trims its tail.
+ * @param sample The sample to render.
+ * @param sampleIndex Index of the sample, used to derive its seed.
+ * @return The trimmed sample, one channel.
+ */
+juce::AudioBuffer<float>
+LibraryRenderer::renderSample(const Sample &sample,
+                              const size_t sampleIndex) const {
+    std::unique_ptr<PDrum> drum;
+    {
+        const juce::ScopedLock lock(instanceLock);
+        drum = std::make_unique<PDrum>();
+        const auto setParameter = [&drum](const char *parameterID,
+                                          const float value) {
+            auto *parameter = drum->getParameters().getParameter(parameterID);
+            parameter->setValueNotifyingHost(parameter->convertTo0to1(value));
+        };
+        setParameter("membraneSize", sample.size);
+        setParameter("depth", sample.depth);
+        setParameter("membraneTension", sample.tension);
+        /// Only the live membrane and resonator are driven below
+        setParameter("offlineQuality", 0.0f);
+    }
+    if (settings.numRadialModes > 0 && settings.numAxialModes > 0)
+        drum->setResonatorModeCount(settings.numRadialModes,
+                                    settings.numAxialModes);
+    drum->setNonRealtime(true);
+    drum->setRateAndBufferSizeDetails(settings.sampleRate, trimBlockSize);
+    drum->prepareToPlay(settings.sampleRate, trimBlockSize);
+    auto &membrane = drum->getModel();
+    auto &resonator = drum->getResonatorModel();
+
+    /// Every sample draws its jitter from a seed of its own, so the result
+    /// does not depend on which thread renders it
+    std::mt19937 rng(settings.seed +
+                     static_cast<juce::uint32>(sampleIndex) * 0x9E3779B9u);
+    std::uniform_int_distribution<int> jitter(-settings.jitterCells,
+                                              settings.jitterCells);
+    const int limit = static_cast<int>(
+            maxPosition * static_cast<float>(membrane.getGridResolution()) /
+            2.0f);
+    const int offsetX = juce::jlimit(
+            -limit, limit,
+            juce::roundToInt(sample.position * static_cast<float>(limit) /
+                             maxPosition) +
+                    jitter(rng));
+    const int offsetY = juce::jlimit(-limit, limit, jitter(rng));
+    membrane.exciteOffset(strikeAmplitude * sample.velocity, offsetX, offsetY);
+
+    const int maxSamples = std::max(
+            1, static_cast<int>(
+                       std::ceil(settings.maxSeconds * settings.sampleRate)));
+    const int holdSamples = static_cast<int>(
+            std::ceil(settings.holdSeconds * settings.sampleRate));
+    const float threshold =
+            juce::Decibels::decibelsToGain(settings.trimDecibels, -1000.0f);
+    const auto inverseSampleRate =
+            static_cast<float>(1.0 / settings.sampleRate);
+    juce::AudioBuffer<float> output(1, maxSamples);
+    float *samples = output.getWritePointer(0);
+    float peak = 0.0f;
+    int quietStart = -1, length = maxSamples;
+    for (int start = 0; start < maxSamples; start += trimBlockSize) {
+        const int end = std::min(start + trimBlockSize, maxSamples);
+        float energy = 0.0f;
+        membrane.beginBlock(end - start);
+        for (int i = start; i < end; ++i) {
+            samples[i] = resonator.process(
+                    membrane.processSample(inverseSampleRate));
+            peak = std::max(peak, std::abs(samples[i]));
+            energy += samples[i] * samples[i];
+        }
+        /// The tail ends where the level dropped below the threshold for
+        /// good, which a silent start before the peak never does
+        const float level =
+                std::sqrt(energy / static_cast<float>(end - start));
+        if (level >= peak * threshold) {
+            quietStart = -1;
+            continue;
+        }
+        if (quietStart < 0)
+            quietStart = start;
+        if (end - quietStart >= holdSamples) {
+            length = end;
+            break;
+        }
+    }
+    /// Fade out after the level dropped, or at the end of the longest
+    /// sample
+    const int fadeSamples = static_cast<int>(
+            std::ceil(settings.fadeSeconds * settings.sampleRate));
+    if (quietStart >= 0)
+        length = std::min(length, quietStart + fadeSamples);
+    const int fadeLength = std::min(fadeSamples, length);
+    if (fadeLength > 0)
+        output.applyGainRamp(0, length - fadeLength, fadeLength, 1.0f, 0.0f);
+    output.setSize(1, length, true);
+    {
+        const juce::ScopedLock lock(instanceLock);
+        drum.reset();
+    }
+    return output;
+}
+
+/**
+ * @brief Writes a JSON manifest of the rendered samples.
+ * @param file The manifest file to write.
+ * @param samples The rendered samples.
+ * @return True if the file was written.
+ */
+bool LibraryRenderer::writeManifest(const juce::File &file,
+                                    const std::vector<Sample> &samples) const {
+    juce::var entries;
+    for (const auto &sample: samples) {
+        if (!sample.written)
+            continue;
+        auto *entry = new juce::DynamicObject();
+        entry->setProperty("file", sample.fileName);
+        entry->setProperty("size", sample.size);
+        entry->setProperty("depth", sample.depth);
+        entry->setProperty("tension", sample.tension);
+        entry->setProperty("velocity", sample.velocity);
+        entry->setProperty("position", sample.position);
+        entry->setProperty("roundRobin", sample.roundRobin + 1);
+        entry->setProperty("seconds", sample.numSamples / settings.sampleRate);
+        entry->setProperty("peak", sample.peak);
+        entries.append(juce::var(entry));
+    }
+    auto *manifest = new juce::DynamicObject();
+    manifest->setProperty("sampleRate", settings.sampleRate);
+    manifest->setProperty("bitsPerSample", settings.bitsPerSample);
+    manifest->setProperty("channels", settings.numChannels);
+    manifest->setProperty("trimDb", settings.trimDecibels);
+    manifest->setProperty("samples", entries);
+    return file.replaceWithText(juce::JSON::toString(juce::var(manifest)));
+}
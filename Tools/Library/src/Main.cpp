@@ -0,0 +1,73 @@
+#include <iostream>
+#include <juce_audio_processors/juce_audio_processors.h>
+#include "LibraryRenderer.h"
+
+/**
+ * @brief Prints the command line usage.
+ */
+static void printUsage() {
+    std::cerr << "Usage: pdrum_library --spec <sweep.json>"
+                 " --output <directory>\n"
+                 "                     [--jobs 0]\n";
+}
+
+/**
+ * @brief Entry point for the sample library renderer. Renders every
+ * combination of the sweep in the specification to its own file in the
+ * output directory and writes a manifest.json listing them.
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments.
+ * @return Zero on success.
+ */
+int main(int argc, char *argv[]) {
+    const juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    const juce::ArgumentList args(argc, argv);
+    if (!args.containsOption("--spec") || !args.containsOption("--output")) {
+        printUsage();
+        return 1;
+    }
+    const auto workingDirectory = juce::File::getCurrentWorkingDirectory();
+    const auto specFile =
+            workingDirectory.getChildFile(args.getValueForOption("--spec"));
+    const auto outputDirectory =
+            workingDirectory.getChildFile(args.getValueForOption("--output"));
+
+    LibraryRenderer::Settings settings;
+    LibraryRenderer::Sweep sweep;
+    if (juce::String error;
+        !LibraryRenderer::readSpec(specFile, settings, sweep, error)) {
+        std::cerr << error << "\n";
+        return 1;
+    }
+    if (args.containsOption("--jobs"))
+        settings.numThreads = args.getValueForOption("--jobs").getIntValue();
+
+    const LibraryRenderer renderer(settings, sweep);
+    auto samples = renderer.listSamples();
+    std::cout << "Rendering " << samples.size() << " samples to "
+              << outputDirectory.getFullPathName() << "\n";
+    const double startTime = juce::Time::getMillisecondCounterHiRes();
+    const bool allWritten = renderer.render(outputDirectory, samples);
+    const double elapsedSeconds =
+            (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+    const auto manifestFile = outputDirectory.getChildFile("manifest.json");
+    if (!renderer.writeManifest(manifestFile, samples)) {
+        std::cerr << "Could not write " << manifestFile.getFullPathName()
+                  << "\n";
+        return 1;
+    }
+    double audioSeconds = 0.0;
+    size_t numFailed = 0;
+    for (const auto &sample: samples) {
+        audioSeconds += sample.numSamples / settings.sampleRate;
+        if (!sample.written) {
+            std::cerr << "Could not write " << sample.fileName << "\n";
+            ++numFailed;
+        }
+    }
+    std::cout << "Rendered " << samples.size() - numFailed << " samples: "
+              << audioSeconds << " s of audio in " << elapsedSeconds
+              << " s (" << audioSeconds / std::max(elapsedSeconds, 1.0e-9)
+              << "x real time)\n";
+    return allWritten ? 0 : 1;
+}
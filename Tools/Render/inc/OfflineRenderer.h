@@ -0,0 +1,149 @@
+#ifndef OFFLINE_RENDERER_H
+#define OFFLINE_RENDERER_H
+
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <juce_audio_formats/juce_audio_formats.h>
+#include <vector>
+
+/**
+ * @brief Renders note events through independent PDrum instances, faster
+ * than real time and in parallel.
+ *
+ * Notes are grouped into segments separated by at least the tail length.
+ * Every segment starts from a silent drum, so segments are rendered
+ * concurrently on separate processor instances and then summed into the
+ * output in segment order, which makes the result independent of the number
+ * of threads.
+ */
+class OfflineRenderer final {
+public:
+    /**
+     * @brief A single note-on to render.
+     */
+    struct NoteEvent {
+        /** Position of the note in samples from the start of the render. */
+        juce::int64 samplePosition = 0;
+
+        /** MIDI note number. */
+        int noteNumber = 60;
+
+        /** Velocity in the range 0 to 1. */
+        float velocity = 1.0f;
+    };
+
+    /**
+     * @brief A group of notes that is rendered by one processor instance.
+     */
+    struct Segment {
+        /** First note of the segment. */
+        size_t firstNote = 0;
+
+        /** One past the last note of the segment. */
+        size_t endNote = 0;
+
+        /** First output sample rendered by the segment. */
+        juce::int64 startSample = 0;
+
+        /** Number of samples rendered by the segment. */
+        juce::int64 numSamples = 0;
+    };
+
+    /**
+     * @brief Settings shared by every segment of a render.
+     */
+    struct Settings {
+        /** Sample rate of the render. */
+        double sampleRate = 48000.0;
+
+        /** Block size passed to processBlock. */
+        int blockSize = 512;
+
+        /** Number of output channels. */
+        int numChannels = 2;
+
+        /** Silence after a note before a new segment may start, in seconds. */
+        double tailSeconds = 2.0;
+
+        /** Number of worker threads, or 0 to use every core. */
+        int numThreads = 0;
+
+        /** Base seed for the strike position randomness. */
+        juce::uint32 seed = 1;
+
+        /** Number of resonator Bessel zeros, or 0 for the plugin default. */
+        int numRadialModes = 0;
+
+        /** Number of resonator axial orders, or 0 for the plugin default. */
+        int numAxialModes = 0;
+
+        /** Resonator engine index, or -1 for the plugin default. */
+        int resonatorEngine = -1;
+
+        /** Offline quality index, or -1 for the plugin default. */
+        int offlineQuality = -1;
+
+        /** Parameter values applied to every instance before rendering. */
+        std::vector<std::pair<juce::String, float>> parameters;
+    };
+
+    /**
+     * @brief Constructs an OfflineRenderer.
+     * @param settings The settings used for every segment.
+     */
+    explicit OfflineRenderer(Settings settings);
+
+    /**
+     * @brief Splits sorted note events into independent segments.
+     * @param notes The note events, sorted by position.
+     * @return The segments covering every note.
+     */
+    [[nodiscard]] std::vector<Segment>
+    findSegments(const std::vector<NoteEvent> &notes) const;
+
+    /**
+     * @brief Renders the note events.
+     * @param notes The note events, sorted by position.
+     * @return The rendered audio.
+     */
+    [[nodiscard]] juce::AudioBuffer<float>
+    render(const std::vector<NoteEvent> &notes) const;
+
+    /**
+     * @brief Reads the note-on events of every track of a MIDI file.
+     * @param file The MIDI file to read.
+     * @param sampleRate The sample rate used to convert event times.
+     * @param notes Receives the note events, sorted by position.
+     * @return True if the file was read successfully.
+     */
+    static bool readMidiFile(const juce::File &file, double sampleRate,
+                             std::vector<NoteEvent> &notes);
+
+    /**
+     * @brief Writes audio to a WAV or FLAC file, chosen by file extension.
+     * @param file The file to write.
+     * @param audio The audio to write.
+     * @param sampleRate The sample rate of the audio.
+     * @param bitsPerSample The bit depth of the file.
+     * @return True if the file was written successfully.
+     */
+    static bool writeAudioFile(const juce::File &file,
+                               const juce::AudioBuffer<float> &audio,
+                               double sampleRate, int bitsPerSample);
+
+private:
+    /**
+     * @brief Renders one segment on a fresh processor instance.
+     * @param notes All note events of the render.
+     * @param segment The segment to render.
+     * @param segmentIndex Index of the segment, used to derive its seed.
+     * @return The rendered segment.
+     */
+    [[nodiscard]] juce::AudioBuffer<float>
+    renderSegment(const std::vector<NoteEvent> &notes, const Segment &segment,
+                  size_t segmentIndex) const;
+
+    /** Settings used for every segment */
+    Settings settings;
+};
+
+#endif // OFFLINE_RENDERER_H
@@ -0,0 +1,180 @@
+#include <iostream>
+#include <juce_audio_processors/juce_audio_processors.h>
+#include "OfflineRenderer.h"
+#include "PDrum.h"
+#include "TraceRecorder.h"
+
+/**
+ * @brief Command line options that map directly onto plugin parameters.
+ */
+static const std::pair<const char *, const char *> parameterOptions[] = {
+        {"--tension", "membraneTension"},
+        {"--size", "membraneSize"},
+        {"--depth", "depth"},
+        {"--randomness", "randomness"},
+};
+
+/**
+ * @brief Names accepted by --engine, in the order of the resonatorEngine
+ * parameter choices.
+ */
+static const char *const engineNames[] = {"modal", "convolution",
+                                          "convolution-low-cpu"};
+
+/**
+ * @brief Names accepted by --quality, in the order of the offlineQuality
+ * parameter choices.
+ */
+static const char *const qualityNames[] = {"live", "high", "maximum"};
+
+/**
+ * @brief Prints the command line usage.
+ */
+static void printUsage() {
+    std::cerr << "Usage: pdrum_render --midi <file.mid>"
+                 " --output <file.wav|flac>\n"
+                 "                    [--rate 48000] [--block 512]"
+                 " [--bits 24]\n"
+                 "                    [--channels 2] [--tail 2.0] [--jobs 0]\n"
+                 "                    [--seed 1] [--tension <value>]\n"
+                 "                    [--size <value>] [--depth <value>]\n"
+                 "                    [--randomness <value>]\n"
+                 "                    [--radial-modes <count>]\n"
+                 "                    [--axial-modes <count>]\n"
+                 "                    [--engine modal|convolution|"
+                 "convolution-low-cpu]\n"
+                 "                    [--quality live|high|maximum]\n"
+                 "                    [--trace <file.json>]\n";
+}
+
+/**
+ * @brief Entry point for the offline renderer.
+ * @param argc The number of command line arguments.
+ * @param argv The command line arguments.
+ * @return Zero on success.
+ */
+int main(int argc, char *argv[]) {
+    const juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    const juce::ArgumentList args(argc, argv);
+    if (!args.containsOption("--midi") || !args.containsOption("--output")) {
+        printUsage();
+        return 1;
+    }
+    const auto workingDirectory = juce::File::getCurrentWorkingDirectory();
+    const auto midiFile =
+            workingDirectory.getChildFile(args.getValueForOption("--midi"));
+    const auto outputFile =
+            workingDirectory.getChildFile(args.getValueForOption("--output"));
+    const auto optionOr = [&](const char *option,
+                              const juce::String &fallback) {
+        return args.containsOption(option) ? args.getValueForOption(option)
+                                           : fallback;
+    };
+
+    OfflineRenderer::Settings settings;
+    settings.sampleRate = optionOr("--rate", "48000").getDoubleValue();
+    settings.blockSize = optionOr("--block", "512").getIntValue();
+    settings.numChannels = optionOr("--channels", "2").getIntValue();
+    settings.tailSeconds = optionOr("--tail", "2.0").getDoubleValue();
+    settings.numThreads = optionOr("--jobs", "0").getIntValue();
+    settings.seed = static_cast<juce::uint32>(
+            optionOr("--seed", "1").getLargeIntValue());
+    settings.numRadialModes = optionOr("--radial-modes", "0").getIntValue();
+    settings.numAxialModes = optionOr("--axial-modes", "0").getIntValue();
+    if (args.containsOption("--engine")) {
+        const auto engineName = args.getValueForOption("--engine");
+        for (int i = 0; i < static_cast<int>(std::size(engineNames)); ++i) {
+            if (engineName == engineNames[i])
+                settings.resonatorEngine = i;
+        }
+        if (settings.resonatorEngine < 0) {
+            printUsage();
+            return 1;
+        }
+    }
+    if (args.containsOption("--quality")) {
+        const auto qualityName = args.getValueForOption("--quality");
+        for (int i = 0; i < static_cast<int>(std::size(qualityNames)); ++i) {
+            if (qualityName == qualityNames[i])
+                settings.offlineQuality = i;
+        }
+        if (settings.offlineQuality < 0) {
+            printUsage();
+            return 1;
+        }
+    }
+#if !PDRUM_ENABLE_TRACING
+    if (args.containsOption("--trace")) {
+        std::cerr << "--trace needs a build with PDRUM_ENABLE_TRACING=ON\n";
+        return 1;
+    }
+#endif
+    const int bitsPerSample = optionOr("--bits", "24").getIntValue();
+    if (settings.sampleRate <= 0.0 || settings.blockSize <= 0 ||
+        settings.numChannels <= 0 || settings.tailSeconds <= 0.0) {
+        printUsage();
+        return 1;
+    }
+
+    /// Validate parameter values against the plugin's own ranges
+    {
+        PDrum probe;
+        for (const auto &[option, parameterID]: parameterOptions) {
+            if (!args.containsOption(option))
+                continue;
+            const float value = args.getValueForOption(option).getFloatValue();
+            const auto *parameter = dynamic_cast<juce::AudioParameterFloat *>(
+                    probe.getParameters().getParameter(parameterID));
+            if (parameter == nullptr || value < parameter->range.start ||
+                value > parameter->range.end) {
+                std::cerr << "Value out of range for " << option << "\n";
+                return 1;
+            }
+            settings.parameters.emplace_back(parameterID, value);
+        }
+    }
+
+    std::vector<OfflineRenderer::NoteEvent> notes;
+    if (!OfflineRenderer::readMidiFile(midiFile, settings.sampleRate, notes)) {
+        std::cerr << "Could not read MIDI file "
+                  << midiFile.getFullPathName() << "\n";
+        return 1;
+    }
+    if (notes.empty()) {
+        std::cerr << "No notes found in " << midiFile.getFullPathName()
+                  << "\n";
+        return 1;
+    }
+
+    const OfflineRenderer renderer(settings);
+    const auto numSegments = renderer.findSegments(notes).size();
+    const double startTime = juce::Time::getMillisecondCounterHiRes();
+    const auto audio = renderer.render(notes);
+    const double elapsedSeconds =
+            (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+    if (!OfflineRenderer::writeAudioFile(outputFile, audio,
+                                         settings.sampleRate, bitsPerSample)) {
+        std::cerr << "Could not write " << outputFile.getFullPathName()
+                  << "\n";
+        return 1;
+    }
+#if PDRUM_ENABLE_TRACING
+    if (args.containsOption("--trace")) {
+        const auto traceFile = workingDirectory.getChildFile(
+                args.getValueForOption("--trace"));
+        if (!TraceRecorder::writeChromeTrace(traceFile)) {
+            std::cerr << "Could not write " << traceFile.getFullPathName()
+                      << "\n";
+            return 1;
+        }
+    }
+#endif
+    const double audioSeconds =
+            static_cast<double>(audio.getNumSamples()) / settings.sampleRate;
+    std::cout << "Rendered " << notes.size() << " notes in " << numSegments
+              << " segments: " << audioSeconds << " s of audio in "
+              << elapsedSeconds << " s ("
+              << audioSeconds / std::max(elapsedSeconds, 1.0e-9)
+              << "x real time)\n";
+    return 0;
+}
@@ -0,0 +1,263 @@
+#include "OfflineRenderer.h"
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include "PDrum.h"
+
+/**
+ * @brief Guards construction and destruction of processor instances, which
+ * register timers and listeners that are not safe to create concurrently.
+ */
+static juce::CriticalSection instanceLock;
+
+/**
+ * @brief Constructs an OfflineRenderer.
+ * @param settings The settings used for every segment.
+ */
+OfflineRenderer::OfflineRenderer(Settings settings) :
+    settings(std::move(settings)) {}
+
+/**
+ * @brief Splits sorted note events into independent segments.
+ * @param notes The note events, sorted by position.
+ * @return The segments covering every note.
+ */
+std::vector<OfflineRenderer::Segment>
+OfflineRenderer::findSegments(const std::vector<NoteEvent> &notes) const {
+    std::vector<Segment> segments;
+    if (notes.empty())
+        return segments;
+    const auto tailSamples = static_cast<juce::int64>(
+            std::ceil(settings.tailSeconds * settings.sampleRate));
+    /// Start every segment on the block and simulation step grid a serial
+    /// render would use, so each segment sees the same step phase
+    const juce::int64 alignment =
+            std::lcm(static_cast<juce::int64>(settings.blockSize),
+                     static_cast<juce::int64>(
+                             VibratingMembraneModel::defaultStepInterval));
+    const auto closeSegment = [&](const size_t first, const size_t end) {
+        Segment segment;
+        segment.firstNote = first;
+        segment.endNote = end;
+        segment.startSample =
+                notes[first].samplePosition / alignment * alignment;
+        segment.numSamples = notes[end - 1].samplePosition + tailSamples -
+                             segment.startSample;
+        segments.push_back(segment);
+    };
+    size_t first = 0;
+    for (size_t i = 1; i < notes.size(); ++i) {
+        if (notes[i].samplePosition - notes[i - 1].samplePosition >=
+            tailSamples) {
+            closeSegment(first, i);
+            first = i;
+        }
+    }
+    closeSegment(first, notes.size());
+    return segments;
+}
+
+/**
+ * @brief Renders the note events.
+ * @param notes The note events, sorted by position.
+ * @return The rendered audio.
+ */
+juce::AudioBuffer<float>
+OfflineRenderer::render(const std::vector<NoteEvent> &notes) const {
+    const auto segments = findSegments(notes);
+    juce::int64 totalSamples = 0;
+    for (const auto &segment: segments)
+        totalSamples = std::max(totalSamples,
+                                segment.startSample + segment.numSamples);
+    /// Render the longest segments first to balance the workers
+    std::vector<size_t> order(segments.size());
+    std::iota(order.begin(), order.end(), size_t{0});
+    std::stable_sort(order.begin(), order.end(),
+                     [&](const size_t a, const size_t b) {
+                         return segments[a].numSamples >
+                                segments[b].numSamples;
+                     });
+    std::vector<juce::AudioBuffer<float>> results(segments.size());
+    const int numThreads =
+            settings.numThreads > 0
+                    ? settings.numThreads
+                    : juce::SystemStats::getNumCpus();
+    {
+        juce::ThreadPool pool(numThreads);
+        std::atomic<size_t> nextSegment{0};
+        std::atomic<int> finishedWorkers{0};
+        juce::WaitableEvent allFinished;
+        for (int t = 0; t < numThreads; ++t) {
+            pool.addJob([&] {
+                for (size_t i = nextSegment++; i < order.size();
+                     i = nextSegment++) {
+                    results[order[i]] =
+                            renderSegment(notes, segments[order[i]], order[i]);
+                }
+                if (++finishedWorkers == numThreads)
+                    allFinished.signal();
+            });
+        }
+        allFinished.wait();
+    }
+    /// Sum the segments in order so the result never depends on scheduling
+    juce::AudioBuffer<float> output(settings.numChannels,
+                                    static_cast<int>(totalSamples));
+    output.clear();
+    for (size_t i = 0; i < segments.size(); ++i) {
+        for (int ch = 0; ch < settings.numChannels; ++ch) {
+            output.addFrom(ch, static_cast<int>(segments[i].startSample),
+                           results[i], ch, 0, results[i].getNumSamples());
+        }
+    }
+    return output;
+}
+
+/**
+ * @brief Renders one segment on a fresh processor instance.
+ * @param notes All note events of the render.
+ * @param segment The segment to render.
+ * @param segmentIndex Index of the segment, used to derive its seed.
+ * @return The rendered segment.
+ */
+juce::AudioBuffer<float>
+OfflineRenderer::renderSegment(const std::vector<NoteEvent> &notes,
+                               const Segment &segment,
+                               const size_t segmentIndex) const {
+    std::unique_ptr<PDrum> drum;
+    {
+        const juce::ScopedLock lock(instanceLock);
+        drum = std::make_unique<PDrum>();
+        for (const auto &[parameterID, value]: settings.parameters) {
+            if (auto *parameter =
+                        drum->getParameters().getParameter(parameterID))
+                parameter->setValueNotifyingHost(
+                        parameter->convertTo0to1(value));
+        }
+        if (settings.resonatorEngine >= 0) {
+            auto *parameter =
+                    drum->getParameters().getParameter("resonatorEngine");
+            parameter->setValueNotifyingHost(parameter->convertTo0to1(
+                    static_cast<float>(settings.resonatorEngine)));
+        }
+        if (settings.offlineQuality >= 0) {
+            auto *parameter =
+                    drum->getParameters().getParameter("offlineQuality");
+            parameter->setValueNotifyingHost(parameter->convertTo0to1(
+                    static_cast<float>(settings.offlineQuality)));
+        }
+    }
+    if (settings.numRadialModes > 0 && settings.numAxialModes > 0)
+        drum->setResonatorModeCount(settings.numRadialModes,
+                                    settings.numAxialModes);
+    drum->setNonRealtime(true);
+    drum->setRateAndBufferSizeDetails(settings.sampleRate, settings.blockSize);
+    drum->prepareToPlay(settings.sampleRate, settings.blockSize);
+    drum->setRandomSeed(
+            settings.seed +
+            static_cast<juce::uint32>(segmentIndex) * 0x9E3779B9u);
+
+    const auto numSamples = static_cast<int>(segment.numSamples);
+    juce::AudioBuffer<float> output(settings.numChannels, numSamples);
+    juce::AudioBuffer<float> block(settings.numChannels, settings.blockSize);
+    juce::MidiBuffer midi;
+    size_t nextNote = segment.firstNote;
+    for (int position = 0; position < numSamples;
+         position += settings.blockSize) {
+        const int blockLength =
+                std::min(settings.blockSize, numSamples - position);
+        const juce::int64 blockStart = segment.startSample + position;
+        midi.clear();
+        while (nextNote < segment.endNote &&
+               notes[nextNote].samplePosition < blockStart + blockLength) {
+            const auto &note = notes[nextNote++];
+            midi.addEvent(juce::MidiMessage::noteOn(1, note.noteNumber,
+                                                    note.velocity),
+                          static_cast<int>(note.samplePosition - blockStart));
+        }
+        juce::AudioBuffer<float> view(block.getArrayOfWritePointers(),
+                                      settings.numChannels, blockLength);
+        drum->processBlock(view, midi);
+        for (int ch = 0; ch < settings.numChannels; ++ch)
+            output.copyFrom(ch, position, view, ch, 0, blockLength);
+    }
+    {
+        const juce::ScopedLock lock(instanceLock);
+        drum.reset();
+    }
+    return output;
+}
+
+/**
+ * @brief Reads the note-on events of every track of a MIDI file.
+ * @param file The MIDI file to read.
+ * @param sampleRate The sample rate used to convert event times.
+ * @param notes Receives the note events, sorted by position.
+ * @return True if the file was read successfully.
+ */
+bool OfflineRenderer::readMidiFile(const juce::File &file,
+                                   const double sampleRate,
+                                   std::vector<NoteEvent> &notes) {
+    juce::FileInputStream stream(file);
+    if (!stream.openedOk())
+        return false;
+    juce::MidiFile midiFile;
+    if (!midiFile.readFrom(stream))
+        return false;
+    midiFile.convertTimestampTicksToSeconds();
+    notes.clear();
+    for (int track = 0; track < midiFile.getNumTracks(); ++track) {
+        const auto *sequence = midiFile.getTrack(track);
+        for (int i = 0; i < sequence->getNumEvents(); ++i) {
+            if (const auto &message = sequence->getEventPointer(i)->message;
+                message.isNoteOn()) {
+                NoteEvent note;
+                note.samplePosition = static_cast<juce::int64>(
+                        std::llround(message.getTimeStamp() * sampleRate));
+                note.noteNumber = message.getNoteNumber();
+                note.velocity = message.getFloatVelocity();
+                notes.push_back(note);
+            }
+        }
+    }
+    std::stable_sort(notes.begin(), notes.end(),
+                     [](const NoteEvent &a, const NoteEvent &b) {
+                         return a.samplePosition < b.samplePosition;
+                     });
+    return true;
+}
+
+/**
+ * @brief Writes audio to a WAV or FLAC file, chosen by file extension.
+ * @param file The file to write.
+ * @param audio The audio to write.
+ * @param sampleRate The sample rate of the audio.
+ * @param bitsPerSample The bit depth of the file.
+ * @return True if the file was written successfully.
+ */
+bool OfflineRenderer::writeAudioFile(const juce::File &file,
+                                     const juce::AudioBuffer<float> &audio,
+                                     const double sampleRate,
+                                     const int bitsPerSample) {
+    std::unique_ptr<juce::AudioFormat> format;
+    if (file.hasFileExtension("flac"))
+        format = std::make_unique<juce::FlacAudioFormat>();
+    else if (file.hasFileExtension("wav"))
+        format = std::make_unique<juce::WavAudioFormat>();
+    else
+        return false;
+    file.deleteFile();
+    auto stream = file.createOutputStream();
+    if (stream == nullptr)
+        return false;
+    std::unique_ptr<juce::AudioFormatWriter> writer(format->createWriterFor(
+            stream.get(), sampleRate,
+            static_cast<unsigned int>(audio.getNumChannels()), bitsPerSample,
+            {}, 0));
+    if (writer == nullptr)
+        return false;
+    /// The writer now owns the stream
+    stream.release();
+    return writer->writeFromAudioSampleBuffer(audio, 0,
+                                              audio.getNumSamples());
+}